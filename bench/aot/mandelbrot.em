@@ -0,0 +1,42 @@
+# mandelbrot: prints the Mandelbrot set in characters, then how many points
+# of a finer grid are in it; only numbers and loops, so emilyc can translate it
+
+limit = 200
+
+# iterations before c escapes, up to limit
+escape ^cr ^ci = {
+    zr = 0.0; zi = 0.0
+    n = 0; t = 0
+    while ^(n < limit && zr * zr + zi * zi <= 4) ^(
+        nonlocal t = zr * zr - zi * zi + cr
+        nonlocal zi = 2 * zr * zi + ci
+        nonlocal zr = t
+        nonlocal n = n + 1
+    )
+    n
+}
+
+# loop bodies run in place, so they set variables defined outside them
+x = 0
+y = 0
+while ^(y < 24) ^(
+    nonlocal x = 0
+    while ^(x < 72) ^(
+        print (escape (x / 30 - 1.8) (y / 10 - 1.2) == limit ? "#" : ".")
+        nonlocal x = x + 1
+    )
+    ln
+    nonlocal y = y + 1
+)
+
+inside = 0
+nonlocal y = 0
+while ^(y < 300) ^(
+    nonlocal x = 0
+    while ^(x < 300) ^(
+        if (escape (x / 120 - 2) (y / 120 - 1.25) == limit) ^( nonlocal inside = inside + 1 )
+        nonlocal x = x + 1
+    )
+    nonlocal y = y + 1
+)
+println inside
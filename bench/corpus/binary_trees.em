@@ -0,0 +1,36 @@
+# binary-trees: allocates and walks many short-lived complete binary trees
+# minimum depth 4, maximum depth 10
+
+minDepth = 4
+maxDepth = 10
+
+bottomUp ^depth = {
+    node = [ leaf = depth == 0 ]
+    if (depth > 0) ^(
+        node.left = bottomUp (depth - 1)
+        node.right = bottomUp (depth - 1)
+    )
+    node
+}
+
+check ^tree = {
+    tree.leaf ? 1 : 1 + (check (tree.left)) + (check (tree.right))
+}
+
+print "stretch tree of depth " (maxDepth + 1) " check: " (check (bottomUp (maxDepth + 1))) ln
+
+longLived = bottomUp maxDepth
+
+depth = minDepth
+while ^(depth <= maxDepth) ^(
+    iterations = 1
+    shift = maxDepth - depth + minDepth
+    while ^(shift > 0) ^( iterations = iterations * 2; shift = shift - 1 )
+    total = 0
+    i = 0
+    while ^(i < iterations) ^( total = total + (check (bottomUp depth)); i = i + 1 )
+    print iterations " trees of depth " depth " check: " total ln
+    depth = depth + 2
+)
+
+print "long lived tree of depth " maxDepth " check: " (check longLived) ln
@@ -0,0 +1,402 @@
+# deltablue: incremental dataflow constraint solver
+# chain and projection tests of 100 variables; prints what each test checks
+
+required = 0
+strongPreferred = 1
+preferred = 2
+strongDefault = 3
+normal = 4
+weakDefault = 5
+weakest = 6
+
+none = 0
+forward = 1
+backward = 2
+
+stronger ^a ^b = a < b
+weaker ^a ^b = a > b
+weakestOf ^a ^b = weaker a b ? a : b
+
+planner = null
+
+# a growable array read from the front, for the planner's work lists
+queue ^ = [
+    items = []
+    head = 0
+    size = 0
+    add ^x = { this.items (this.size) = x; this.size = this.size + 1 }
+    empty ^ = this.head == this.size
+    removeFirst ^ = { x = this.items (this.head); this.head = this.head + 1; x }
+]
+
+forEach ^list ^perform = {
+    i = 0
+    while ^(i < list.size) ^( perform (list.items i); i = i + 1 )
+}
+
+variable ^value = [
+    value = value
+    constraints = do queue
+    determinedBy = null
+    mark = 0
+    walkStrength = weakest
+    stay = true
+
+    addConstraint ^c = this.constraints.add c
+    removeConstraint ^c = {
+        kept = do queue
+        forEach (this.constraints) ^x ( if (x != c) ^( kept.add x ) )
+        this.constraints = kept
+        if (this.determinedBy == c) ^( this.determinedBy = null )
+    }
+]
+
+constraint = [
+    addConstraint ^ = {
+        do: this.addToGraph
+        planner.incrementalAdd this
+    }
+
+    satisfy ^mark = {
+        this.chooseMethod mark
+        satisfied = do: this.isSatisfied
+        do: satisfied ? ^(
+            this.markInputs mark
+            out = do: this.output
+            overridden = out.determinedBy
+            if (overridden != null) ^( do: overridden.markUnsatisfied )
+            out.determinedBy = this
+            if (!(planner.addPropagate this mark)) ^( println "Cycle encountered" )
+            out.mark = mark
+            overridden
+        ) : ^(
+            if (this.strength == required) ^( println "Could not satisfy a required constraint" )
+            null
+        )
+    }
+
+    destroyConstraint ^ = {
+        satisfied = do: this.isSatisfied
+        do: satisfied ? ^( planner.incrementalRemove this ) : ^( do: this.removeFromGraph )
+    }
+
+    isInput ^ = null
+]
+
+unaryConstraint = [
+    parent = constraint
+
+    addToGraph ^ = {
+        this.myOutput.addConstraint this
+        this.satisfied = null
+    }
+    chooseMethod ^mark = {
+        this.satisfied = this.myOutput.mark != mark && (stronger (this.strength) (this.myOutput.walkStrength))
+    }
+    isSatisfied ^ = this.satisfied
+    markInputs ^mark = null
+    output ^ = this.myOutput
+    recalculate ^ = {
+        this.myOutput.walkStrength = this.strength
+        this.myOutput.stay = !(do: this.isInput)
+        if (this.myOutput.stay) ^( do: this.execute )
+    }
+    markUnsatisfied ^ = { this.satisfied = null }
+    inputsKnown ^mark = true
+    removeFromGraph ^ = {
+        this.myOutput.removeConstraint this
+        this.satisfied = null
+    }
+    execute ^ = null
+]
+
+# keeps v at its current value unless a stronger constraint changes it
+stayConstraint ^v ^strength = {
+    c = [ parent = unaryConstraint; myOutput = v; strength = strength; satisfied = null ]
+    do: c.addConstraint
+    c
+}
+
+# marks v as an input the program changes directly
+editConstraint ^v ^strength = {
+    c = [ parent = unaryConstraint; myOutput = v; strength = strength; satisfied = null; isInput ^ = true ]
+    do: c.addConstraint
+    c
+}
+
+binaryConstraint = [
+    parent = constraint
+
+    chooseMethod ^mark = {
+        if (this.v1.mark == mark) ^(
+            this.direction = this.v2.mark != mark && (stronger (this.strength) (this.v2.walkStrength)) ? forward : none
+        )
+        if (this.v2.mark == mark) ^(
+            this.direction = this.v1.mark != mark && (stronger (this.strength) (this.v1.walkStrength)) ? backward : none
+        )
+        do: weaker (this.v1.walkStrength) (this.v2.walkStrength) ? ^(
+            this.direction = stronger (this.strength) (this.v1.walkStrength) ? backward : none
+        ) : ^(
+            this.direction = stronger (this.strength) (this.v2.walkStrength) ? forward : backward
+        )
+    }
+    addToGraph ^ = {
+        this.v1.addConstraint this
+        this.v2.addConstraint this
+        this.direction = none
+    }
+    isSatisfied ^ = this.direction != none
+    markInputs ^mark = {
+        i = do: this.input
+        i.mark = mark
+    }
+    input ^ = this.direction == forward ? this.v1 : this.v2
+    output ^ = this.direction == forward ? this.v2 : this.v1
+    recalculate ^ = {
+        i = do: this.input
+        out = do: this.output
+        out.walkStrength = weakestOf (this.strength) (i.walkStrength)
+        out.stay = i.stay
+        if (out.stay) ^( do: this.execute )
+    }
+    markUnsatisfied ^ = { this.direction = none }
+    inputsKnown ^mark = {
+        i = do: this.input
+        i.mark == mark || i.stay || i.determinedBy == null
+    }
+    removeFromGraph ^ = {
+        this.v1.removeConstraint this
+        this.v2.removeConstraint this
+        this.direction = none
+    }
+]
+
+# keeps v1 and v2 equal
+equalityConstraint ^v1 ^v2 ^strength = {
+    c = [
+        parent = binaryConstraint
+        v1 = v1; v2 = v2; strength = strength; direction = none
+        execute ^ = {
+            i = do: this.input
+            out = do: this.output
+            out.value = i.value
+        }
+    ]
+    do: c.addConstraint
+    c
+}
+
+# keeps dest equal to src * scale + offset
+scaleConstraint ^src ^scale ^offset ^dest ^strength = {
+    c = [
+        parent = binaryConstraint
+        v1 = src; v2 = dest; strength = strength; direction = none
+        scale = scale; offset = offset
+
+        addToGraph ^ = {
+            do: super.addToGraph
+            this.scale.addConstraint this
+            this.offset.addConstraint this
+        }
+        removeFromGraph ^ = {
+            do: super.removeFromGraph
+            this.scale.removeConstraint this
+            this.offset.removeConstraint this
+        }
+        markInputs ^mark = {
+            super.markInputs mark
+            this.scale.mark = mark
+            this.offset.mark = mark
+        }
+        execute ^ = {
+            do: this.direction == forward ? ^(
+                this.v2.value = this.v1.value * this.scale.value + this.offset.value
+            ) : ^(
+                this.v1.value = (this.v2.value - this.offset.value) / this.scale.value
+            )
+        }
+        recalculate ^ = {
+            i = do: this.input
+            out = do: this.output
+            out.walkStrength = weakestOf (this.strength) (i.walkStrength)
+            out.stay = i.stay && this.scale.stay && this.offset.stay
+            if (out.stay) ^( do: this.execute )
+        }
+    ]
+    do: c.addConstraint
+    c
+}
+
+newPlanner ^ = [
+    currentMark = 0
+
+    newMark ^ = {
+        this.currentMark = this.currentMark + 1
+        this.currentMark
+    }
+
+    incrementalAdd ^c = {
+        mark = do: this.newMark
+        overridden = c.satisfy mark
+        while ^(overridden != null) ^( overridden = overridden.satisfy mark )
+    }
+
+    incrementalRemove ^c = {
+        out = do: c.output
+        do: c.markUnsatisfied
+        do: c.removeFromGraph
+        unsatisfied = this.removePropagateFrom out
+        strength = required
+        while ^(strength != weakest) ^(
+            forEach unsatisfied ^u ( if (u.strength == strength) ^( this.incrementalAdd u ) )
+            strength = strength + 1
+        )
+    }
+
+    makePlan ^sources = {
+        mark = do: this.newMark
+        plan = do queue
+        todo = sources
+        while ^(!(do: todo.empty)) ^(
+            c = do: todo.removeFirst
+            out = do: c.output
+            if (out.mark != mark && (c.inputsKnown mark)) ^(
+                plan.add c
+                out.mark = mark
+                this.addConstraintsConsumingTo out todo
+            )
+        )
+        plan
+    }
+
+    extractPlanFromConstraints ^constraints = {
+        sources = do queue
+        forEach constraints ^c (
+            if ((do: c.isInput) && (do: c.isSatisfied)) ^( sources.add c )
+        )
+        this.makePlan sources
+    }
+
+    addPropagate ^c ^mark = {
+        todo = do queue
+        todo.add c
+        ok = true
+        while ^(ok && !(do: todo.empty)) ^(
+            d = do: todo.removeFirst
+            out = do: d.output
+            do: out.mark == mark ? ^(
+                this.incrementalRemove c
+                ok = null
+            ) : ^(
+                do: d.recalculate
+                this.addConstraintsConsumingTo out todo
+            )
+        )
+        ok
+    }
+
+    removePropagateFrom ^out = {
+        out.determinedBy = null
+        out.walkStrength = weakest
+        out.stay = true
+        unsatisfied = do queue
+        todo = do queue
+        todo.add out
+        while ^(!(do: todo.empty)) ^(
+            v = do: todo.removeFirst
+            forEach (v.constraints) ^c (
+                if (!(do: c.isSatisfied)) ^( unsatisfied.add c )
+            )
+            determining = v.determinedBy
+            forEach (v.constraints) ^next (
+                if (next != determining && (do: next.isSatisfied)) ^(
+                    do: next.recalculate
+                    todo.add (do: next.output)
+                )
+            )
+        )
+        unsatisfied
+    }
+
+    addConstraintsConsumingTo ^v ^coll = {
+        determining = v.determinedBy
+        forEach (v.constraints) ^c (
+            if (c != determining && (do: c.isSatisfied)) ^( coll.add c )
+        )
+    }
+]
+
+execute ^plan = forEach plan ^c ( do: c.execute )
+
+chainTest ^n = {
+    nonlocal planner = do newPlanner
+    prev = null
+    first = null
+    last = null
+    i = 0
+    while ^(i <= n) ^(
+        v = variable 0
+        if (prev != null) ^( equalityConstraint prev v required )
+        if (i == 0) ^( first = v )
+        if (i == n) ^( last = v )
+        prev = v
+        i = i + 1
+    )
+    stayConstraint last strongDefault
+    edits = do queue
+    edits.add (editConstraint first preferred)
+    plan = planner.extractPlanFromConstraints edits
+    failures = 0
+    i = 0
+    while ^(i < 100) ^(
+        first.value = i
+        execute plan
+        if (last.value != i) ^( failures = failures + 1 )
+        i = i + 1
+    )
+    print "chain " (last.value) " failures " failures ln
+}
+
+change ^v ^newValue = {
+    edit = editConstraint v preferred
+    edits = do queue
+    edits.add edit
+    plan = planner.extractPlanFromConstraints edits
+    i = 0
+    while ^(i < 10) ^( v.value = newValue; execute plan; i = i + 1 )
+    do: edit.destroyConstraint
+}
+
+projectionTest ^n = {
+    nonlocal planner = do newPlanner
+    scale = variable 10
+    offset = variable 1000
+    src = null
+    dst = null
+    dests = do queue
+    i = 0
+    while ^(i < n) ^(
+        src = variable i
+        dst = variable i
+        dests.add dst
+        stayConstraint src normal
+        scaleConstraint src scale offset dst required
+        i = i + 1
+    )
+    total ^ = {
+        sum = 0
+        forEach dests ^d ( sum = sum + d.value )
+        sum
+    }
+    change src 17
+    print "projection " (dst.value)
+    change dst 1050
+    print " " (src.value)
+    change scale 5
+    print " " (do total)
+    change offset 2000
+    print " " (do total) ln
+}
+
+chainTest 100
+projectionTest 100
@@ -0,0 +1,63 @@
+# fannkuch-redux: counts pancake flips over every permutation of n items
+# n = 7; prints the checksum and the maximum number of flips
+
+n = 7
+
+array ^size ^fill = {
+    result = []
+    i = 0
+    while ^(i < size) ^( result.append: fill i; i = i + 1 )
+    result
+}
+
+perm1 = array n ^i ( i )
+perm = array n ^i ( 0 )
+count = array n ^i ( 0 )
+maxFlips = 0
+checksum = 0
+permCount = 0
+r = n
+running = true
+
+while ^(running) ^(
+    while ^(r != 1) ^( count (r - 1) = r; r = r - 1 )
+
+    i = 0
+    while ^(i < n) ^( perm i = perm1 i; i = i + 1 )
+
+    # flip the first k + 1 items until the first item is 0
+    flips = 0
+    k = perm 0
+    while ^(k != 0) ^(
+        lo = 0
+        hi = k
+        while ^(lo < hi) ^(
+            t = perm lo
+            perm lo = perm hi
+            perm hi = t
+            lo = lo + 1
+            hi = hi - 1
+        )
+        flips = flips + 1
+        k = perm 0
+    )
+    if (flips > maxFlips) ^( maxFlips = flips )
+    checksum = checksum + (permCount % 2 == 0 ? flips : ~flips)
+
+    # advance to the next permutation
+    advancing = true
+    while ^(advancing) ^(
+        do: r == n ? ^( advancing = null; running = null ) : ^(
+            p0 = perm1 0
+            i = 0
+            while ^(i < r) ^( perm1 i = perm1 (i + 1); i = i + 1 )
+            perm1 r = p0
+            count r = count r - 1
+            do: count r > 0 ? ^( advancing = null ) : ^( r = r + 1 )
+        )
+    )
+    permCount = permCount + 1
+)
+
+println checksum
+print "Pfannkuchen(" n ") = " maxFlips ln
@@ -0,0 +1,103 @@
+# n-body: simulates the Jovian planets orbiting the sun
+# 1000 steps of 0.01; prints the energy before and after
+
+pi = 3.141592653589793
+solarMass = 4 * pi * pi
+daysPerYear = 365.24
+
+# there is no square root builtin, so use a fixed number of Newton steps
+sqrt ^x = {
+    guess = x > 1 ? x : 1
+    i = 0
+    while ^(i < 60) ^( guess = (guess + x / guess) / 2; i = i + 1 )
+    guess
+}
+
+body ^x ^y ^z ^vx ^vy ^vz ^mass = [
+    x = x; y = y; z = z
+    vx = vx * daysPerYear; vy = vy * daysPerYear; vz = vz * daysPerYear
+    mass = mass * solarMass
+]
+
+bodies = [
+    append: body 0 0 0 0 0 0 1
+    append: body 4.84143144246472090e+00 (~1.16032004402742839e+00) (~1.03622044471123109e-01) \
+        1.66007664274403694e-03 7.69901118419740425e-03 (~6.90460016972063023e-05) 9.54791938424326609e-04
+    append: body 8.34336671824457987e+00 4.12479856412430479e+00 (~4.03523417114321381e-01) \
+        (~2.76742510726862411e-03) 4.99852801234917238e-03 2.30417297573763929e-05 2.85885980666130812e-04
+    append: body 1.28943695621391310e+01 (~1.51111514016986312e+01) (~2.23307578892655734e-01) \
+        2.96460137564761618e-03 2.37847173959480950e-03 (~2.96589568540237556e-05) 4.36624404335156298e-05
+    append: body 1.53796971148509165e+01 (~2.59193146099879641e+01) 1.79258772950371181e-01 \
+        2.68067772490389322e-03 1.62824170038242295e-03 (~9.51592254519715870e-05) 5.15138902046611451e-05
+]
+count = 5
+
+offsetMomentum ^ = {
+    px = 0; py = 0; pz = 0
+    i = 0
+    while ^(i < count) ^(
+        b = bodies i
+        px = px + b.vx * b.mass
+        py = py + b.vy * b.mass
+        pz = pz + b.vz * b.mass
+        i = i + 1
+    )
+    sun = bodies 0
+    sun.vx = ~px / solarMass
+    sun.vy = ~py / solarMass
+    sun.vz = ~pz / solarMass
+}
+
+energy ^ = {
+    e = 0
+    i = 0
+    while ^(i < count) ^(
+        b = bodies i
+        e = e + 0.5 * b.mass * (b.vx * b.vx + b.vy * b.vy + b.vz * b.vz)
+        j = i + 1
+        while ^(j < count) ^(
+            b2 = bodies j
+            dx = b.x - b2.x; dy = b.y - b2.y; dz = b.z - b2.z
+            e = e - b.mass * b2.mass / (sqrt (dx * dx + dy * dy + dz * dz))
+            j = j + 1
+        )
+        i = i + 1
+    )
+    e
+}
+
+advance ^dt = {
+    i = 0
+    while ^(i < count) ^(
+        b = bodies i
+        j = i + 1
+        while ^(j < count) ^(
+            b2 = bodies j
+            dx = b.x - b2.x; dy = b.y - b2.y; dz = b.z - b2.z
+            d2 = dx * dx + dy * dy + dz * dz
+            mag = dt / (d2 * (sqrt d2))
+            b.vx = b.vx - dx * b2.mass * mag
+            b.vy = b.vy - dy * b2.mass * mag
+            b.vz = b.vz - dz * b2.mass * mag
+            b2.vx = b2.vx + dx * b.mass * mag
+            b2.vy = b2.vy + dy * b.mass * mag
+            b2.vz = b2.vz + dz * b.mass * mag
+            j = j + 1
+        )
+        i = i + 1
+    )
+    i = 0
+    while ^(i < count) ^(
+        b = bodies i
+        b.x = b.x + dt * b.vx
+        b.y = b.y + dt * b.vy
+        b.z = b.z + dt * b.vz
+        i = i + 1
+    )
+}
+
+do offsetMomentum
+println: do energy
+step = 0
+while ^(step < 1000) ^( advance 0.01; step = step + 1 )
+println: do energy
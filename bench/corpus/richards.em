@@ -0,0 +1,243 @@
+# richards: simulates the task dispatcher of an operating system kernel
+# idle count 1000; prints the number of queued packets and held tasks
+# the state bits of the original are separate flags here, and the idle
+# task's shift register is done with arithmetic since there are no bit operators
+
+idIdle = 0
+idWorker = 1
+idHandlerA = 2
+idHandlerB = 3
+idDeviceA = 4
+idDeviceB = 5
+kindDevice = 0
+kindWork = 1
+dataSize = 4
+
+half ^x = (x - x % 2) / 2
+
+bitXor ^a ^b = {
+    result = 0
+    bit = 1
+    while ^(a > 0 || b > 0) ^(
+        if (a % 2 != b % 2) ^( result = result + bit )
+        a = half a
+        b = half b
+        bit = bit * 2
+    )
+    result
+}
+
+packet ^link ^id ^kind = [
+    link = link; id = id; kind = kind
+    a1 = 0
+    a2 = [ 0, 0, 0, 0 ]
+
+    # appends this packet to the end of queue, returning the new queue
+    addTo ^queue = {
+        this.link = null
+        do: queue == null ? ^( this ) : ^(
+            next = queue
+            while ^(next.link != null) ^( next = next.link )
+            next.link = this
+            queue
+        )
+    }
+]
+
+scheduler = [
+    queueCount = 0
+    holdCount = 0
+    blocks = [ null, null, null, null, null, null ]
+    list = null
+    currentTcb = null
+    currentId = null
+
+    addTask ^id ^priority ^queue ^task = {
+        this.currentTcb = tcb (this.list) id priority queue task
+        this.list = this.currentTcb
+        this.blocks id = this.currentTcb
+    }
+
+    schedule ^ = {
+        this.currentTcb = this.list
+        while ^(this.currentTcb != null) ^(
+            skip = do: this.currentTcb.isHeldOrSuspended
+            do: skip ? ^(
+                this.currentTcb = this.currentTcb.link
+            ) : ^(
+                this.currentId = this.currentTcb.id
+                this.currentTcb = do: this.currentTcb.run
+            )
+        )
+    }
+
+    release ^id = {
+        t = this.blocks id
+        do: t == null ? ^( null ) : ^(
+            t.held = null
+            t.priority > this.currentTcb.priority ? t : this.currentTcb
+        )
+    }
+
+    holdCurrent ^ = {
+        this.holdCount = this.holdCount + 1
+        this.currentTcb.held = true
+        this.currentTcb.link
+    }
+
+    suspendCurrent ^ = {
+        this.currentTcb.waiting = true
+        this.currentTcb
+    }
+
+    queue ^p = {
+        t = this.blocks (p.id)
+        do: t == null ? ^( null ) : ^(
+            this.queueCount = this.queueCount + 1
+            p.link = null
+            p.id = this.currentId
+            t.checkPriorityAdd (this.currentTcb) p
+        )
+    }
+]
+
+# task control block; pending, waiting and held stand in for the state bits
+tcb ^link ^id ^priority ^queue ^task = [
+    link = link; id = id; priority = priority; queue = queue; task = task
+    pending = queue != null
+    waiting = true
+    held = null
+
+    isHeldOrSuspended ^ = this.held || (this.waiting && !(this.pending))
+
+    run ^ = {
+        p = null
+        if (this.waiting && this.pending && !(this.held)) ^(
+            p = this.queue
+            this.queue = p.link
+            this.waiting = null
+            this.pending = this.queue != null
+        )
+        this.task.run p
+    }
+
+    checkPriorityAdd ^t ^p = {
+        do: this.queue == null ? ^(
+            this.queue = p
+            this.pending = true
+            this.priority > t.priority ? this : t
+        ) : ^(
+            this.queue = p.addTo (this.queue)
+            t
+        )
+    }
+]
+
+idleTask ^v1 ^count = [
+    v1 = v1; count = count
+    run ^p = {
+        this.count = this.count - 1
+        do: this.count == 0 ? ^( do: scheduler.holdCurrent ) : ^(
+            do: this.v1 % 2 == 0 ? ^(
+                this.v1 = half (this.v1)
+                scheduler.release idDeviceA
+            ) : ^(
+                this.v1 = bitXor (half (this.v1)) 0xD008
+                scheduler.release idDeviceB
+            )
+        )
+    }
+]
+
+deviceTask ^ = [
+    v1 = null
+    run ^p = {
+        do: p == null ? ^(
+            do: this.v1 == null ? ^( do: scheduler.suspendCurrent ) : ^(
+                v = this.v1
+                this.v1 = null
+                scheduler.queue v
+            )
+        ) : ^(
+            this.v1 = p
+            do: scheduler.holdCurrent
+        )
+    }
+]
+
+workerTask ^v1 ^v2 = [
+    v1 = v1; v2 = v2
+    run ^p = {
+        do: p == null ? ^( do: scheduler.suspendCurrent ) : ^(
+            this.v1 = this.v1 == idHandlerA ? idHandlerB : idHandlerA
+            p.id = this.v1
+            p.a1 = 0
+            i = 0
+            while ^(i < dataSize) ^(
+                this.v2 = this.v2 + 1
+                if (this.v2 > 26) ^( this.v2 = 1 )
+                p.a2 i = this.v2
+                i = i + 1
+            )
+            scheduler.queue p
+        )
+    }
+]
+
+handlerTask ^ = [
+    v1 = null
+    v2 = null
+    run ^p = {
+        if (p != null) ^(
+            do: p.kind == kindWork ? ^( this.v1 = p.addTo (this.v1) ) : ^( this.v2 = p.addTo (this.v2) )
+        )
+        next = null
+        sent = null
+        if (this.v1 != null) ^(
+            count = this.v1.a1
+            do: count < dataSize ? ^(
+                if (this.v2 != null) ^(
+                    v = this.v2
+                    this.v2 = this.v2.link
+                    v.a1 = this.v1.a2 count
+                    this.v1.a1 = count + 1
+                    next = scheduler.queue v
+                    sent = true
+                )
+            ) : ^(
+                v = this.v1
+                this.v1 = this.v1.link
+                next = scheduler.queue v
+                sent = true
+            )
+        )
+        do: sent ? ^( next ) : ^( do: scheduler.suspendCurrent )
+    }
+]
+
+runRichards ^count = {
+    scheduler.addTask idIdle 0 null (idleTask 1 count)
+    scheduler.currentTcb.waiting = null
+
+    q = packet null idWorker kindWork
+    q = packet q idWorker kindWork
+    scheduler.addTask idWorker 1000 q (workerTask idHandlerA 0)
+
+    q = packet null idDeviceA kindDevice
+    q = packet q idDeviceA kindDevice
+    q = packet q idDeviceA kindDevice
+    scheduler.addTask idHandlerA 2000 q (do handlerTask)
+
+    q = packet null idDeviceB kindDevice
+    q = packet q idDeviceB kindDevice
+    q = packet q idDeviceB kindDevice
+    scheduler.addTask idHandlerB 3000 q (do handlerTask)
+
+    scheduler.addTask idDeviceA 4000 null (do deviceTask)
+    scheduler.addTask idDeviceB 5000 null (do deviceTask)
+
+    do: scheduler.schedule
+    print "qpkt count = " (scheduler.queueCount) ", holdcount = " (scheduler.holdCount) ln
+}
+
+runRichards 1000
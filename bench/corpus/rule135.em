@@ -0,0 +1,46 @@
+# Rule 135 automaton from main.cpp, with a fixed number of generations
+# 128 cells, 100 generations, one printed line per generation
+
+width = 128
+generations = 100
+
+foreach ^upto ^perform = {
+    counter = 0
+    while ^(counter < upto) ^( perform counter; counter = counter + 1; )
+}
+
+inherit ^class = [ parent = class ]
+
+line = [                               # Object for one line of printout
+    createFrom ^old = {
+        foreach width ^at { # Rule 135
+            final = width - 1
+            here   = old at
+            before = old ( at == 0 ? final : at - 1 )
+            after  = old ( at == final ? 0 : at + 1 )
+            this.append: ( here && before && after ) \
+                     || !( here || before || after )
+        }
+    }
+    print ^ = {
+        this.each ^cell { print: cell ? "*" : " " }
+        println ""                                          # Next line
+    }
+]
+
+repeatWith ^old ^remaining = {  # Print a line, then generate the next one
+    do: old.print
+    if (remaining > 1) ^(
+        new = inherit line
+        new.createFrom old
+        repeatWith new (remaining - 1)
+    )
+}
+
+starting = inherit line        # Create a starting line full of garbage
+next = 1
+foreach width ^at (
+    starting.append: at != next
+    if (at == next) ^( next = next * 2 )
+)
+repeatWith starting generations                                 # Begin
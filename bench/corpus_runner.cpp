@@ -0,0 +1,294 @@
+// corpus_runner.cpp
+// times the front end phases on each program in bench/corpus and compares
+// them with a stored baseline; with --run, also runs each program through an
+// interpreter command and checks its output against the program's .out file
+// each phase is timed per call, over runs of at least --min-time seconds, 0.05 by default
+// writes one JSON object with a result per program to stdout, and exits with
+// status 1 if any phase regressed past the threshold or any output differed
+// the baseline holds seconds from the machine it was recorded on, so the later
+// phases are compared by their time relative to tokenizing the same program,
+// which carries over between machines; tokenize and run are compared in seconds
+// only with --absolute, for a baseline recorded locally with --write-baseline
+// built with EMILY_INSTRUMENT, each result also has the front end statistics
+// usage: corpus_bench [--corpus dir] [--reps n] [--min-time seconds] [--baseline file]
+//                     [--write-baseline] [--threshold fraction] [--absolute] [--run command]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "instrument.h"
+#include "macro.h"
+#include "tokenize.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <sys/resource.h>
+#endif
+
+#ifndef EMILY_CORPUS_DIR
+#define EMILY_CORPUS_DIR "bench/corpus"
+#endif
+
+namespace{
+
+	using namespace emily;
+
+	const char* const programs[] = {
+		"rule135", "binary_trees", "nbody", "richards", "deltablue", "fannkuch"
+	};
+
+	const char* const step_names[] = { "tokenize", "do_macros", "elide_groups", "lower_control_flow", "run" };
+	enum Step{ Tokenize, DoMacros, ElideGroups, LowerControlFlow, Run, StepCount };
+
+	struct Options{
+		std::string corpus;
+		std::string baseline;
+		const char* command;
+		int reps;
+		double min_seconds;
+		double threshold;
+		bool write_baseline;
+		bool absolute;
+	};
+
+	struct Result{
+		const char* name;
+		bool parsed;
+		bool ran;
+		bool output_ok;
+		double seconds[StepCount];
+		size_t run_peak_rss_kb;
+		std::string instrumentation;	// front end statistics as JSON, in an instrumented build
+	};
+
+	// peak resident set size in kilobytes, of this process or of its finished children
+	size_t peak_rss_kb(bool children){
+#ifdef _WIN32
+		if (children) return 0;
+		PROCESS_MEMORY_COUNTERS pmc;
+		GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc);
+		return pmc.PeakWorkingSetSize / 1024;
+#else
+		rusage usage;
+		getrusage(children ? RUSAGE_CHILDREN : RUSAGE_SELF, &usage);
+		return usage.ru_maxrss;
+#endif
+	}
+
+	bool read_file(const std::string& path, std::string& text){
+		std::ifstream in{ path, std::ios::binary };
+		if (!in) return false;
+		std::ostringstream ss;
+		ss << in.rdbuf();
+		text = ss.str();
+		return true;
+	}
+
+	// seconds per call of fn, calling it until min_seconds have passed, as the
+	// phases of the smaller programs take microseconds, which one call cannot time
+	double time_calls(double min_seconds, const std::function<void()>& fn){
+		auto start = std::chrono::steady_clock::now();
+		double elapsed = 0;
+		long long calls = 0;
+		do{
+			fn();
+			++calls;
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		} while (elapsed < min_seconds);
+		return elapsed / calls;
+	}
+
+	// fastest of reps timings of each phase, into seconds
+	// the phases take turns within each rep, so a change in the machine's speed
+	// during the run affects all of them alike and cancels out of their ratios
+	void measure(int reps, double min_seconds, const std::vector<std::function<void()>>& phases, double* seconds){
+		for (int i = 0; i < reps; ++i){
+			for (size_t p = 0; p < phases.size(); ++p){
+				double t = time_calls(min_seconds, phases[p]);
+				if (i == 0 || t < seconds[p]) seconds[p] = t;
+			}
+		}
+	}
+
+	// baseline lines are "program phase seconds"
+	typedef std::map<std::string, double> Baseline;
+
+	Baseline read_baseline(const std::string& path){
+		Baseline base;
+		std::ifstream in{ path };
+		std::string program, phase;
+		double seconds;
+		while (in >> program >> phase >> seconds)
+			base[program + ' ' + phase] = seconds;
+		return base;
+	}
+
+	void write_baseline(const std::string& path, const std::vector<Result>& results){
+		std::ofstream out{ path };
+		for (const auto& r : results){
+			for (int p = 0; p < StepCount; ++p){
+				if (p == Run && !r.ran) continue;
+				char buf[128];
+				std::sprintf(buf, "%s %s %.9f\n", r.name, step_names[p], r.seconds[p]);
+				out << buf;
+			}
+		}
+	}
+
+	Result run_program(const char* name, const Options& opt){
+		Result r;
+		r.name = name;
+		r.parsed = r.ran = r.output_ok = false;
+		for (auto& s : r.seconds) s = 0;
+		r.run_peak_rss_kb = 0;
+
+		std::string path = opt.corpus + '/' + name + ".em";
+		std::string source;
+		if (!read_file(path, source)){
+			std::fprintf(stderr, "cannot read %s\n", path.c_str());
+			return r;
+		}
+
+		Program tokenized = tokenize(source);
+		Program expanded = tokenized;
+		r.parsed = do_macros(expanded);
+		if (!r.parsed){
+			std::fprintf(stderr, "syntax errors in %s\n", path.c_str());
+			return r;
+		}
+		Program elided = expanded;
+		elide_groups(elided);
+		std::vector<std::function<void()>> phases{
+			[&]{ tokenize(source); },
+			[&]{
+				Program prog = tokenized;
+				do_macros(prog);
+			},
+			[&]{
+				Program prog = expanded;
+				elide_groups(prog);
+			},
+			[&]{
+				Program prog = elided;
+				lower_control_flow(prog);
+			}
+		};
+		measure(opt.reps, opt.min_seconds, phases, r.seconds);
+#ifdef EMILY_INSTRUMENT
+		reset_front_end_stats();
+		Program prog = tokenize(source);
+		do_macros(prog);
+		elide_groups(prog);
+		lower_control_flow(prog);
+		std::ostringstream stats;
+		write_json(stats, front_end_stats());
+		r.instrumentation = stats.str();
+		r.instrumentation.pop_back();
+#endif
+
+		if (opt.command){
+			std::string expected;
+			read_file(opt.corpus + '/' + name + ".out", expected);
+			std::string cmd = std::string{ opt.command } + " \"" + path + '"';
+			std::string output;
+			auto start = std::chrono::steady_clock::now();
+			if (FILE* child = popen(cmd.c_str(), "r")){
+				char buf[4096];
+				size_t n;
+				while ((n = std::fread(buf, 1, sizeof buf, child)) > 0) output.append(buf, n);
+				r.ran = pclose(child) == 0;
+			}
+			r.seconds[Run] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			// the largest child so far, which is this one if programs run in growing order
+			r.run_peak_rss_kb = peak_rss_kb(true);
+			r.output_ok = r.ran && output == expected;
+		}
+		return r;
+	}
+
+}
+
+int main(int argc, char** argv){
+	Options opt;
+	opt.corpus = EMILY_CORPUS_DIR;
+	opt.command = nullptr;
+	opt.reps = 5;
+	opt.min_seconds = 0.05;
+	opt.threshold = 0.25;
+	opt.write_baseline = false;
+	opt.absolute = false;
+	for (int i = 1; i < argc; ++i){
+		bool has_value = i + 1 < argc;
+		if (std::strcmp(argv[i], "--write-baseline") == 0) opt.write_baseline = true;
+		else if (std::strcmp(argv[i], "--absolute") == 0) opt.absolute = true;
+		else if (has_value && std::strcmp(argv[i], "--corpus") == 0) opt.corpus = argv[++i];
+		else if (has_value && std::strcmp(argv[i], "--reps") == 0) opt.reps = std::atoi(argv[++i]);
+		else if (has_value && std::strcmp(argv[i], "--min-time") == 0) opt.min_seconds = std::atof(argv[++i]);
+		else if (has_value && std::strcmp(argv[i], "--baseline") == 0) opt.baseline = argv[++i];
+		else if (has_value && std::strcmp(argv[i], "--threshold") == 0) opt.threshold = std::atof(argv[++i]);
+		else if (has_value && std::strcmp(argv[i], "--run") == 0) opt.command = argv[++i];
+		else{
+			std::fprintf(stderr, "usage: %s [--corpus dir] [--reps n] [--min-time seconds] [--baseline file]\n"
+				"\t[--write-baseline] [--threshold fraction] [--absolute] [--run command]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (opt.baseline.empty()) opt.baseline = opt.corpus + "/baseline.txt";
+
+	std::vector<Result> results;
+	for (const char* name : programs)
+		results.push_back(run_program(name, opt));
+
+	if (opt.write_baseline) write_baseline(opt.baseline, results);
+	Baseline base = read_baseline(opt.baseline);
+
+	bool failed = false;
+	std::printf("{\"threshold\":%.2f,\"absolute\":%s,\"peak_rss_kb\":%zu,\"programs\":[",
+		opt.threshold, opt.absolute ? "true" : "false", peak_rss_kb(false));
+	for (size_t i = 0; i < results.size(); ++i){
+		const Result& r = results[i];
+		std::printf("%s\n{\"name\":\"%s\",\"parsed\":%s", i ? "," : "", r.name, r.parsed ? "true" : "false");
+		failed |= !r.parsed;
+		double total = 0;
+		auto tokenized = base.find(std::string{ r.name } + ' ' + step_names[Tokenize]);
+		double base_tokenize = tokenized == base.end() ? 0 : tokenized->second;
+		for (int p = 0; p < StepCount; ++p){
+			if (p == Run && !opt.command) continue;
+			total += r.seconds[p];
+			std::printf(",\"%s\":{\"seconds\":%.9f", step_names[p], r.seconds[p]);
+			auto it = base.find(std::string{ r.name } + ' ' + step_names[p]);
+			if (it != base.end() && it->second > 0){
+				// how much the phase's share of tokenize grew, or its seconds with --absolute
+				bool relative = p != Tokenize && p != Run && !opt.absolute;
+				double ratio = r.seconds[p] / it->second;
+				if (relative) ratio *= base_tokenize / r.seconds[Tokenize];
+				bool checked = relative ? base_tokenize > 0 && r.seconds[Tokenize] > 0 : opt.absolute;
+				bool regressed = checked && ratio > 1 + opt.threshold;
+				failed |= regressed;
+				std::printf(",\"baseline\":%.9f,\"ratio\":%.3f,\"relative\":%s,\"regressed\":%s",
+					it->second, ratio, relative ? "true" : "false", regressed ? "true" : "false");
+			}
+			std::printf("}");
+		}
+		if (opt.command){
+			std::printf(",\"output_ok\":%s,\"run_peak_rss_kb\":%zu", r.output_ok ? "true" : "false", r.run_peak_rss_kb);
+			failed |= !r.output_ok;
+		}
+		if (!r.instrumentation.empty())
+			std::printf(",\"instrumentation\":%s", r.instrumentation.c_str());
+		std::printf(",\"total_seconds\":%.9f}", total);
+	}
+	std::printf("\n]}\n");
+	return failed ? 1 : 0;
+}
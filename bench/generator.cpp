@@ -0,0 +1,219 @@
+// generator.cpp
+
+#include <cstdio>
+#include "generator.h"
+
+namespace emily{
+
+	namespace{
+		const char* const binary_ops[] = {
+			"+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!=", "&&", "||", "%%"
+		};
+
+		// xorshift, so output does not depend on the standard library's distributions
+		class Random{
+			unsigned state;
+
+		public:
+			explicit Random(unsigned seed) : state{ seed ? seed : 0x9E3779B9u }{}
+
+			unsigned next(){
+				state ^= state << 13;
+				state ^= state >> 17;
+				state ^= state << 5;
+				return state;
+			}
+
+			int below(int n){
+				return next() % n;
+			}
+
+			bool chance(double p){
+				return (next() >> 8) < p * (1 << 24);
+			}
+		};
+
+		class Generator{
+			const GeneratorOptions& opt;
+			Random rng;
+			std::string out;
+			int indent;
+
+		public:
+			explicit Generator(const GeneratorOptions& options)
+				: opt(options), rng{ options.seed }, indent{ 0 }{}
+
+			std::string run(){
+				for (int i = 0; i < opt.lines; ++i)
+					statement(0);
+				return out;
+			}
+
+		private:
+			void name(){
+				char buf[16];
+				std::sprintf(buf, "v%d", rng.below(64));
+				out += buf;
+			}
+
+			void number(){
+				char buf[32];
+				switch (rng.below(4)){
+				case 0: std::sprintf(buf, "0x%X", rng.below(4096)); break;
+				case 1: std::sprintf(buf, "%d.%02d", rng.below(1000), rng.below(100)); break;
+				default: std::sprintf(buf, "%d", rng.below(10000)); break;
+				}
+				out += buf;
+			}
+
+			void string(){
+				static const char* const words[] = { "alpha", "beta", "gamma", "delta", "hello", "world" };
+				out += '"';
+				for (int n = 1 + rng.below(4); n > 0; --n){
+					out += words[rng.below(6)];
+					if (n > 1) out += ' ';
+				}
+				out += '"';
+			}
+
+			void operand(int depth){
+				if (depth < opt.max_depth && rng.chance(opt.group_density)){
+					out += "( ";
+					expression(depth + 1);
+					out += " )";
+				}
+				else if (rng.chance(opt.string_density)) string();
+				else{
+					switch (rng.below(8)){
+					case 0: out += "~"; number(); break;
+					case 1: out += "!"; name(); break;
+					case 2: name(); out += '.'; name(); break;
+					case 3: case 4: number(); break;
+					default: name(); break;
+					}
+				}
+			}
+
+			void expression(int depth){
+				operand(depth);
+				while (rng.chance(opt.operator_density)){
+					out += ' ';
+					out += binary_ops[rng.below(sizeof binary_ops / sizeof binary_ops[0])];
+					out += ' ';
+					operand(depth);
+				}
+				if (depth < opt.max_depth && rng.below(16) == 0){
+					out += " ? ";
+					operand(depth + 1);
+					out += " : ";
+					operand(depth + 1);
+				}
+			}
+
+			void newline(){
+				out += '\n';
+				out.append(indent, '\t');
+			}
+
+			void block(int depth, const char* open, const char* close){
+				out += open;
+				++indent;
+				for (int n = 1 + rng.below(3); n > 0; --n){
+					newline();
+					statement(depth + 1);
+					out.pop_back();
+				}
+				--indent;
+				newline();
+				out += close;
+			}
+
+			// writes one statement and its newline
+			void statement(int depth){
+				bool nested = depth < opt.max_depth;
+				if (nested && rng.chance(opt.closure_density)){
+					name();
+					for (int n = rng.below(3); n > 0; --n){
+						out += " ^";
+						name();
+					}
+					out += " = ";
+					block(depth, "{", "}");
+				}
+				else{
+					switch (rng.below(nested ? 12 : 6)){
+					case 0:
+						name(); out += '.'; name(); out += " = ";
+						expression(depth);
+						break;
+					case 1:
+						out += "println: ";
+						expression(depth);
+						break;
+					case 2:
+						name(); out += " = "; name(); out += " // ";
+						expression(depth);
+						break;
+					case 3:
+						out += "` "; name(); out += ' '; number();
+						break;
+					case 4:
+						if (depth > 0){
+							out += "nonlocal ";
+							name(); out += " = ";
+							expression(depth);
+							break;
+						}
+						// fall through - nonlocal needs an enclosing scope, so write a list instead
+					case 5:
+						name(); out += " = [ ";
+						for (int n = 1 + rng.below(4); n > 0; --n){
+							operand(depth);
+							if (n > 1) out += ", ";
+						}
+						out += " ]";
+						break;
+					case 6:
+						out += "if ( ";
+						expression(depth + 1);
+						out += " ) ^";
+						block(depth, "(", ")");
+						break;
+					case 7:
+						out += "while ^( ";
+						expression(depth + 1);
+						out += " ) ^";
+						block(depth, "(", ")");
+						break;
+					case 8:
+						name(); out += " = ";
+						block(depth, "[", "]");
+						break;
+					default:
+						name(); out += " = ";
+						expression(depth);
+						break;
+					}
+				}
+				out += '\n';
+			}
+		};
+	}
+
+	GeneratorOptions default_generator_options(){
+		GeneratorOptions opt;
+		opt.lines = 1000;
+		opt.seed = 1;
+		opt.operator_density = 0.6;
+		opt.group_density = 0.2;
+		opt.string_density = 0.1;
+		opt.closure_density = 0.1;
+		opt.max_depth = 4;
+		return opt;
+	}
+
+	std::string generate_program(const GeneratorOptions& options){
+		return Generator{ options }.run();
+	}
+
+}
@@ -0,0 +1,32 @@
+// generator.h
+
+#ifndef __GENERATOR_H__
+#define __GENERATOR_H__
+
+#include <string>
+
+namespace emily{
+
+	struct GeneratorOptions{
+		int lines;					// top level statements
+		unsigned seed;
+		double operator_density;	// chance that an expression continues with another operator
+		double group_density;		// chance that an operand is a parenthesized expression
+		double string_density;		// chance that an operand is a string literal
+		double closure_density;		// chance that a statement defines a function
+		int max_depth;				// deepest nesting of groups and closures
+	};
+
+	GeneratorOptions default_generator_options();
+
+	/**	Synthetic program generator
+	 *	writes syntactically valid emily source with the given shape, using
+	 *	assignments, arithmetic and comparison, ternaries, atoms, objects and
+	 *	closures, so every macro transform has work to do
+	 *	the same options and seed give the same program on every platform
+	 */
+	std::string generate_program(const GeneratorOptions& options);
+
+}
+
+#endif
@@ -0,0 +1,388 @@
+// jit_bench.cpp
+// compares the baseline JIT with the interpreter on the closures it can compile,
+// from the programs in bench/corpus and a few numeric kernels
+// a reference evaluator of the same operations through the builtins stands in
+// for the interpreter, and runs the calls the JIT bails out of, as it would
+// each closure is tried with Integer, Number and array arguments; the argument
+// types it compiles for are called with varying values through both, and
+// every result must match
+// writes one JSON object with a result per closure to stdout, and exits with
+// status 1 if any result differed
+// usage: jit_bench [--corpus dir] [--calls n]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "builtins.h"
+#include "jit.h"
+#include "macro.h"
+#include "table.h"
+
+#ifndef EMILY_CORPUS_DIR
+#define EMILY_CORPUS_DIR "bench/corpus"
+#endif
+
+namespace{
+
+	using namespace emily;
+
+	const char* const programs[] = {
+		"rule135", "binary_trees", "nbody", "richards", "deltablue", "fannkuch"
+	};
+
+	const char* const kernels =
+		"poly = ^x (x * x * 3 + x * 2 + 1)\n"
+		"lerp = ^a ^b ^t (a + (b - a) * t)\n"
+		"clamp = ^x ^lo ^hi (x < lo ? lo : (x > hi ? hi : x))\n"
+		"dot3 = ^a ^b (a 0 * b 0 + a 1 * b 1 + a 2 * b 2)\n"
+		"mix = ^a ^i ^j ((a i) * 2 - (a j) % 7)\n"
+		"inside = ^x ^y (x * x + y * y <= 100)\n"
+		"steps = ^x ^n (\n"
+		"	if (x > n) ^(x * x)\n"
+		"	while ^(x < 0 - n) ^(x + 1)\n"
+		"	x - n\n"
+		")\n";
+
+	// argument types a closure is tried with
+	enum ArgKind{ IntArg, NumArg, IntArray, NumArray, ArgKinds };
+	const char* const arg_names[] = { "integer", "number", "integer_array", "number_array" };
+
+	// closures with more bindings are not tried, as the signatures grow as 4^n
+	const size_t MaxBindings = 4;
+	const int ArraySize = 16;
+	// argument sets cycled through by the calls
+	const int Samples = 64;
+
+	double seconds_since(std::chrono::steady_clock::time_point start){
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	bool read_file(const std::string& path, std::string& text){
+		std::ifstream in{ path, std::ios::binary };
+		if (!in) return false;
+		std::ostringstream ss;
+		ss << in.rdbuf();
+		text = ss.str();
+		return true;
+	}
+
+	struct Unsupported{};
+
+	volatile int observed;
+
+	/**	Reference evaluator
+	 *	evaluates a closure body of the operations the JIT compiles, one token at
+	 *	a time, calling the builtins on boxed values as the interpreter does
+	 */
+	class Evaluator{
+		const Program& prog;
+		MemoryManager& mm;
+		const ClosureInfo& clos;
+		const Value* args;
+
+	public:
+		Evaluator(const Program& prog, MemoryManager& mm, const ClosureInfo& clos, const Value* args)
+			: prog(prog), mm(mm), clos(clos), args(args){}
+
+		Value run(){ return group(clos.group_idx); }
+
+	private:
+		Value group(int g){
+			Value val{ ValType::Null };
+			for (const auto& ln : prog.groups[g])
+				if (!ln.empty()) val = line(ln);
+			return val;
+		}
+
+		Value line(const Line& ln){
+			auto tk = ln.begin();
+			Value cur;
+			if (tk->type == Tok::Word && tk->index == Kw::Not && param(Kw::Not) < 0){
+				if (++tk == ln.end()) throw Unsupported{};
+				Value operand = token(*tk++);
+				cur = builtin(Kw::Not).fn(mm, &operand);
+			}
+			else cur = token(*tk++);
+			while (tk != ln.end()){
+				if (tk->type == Tok::Atom){
+					int op = operation(tk++->index);
+					if (op == Kw::Negate){
+						cur = builtin(op).fn(mm, &cur);
+						continue;
+					}
+					if (op < 0 || tk == ln.end()) throw Unsupported{};
+					Value pair[2] = { cur, token(*tk++) };
+					cur = builtin(op).fn(mm, pair);
+				}
+				else if (cur.type == ValType::Table){
+					Table& t = mm.get<Table>(cur);
+					auto it = t.find(token(*tk++));
+					if (it == t.end()) throw Unsupported{};
+					cur = it->second;
+				}
+				else throw Unsupported{};
+			}
+			return cur;
+		}
+
+		Value token(const Token& tok){
+			switch (tok.type){
+			case Tok::Integer: return make_integer(prog.integers[tok.index]);
+			case Tok::Number: return make_number(prog.numbers[tok.index]);
+			case Tok::Word:{
+				int p = param(tok.index);
+				if (p < 0) throw Unsupported{};
+				return args[p];
+			}
+			case Tok::Group: return group(tok.index);
+			case Tok::Branch:{
+				const BranchInfo& br = prog.branches[tok.index];
+				switch (br.op){
+				case Kw::Tern: return token(br.operands[token(br.operands[0]).type != ValType::Null ? 1 : 2]);
+				case Kw::If:
+					if (token(br.operands[0]).type != ValType::Null) token(br.operands[1]);
+					return Value{ ValType::Null };
+				case Kw::While:
+					while (token(br.operands[0]).type != ValType::Null) token(br.operands[1]);
+					return Value{ ValType::Null };
+				default: throw Unsupported{};
+				}
+			}
+			default: throw Unsupported{};
+			}
+		}
+
+		int param(int word){
+			for (int i = (int)clos.bindings.size() - 1; i >= 0; --i)
+				if (clos.bindings[i].index == word) return i;
+			return -1;
+		}
+
+		int operation(int word){
+			static const struct{ const char* name; int kw; } ops[] = {
+				{ "plus", Kw::Add }, { "minus", Kw::Minus }, { "times", Kw::Times },
+				{ "divide", Kw::Divide }, { "mod", Kw::Mod }, { "negate", Kw::Negate },
+				{ "lt", Kw::Lt }, { "lte", Kw::Lte }, { "gt", Kw::Gt }, { "gte", Kw::Gte }, { "eq", Kw::Eq }
+			};
+			for (const auto& op : ops)
+				if (prog.word(word) == op.name) return op.kw;
+			return -1;
+		}
+	};
+
+	bool same_result(Value a, Value b){
+		if (a.type != b.type) return false;
+		if (a.type == ValType::Integer) return a.integer == b.integer;
+		if (a.type == ValType::Number) return a.number == b.number || (a.number != a.number && b.number != b.number);
+		return a.type == ValType::True || a.type == ValType::Null;
+	}
+
+	struct Result{
+		std::string name;
+		std::string signature;
+		size_t code_bytes;
+		double interpreted_ns;
+		double jit_ns;
+		size_t bailouts;
+		bool matched;
+	};
+
+	// names of closures bound by name = ^args ..., found from their let lines
+	std::vector<std::string> closure_names(const Program& prog){
+		std::vector<std::string> names(prog.closures.size());
+		for (const auto& g : prog.groups)
+			for (const auto& ln : g){
+				if (ln.size() != 3) continue;
+				auto tk = ln.begin();
+				const Token& let = *tk++;
+				const Token& name = *tk++;
+				if (let.type == Tok::Atom && prog.word(let.index) == "let" && name.type == Tok::Word && tk->type == Tok::Closure)
+					names[tk->index] = prog.word(name.index);
+			}
+		return names;
+	}
+
+	class Bench{
+		const Program& prog;
+		MemoryManager mm;
+		Jit jit;
+		std::vector<Value> tables;
+		int calls;
+
+	public:
+		std::vector<Result> results;
+
+		Bench(const Program& prog, int calls) : prog(prog), jit{ prog, mm, 1 }, calls{ calls }{
+			for (int kind = IntArray; kind <= NumArray; ++kind){
+				Value t = mm.create(ValType::Table);
+				for (int i = 0; i < ArraySize; ++i)
+					mm.get<Table>(t)[make_integer(i)] = kind == IntArray ? make_integer(3 * i + 1) : make_number(1.5 * i - 4);
+				tables.push_back(t);
+			}
+		}
+
+		~Bench(){
+			for (Value t : tables) mm.deref(t);
+		}
+
+		const JitStats& stats() const{ return jit.stats(); }
+
+		void closure(const std::string& prefix, int c){
+			const ClosureInfo& clos = prog.closures[c];
+			size_t n = clos.bindings.size();
+			if (n == 0 || n > MaxBindings) return;
+			size_t signatures = 1;
+			for (size_t i = 0; i < n; ++i) signatures *= ArgKinds;
+			std::vector<ArgKind> kinds(n);
+			for (size_t s = 0; s < signatures; ++s){
+				size_t code = s;
+				for (size_t i = 0; i < n; ++i, code /= ArgKinds) kinds[i] = (ArgKind)(code % ArgKinds);
+				std::vector<Value> args = samples(kinds);
+				size_t bytes = jit.stats().code_bytes;
+				if (!jit.compile(c, &args[0]) || !evaluates(clos, args)) continue;
+				results.push_back(measure(prefix, c, kinds, args));
+				results.back().code_bytes = jit.stats().code_bytes - bytes;
+			}
+		}
+
+	private:
+		// Samples sets of arguments, one after another
+		// numbers stay in range of the arrays, so they can be used as keys
+		std::vector<Value> samples(const std::vector<ArgKind>& kinds){
+			std::vector<Value> args;
+			for (int k = 0; k < Samples; ++k)
+				for (size_t i = 0; i < kinds.size(); ++i){
+					int pos = (k + 5 * (int)i) % ArraySize;
+					switch (kinds[i]){
+					case IntArg: args.push_back(make_integer(pos)); break;
+					case NumArg: args.push_back(make_number(pos + 0.25)); break;
+					default: args.push_back(tables[kinds[i] - IntArray]);
+					}
+				}
+			return args;
+		}
+
+		bool evaluates(const ClosureInfo& clos, const std::vector<Value>& args){
+			try{
+				for (size_t k = 0; k < args.size(); k += clos.bindings.size())
+					Evaluator{ prog, mm, clos, &args[k] }.run();
+				return true;
+			}
+			catch (Unsupported&){
+				return false;
+			}
+			catch (RuntimeError&){
+				return false;
+			}
+		}
+
+		Result measure(const std::string& prefix, int c, const std::vector<ArgKind>& kinds, const std::vector<Value>& args){
+			const ClosureInfo& clos = prog.closures[c];
+			size_t n = clos.bindings.size();
+			Result r;
+			r.name = prefix;
+			for (size_t i = 0; i < n; ++i) r.signature += (i ? "," : "") + std::string{ arg_names[kinds[i]] };
+
+			r.matched = true;
+			size_t bailouts = jit.stats().bailouts;
+			Value sink{ ValType::Null };
+			for (int k = 0; k < Samples; ++k){
+				const Value* a = &args[k * n];
+				Value expected = Evaluator{ prog, mm, clos, a }.run();
+				Value got;
+				if (!jit.call(c, a, got)) got = Evaluator{ prog, mm, clos, a }.run();
+				if (!same_result(expected, got)) r.matched = false;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			for (int k = 0; k < calls; ++k)
+				sink = Evaluator{ prog, mm, clos, &args[k % Samples * n] }.run();
+			r.interpreted_ns = seconds_since(start) * 1e9 / calls;
+
+			start = std::chrono::steady_clock::now();
+			for (int k = 0; k < calls; ++k){
+				const Value* a = &args[k % Samples * n];
+				if (!jit.call(c, a, sink)) sink = Evaluator{ prog, mm, clos, a }.run();
+			}
+			r.jit_ns = seconds_since(start) * 1e9 / calls;
+			r.bailouts = jit.stats().bailouts - bailouts;
+			// keeps the loops from being optimized away
+			observed = (int)sink.type;
+			return r;
+		}
+	};
+
+	// expands source as the interpreter would before running it
+	bool expand(const std::string& source, Program& prog){
+		prog = tokenize(source);
+		if (!do_macros(prog)) return false;
+		elide_groups(prog);
+		lower_control_flow(prog);
+		return true;
+	}
+
+	void bench_program(const std::string& name, const Program& prog, int calls, std::vector<Result>& results, JitStats& totals){
+		Bench bench{ prog, calls };
+		std::vector<std::string> names = closure_names(prog);
+		for (size_t c = 0; c < prog.closures.size(); ++c)
+			bench.closure(name + ':' + (names[c].empty() ? std::to_string(c) : names[c]), (int)c);
+		results.insert(results.end(), bench.results.begin(), bench.results.end());
+		const JitStats& s = bench.stats();
+		totals.compiled += s.compiled;
+		totals.rejected += s.rejected;
+		totals.discarded += s.discarded;
+		totals.runs += s.runs;
+		totals.bailouts += s.bailouts;
+		totals.code_bytes += s.code_bytes;
+	}
+
+}
+
+int main(int argc, char** argv){
+	std::string corpus = EMILY_CORPUS_DIR;
+	int calls = 1000000;
+	for (int i = 1; i < argc; ++i){
+		bool has_value = i + 1 < argc;
+		if (has_value && std::strcmp(argv[i], "--corpus") == 0) corpus = argv[++i];
+		else if (has_value && std::strcmp(argv[i], "--calls") == 0) calls = std::atoi(argv[++i]);
+		else{
+			std::fprintf(stderr, "usage: %s [--corpus dir] [--calls n]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (calls < 1) calls = 1;
+
+	std::vector<Result> results;
+	JitStats totals{};
+	for (const char* name : programs){
+		std::string path = corpus + '/' + name + ".em";
+		std::string source;
+		Program prog;
+		if (!read_file(path, source) || !expand(source, prog)){
+			std::fprintf(stderr, "cannot expand %s\n", path.c_str());
+			continue;
+		}
+		bench_program(name, prog, calls, results, totals);
+	}
+	Program prog;
+	expand(kernels, prog);
+	bench_program("kernels", prog, calls, results, totals);
+
+	bool failed = false;
+	std::printf("{\"calls\":%d,\"closures\":[", calls);
+	for (size_t i = 0; i < results.size(); ++i){
+		const Result& r = results[i];
+		std::printf("%s\n{\"name\":\"%s\",\"signature\":\"%s\",\"code_bytes\":%zu,\"interpreted_ns\":%.2f,\"jit_ns\":%.2f,"
+			"\"speedup\":%.2f,\"bailouts\":%zu,\"matched\":%s}", i ? "," : "", r.name.c_str(), r.signature.c_str(), r.code_bytes,
+			r.interpreted_ns, r.jit_ns, r.interpreted_ns / r.jit_ns, r.bailouts, r.matched ? "true" : "false");
+		failed |= !r.matched;
+	}
+	std::printf("\n],\"compiled\":%zu,\"rejected\":%zu,\"discarded\":%zu,\"runs\":%zu,\"bailouts\":%zu,\"code_bytes\":%zu}\n",
+		totals.compiled, totals.rejected, totals.discarded, totals.runs, totals.bailouts, totals.code_bytes);
+	return failed ? 1 : 0;
+}
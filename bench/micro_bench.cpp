@@ -0,0 +1,454 @@
+// micro_bench.cpp
+// times the front end phases, memory pool patterns and number conversions on generated programs
+// writes one JSON object with a result per benchmark to stdout
+// usage: emily_bench [--lines n] [--seed n] [--reps n] [--filter substring]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include "builtins.h"
+#include "generator.h"
+#include "macro.h"
+#include "memory.h"
+#include "number.h"
+#include "table.h"
+#include "tokenize.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace{
+
+	// heap allocations made through operator new, counted for every benchmark
+	size_t allocations = 0;
+
+}
+
+void* operator new(size_t size){
+	++allocations;
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc{};
+}
+
+void operator delete(void* p) throw(){
+	std::free(p);
+}
+
+namespace{
+
+	using namespace emily;
+
+	// peak resident set size of the process in kilobytes
+	size_t peak_rss_kb(){
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS pmc;
+		GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc);
+		return pmc.PeakWorkingSetSize / 1024;
+#else
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_maxrss;
+#endif
+	}
+
+	size_t count_tokens(const Program& prog){
+		size_t n = 0;
+		for (const auto& group : prog.groups)
+			for (const auto& line : group) n += line.size();
+		return n;
+	}
+
+	struct Options{
+		int lines;
+		unsigned seed;
+		int reps;
+		const char* filter;
+	};
+
+	class Results{
+		bool first;
+		const char* filter;
+
+	public:
+		explicit Results(const Options& opt) : first{ true }, filter{ opt.filter }{
+			std::printf("{\"lines\":%d,\"seed\":%u,\"benchmarks\":[", opt.lines, opt.seed);
+		}
+
+		~Results(){
+			std::printf("\n]}\n");
+		}
+
+		bool wanted(const char* name) const{
+			return filter == nullptr || std::strstr(name, filter) != nullptr;
+		}
+
+		// items is what the rate is measured in: tokens, words or objects
+		void add(const char* name, double seconds, size_t items, size_t allocs, const char* extra = ""){
+			std::printf("%s\n{\"name\":\"%s\",\"seconds\":%.9f,\"items\":%zu,\"items_per_sec\":%.1f,"
+				"\"allocations\":%zu,\"peak_rss_kb\":%zu%s}",
+				first ? "" : ",", name, seconds, items, seconds > 0 ? items / seconds : 0.0,
+				allocs, peak_rss_kb(), extra);
+			first = false;
+		}
+	};
+
+	// runs fn reps times, returning the fastest time in seconds and
+	// the allocations made by one run
+	template<typename F>
+	double measure(int reps, size_t& allocs, F fn){
+		double best = 0;
+		for (int i = 0; i < reps; ++i){
+			size_t before = allocations;
+			auto start = std::chrono::steady_clock::now();
+			fn();
+			double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			allocs = allocations - before;
+			if (i == 0 || t < best) best = t;
+		}
+		return best;
+	}
+
+	void bench_front_end(Results& out, const Options& opt){
+		GeneratorOptions gen = default_generator_options();
+		gen.lines = opt.lines;
+		gen.seed = opt.seed;
+		std::string source = generate_program(gen);
+		size_t allocs = 0;
+
+		Program tokenized = tokenize(source);
+		size_t tokens = count_tokens(tokenized);
+		if (out.wanted("tokenize")){
+			double t = measure(opt.reps, allocs, [&]{ tokenize(source); });
+			out.add("tokenize", t, tokens, allocs);
+		}
+
+		if (out.wanted("do_macros")){
+			MacroTimes times{};
+			double t = measure(opt.reps, allocs, [&]{
+				Program prog = tokenized;
+				times = MacroTimes{};
+				do_macros(prog, &times);
+			});
+			std::string extra = ",\"transforms\":{";
+			for (int i = 0; i < TransformCount; ++i){
+				char buf[128];
+				std::sprintf(buf, "%s\"%s\":{\"seconds\":%.9f,\"applied\":%zu}", i ? "," : "",
+					transform_name(i), std::chrono::duration<double>(times.time[i]).count(), times.applied[i]);
+				extra += buf;
+			}
+			extra += '}';
+			// the copy of the program is part of each run
+			out.add("do_macros", t, tokens, allocs, extra.c_str());
+		}
+
+		if (out.wanted("elide_groups")){
+			Program expanded = tokenized;
+			do_macros(expanded);
+			double t = measure(opt.reps, allocs, [&]{
+				Program prog = expanded;
+				elide_groups(prog);
+			});
+			out.add("elide_groups", t, count_tokens(expanded), allocs);
+		}
+
+		if (out.wanted("lower_control_flow")){
+			Program elided = tokenized;
+			do_macros(elided);
+			elide_groups(elided);
+			size_t lowered = 0;
+			double t = measure(opt.reps, allocs, [&]{
+				Program prog = elided;
+				lowered = lower_control_flow(prog);
+			});
+			char extra[64];
+			std::sprintf(extra, ",\"lowered\":%zu", lowered);
+			// the copy of the program is part of each run
+			out.add("lower_control_flow", t, count_tokens(elided), allocs, extra);
+		}
+
+		if (out.wanted("intern")){
+			// the words of the program in order, so hits and misses mix like in tokenize
+			std::vector<std::string> words;
+			for (const auto& group : tokenized.groups)
+				for (const auto& line : group)
+					for (const auto& tok : line)
+						if (tok.type == Tok::Word) words.push_back(tokenized.word(tok.index));
+			double t = measure(opt.reps, allocs, [&]{
+				Program prog;
+				for (const auto& w : words) prog.intern(w);
+			});
+			out.add("intern", t, words.size(), allocs);
+		}
+	}
+
+	void bench_pools(Results& out, const Options& opt){
+		const int n = 100000;
+		size_t allocs = 0;
+
+		if (out.wanted("pool_create_free_lifo")){
+			MemoryManager mm;
+			std::vector<Value> vals(n);
+			double t = measure(opt.reps, allocs, [&]{
+				for (int i = 0; i < n; ++i) vals[i] = mm.create(ValType::Table);
+				for (int i = n - 1; i >= 0; --i) mm.deref(vals[i]);
+			});
+			out.add("pool_create_free_lifo", t, n, allocs);
+		}
+
+		if (out.wanted("pool_create_free_fifo")){
+			MemoryManager mm;
+			std::vector<Value> vals(n);
+			double t = measure(opt.reps, allocs, [&]{
+				for (int i = 0; i < n; ++i) vals[i] = mm.create(ValType::UserClosure);
+				for (int i = 0; i < n; ++i) mm.deref(vals[i]);
+			});
+			out.add("pool_create_free_fifo", t, n, allocs);
+		}
+
+		if (out.wanted("pool_churn")){
+			// a steady population where each new object replaces a pseudo-random old one
+			MemoryManager mm;
+			std::vector<Value> vals(n / 10);
+			for (auto& v : vals) v = mm.create(ValType::Continuation);
+			unsigned x = 12345;
+			double t = measure(opt.reps, allocs, [&]{
+				for (int i = 0; i < n; ++i){
+					x = x * 1103515245u + 12345u;
+					Value& slot = vals[(x >> 8) % vals.size()];
+					mm.deref(slot);
+					slot = mm.create(ValType::Continuation);
+				}
+			});
+			for (auto v : vals) mm.deref(v);
+			out.add("pool_churn", t, n, allocs);
+		}
+
+		if (out.wanted("pool_ref_deref")){
+			MemoryManager mm;
+			Value v = mm.create(ValType::Table);
+			double t = measure(opt.reps, allocs, [&]{
+				for (int i = 0; i < n; ++i) mm.ref(v);
+				for (int i = 0; i < n; ++i) mm.deref(v);
+			});
+			mm.deref(v);
+			out.add("pool_ref_deref", t, 2 * n, allocs);
+		}
+
+		if (out.wanted("pool_ref_deref_constant")){
+			// the same traffic on a literal from a constant pool, which is never counted
+			Program prog;
+			prog.strings.push_back("literal");
+			auto constants = std::make_shared<const ConstantPool>(prog);
+			MemoryManager mm;
+			mm.set_constants(constants);
+			Value v = mm.literal(prog, 0);
+			double t = measure(opt.reps, allocs, [&]{
+				for (int i = 0; i < n; ++i) mm.ref(v);
+				for (int i = 0; i < n; ++i) mm.deref(v);
+			});
+			out.add("pool_ref_deref_constant", t, 2 * n, allocs);
+		}
+
+		if (out.wanted("pool_table_of_strings")){
+			// building and dropping a structure, so freeing cascades through its references
+			MemoryManager mm;
+			double t = measure(opt.reps, allocs, [&]{
+				Value table = mm.create(ValType::Table);
+				Table& entries = mm.get<Table>(table);
+				for (int i = 0; i < n; ++i)
+					entries.insert(make_number(i), mm.create_string("entry"));
+				mm.deref(table);
+			});
+			out.add("pool_table_of_strings", t, 2 * n, allocs);
+		}
+
+		if (out.wanted("image_build") || out.wanted("image_save") || out.wanted("image_load")){
+			// a prelude-like heap: a global scope of class tables holding methods and names
+			const int classes = n / 20;
+			Program prog;
+			auto build = [&](MemoryManager& mm){
+				Value scope = mm.create(ValType::Table);
+				for (int i = 0; i < classes; ++i){
+					Value cls = mm.create(ValType::Table);
+					Table& members = mm.get<Table>(cls);
+					for (int j = 0; j < 8; ++j){
+						Value method = mm.create(ValType::UserClosure);
+						UserClosure& clos = mm.get<UserClosure>(method);
+						clos.bound.push_back(mm.create_string("bound"));
+						clos.envScope = mm.ref(scope);
+						clos.thisBindings[0] = clos.thisBindings[1] = Value{ ValType::Null };
+						members.insert(make_integer(j), method);
+					}
+					mm.get<Table>(scope).insert(mm.intern("class" + std::to_string(i)), cls);
+				}
+				return scope;
+			};
+			const char* path = "emily_bench.image";
+			if (out.wanted("image_build")){
+				double t = measure(opt.reps, allocs, [&]{
+					MemoryManager mm;
+					build(mm);
+				});
+				out.add("image_build", t, classes * 19, allocs);
+			}
+			{
+				MemoryManager mm;
+				std::vector<Value> roots{ build(mm) };
+				double t = measure(opt.reps, allocs, [&]{ mm.save_image(path, prog, roots); });
+				if (out.wanted("image_save")) out.add("image_save", t, classes * 19, allocs);
+			}
+			if (out.wanted("image_load")){
+				double t = measure(opt.reps, allocs, [&]{
+					MemoryManager mm;
+					std::vector<Value> roots;
+					mm.load_image(path, prog, roots);
+				});
+				out.add("image_load", t, classes * 19, allocs);
+			}
+			std::remove(path);
+		}
+	}
+
+	// numeric literals of every form, as written in a source, and their values
+	struct Literals{
+		std::string source;
+		std::vector<std::string> decimals;
+		std::vector<double> values;
+	};
+
+	Literals generate_literals(unsigned seed, int n){
+		Literals lit;
+		unsigned long long x = seed * 2654435761ULL + 1;
+		auto next = [&]{
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			return x;
+		};
+		char buf[64];
+		for (int i = 0; i < n; ++i){
+			unsigned long long r = next();
+			switch (r % 8){
+			case 0: std::sprintf(buf, "0x%llx", r >> 40); break;
+			case 1: std::sprintf(buf, "0o%llo", r >> 44); break;
+			case 2:{
+				// a short binary literal, written digit by digit
+				int len = 0;
+				buf[len++] = '0';
+				buf[len++] = 'b';
+				for (unsigned long long b = r >> 52; b != 0 || len == 2; b >>= 1) buf[len++] = '0' + (b & 1);
+				buf[len] = '\0';
+				break;
+			}
+			case 3: std::sprintf(buf, "%llu", r >> 44); break;
+			case 4: std::sprintf(buf, "%llu.%02llu", (r >> 20) % 10000, r % 100); break;
+			case 5: std::sprintf(buf, "%.17g", (double)(r >> 11) / (1ULL << 53)); break;
+			default: std::sprintf(buf, "%llu.%llue%d", (r >> 40) % 10, (r >> 20) % 1000, int(r % 600) - 300); break;
+			}
+			lit.source += buf;
+			lit.source += (i + 1) % 16 ? " " : "\n";
+			if (buf[0] != '0' || buf[1] == '.' || buf[1] == '\0'){
+				lit.decimals.push_back(buf);
+				lit.values.push_back(std::strtod(buf, nullptr));
+			}
+		}
+		return lit;
+	}
+
+	void bench_numbers(Results& out, const Options& opt){
+		const int n = 100000;
+		Literals lit = generate_literals(opt.seed, n);
+		size_t allocs = 0;
+		volatile double sink = 0;
+
+		if (out.wanted("tokenize_numbers")){
+			double t = measure(opt.reps, allocs, [&]{ tokenize(lit.source); });
+			out.add("tokenize_numbers", t, n, allocs);
+		}
+
+		if (out.wanted("number_parse")){
+			double t = measure(opt.reps, allocs, [&]{
+				for (const auto& d : lit.decimals) sink = parse_decimal(d.data(), d.data() + d.size());
+			});
+			out.add("number_parse", t, lit.decimals.size(), allocs);
+		}
+
+		if (out.wanted("number_parse_strtod")){
+			double t = measure(opt.reps, allocs, [&]{
+				for (const auto& d : lit.decimals) sink = std::strtod(d.c_str(), nullptr);
+			});
+			out.add("number_parse_strtod", t, lit.decimals.size(), allocs);
+		}
+
+		if (out.wanted("number_format")){
+			char buf[NumberBufferSize];
+			double t = measure(opt.reps, allocs, [&]{
+				for (double v : lit.values) sink = format_number(v, buf);
+			});
+			out.add("number_format", t, lit.values.size(), allocs);
+		}
+
+		if (out.wanted("number_format_printf")){
+			// the old %g output, which rounds to six digits
+			char buf[NumberBufferSize];
+			double t = measure(opt.reps, allocs, [&]{
+				for (double v : lit.values) sink = std::sprintf(buf, "%g", v);
+			});
+			out.add("number_format_printf", t, lit.values.size(), allocs);
+		}
+
+		// an index loop as the interpreter runs it: compare, look up, increment
+		// through the builtins, with the counter and keys Integers or Numbers
+		const int len = 10000;
+		const char* counters[] = { "index_loop_integer", "index_loop_number" };
+		for (int kind = 0; kind < 2; ++kind){
+			if (!out.wanted(counters[kind])) continue;
+			MemoryManager mm;
+			auto make = [&](int i){ return kind == 0 ? make_integer(i) : make_number(i); };
+			Table table;
+			for (int i = 0; i < len; ++i) table.insert(make(i), make(len - i));
+			double t = measure(opt.reps, allocs, [&]{
+				Value args[2] = { make(0), make(len) };
+				Value one = make(1);
+				while (builtin_lt(mm, args).type == ValType::True){
+					Value step[2] = { table.find(args[0])->second, one };
+					sink = number_value(builtin_add(mm, step));
+					step[0] = args[0];
+					args[0] = builtin_add(mm, step);
+				}
+			});
+			out.add(counters[kind], t, len, allocs);
+		}
+	}
+
+}
+
+int main(int argc, char** argv){
+	Options opt;
+	opt.lines = 1000;
+	opt.seed = 1;
+	opt.reps = 5;
+	opt.filter = nullptr;
+	for (int i = 1; i + 1 < argc; i += 2){
+		if (std::strcmp(argv[i], "--lines") == 0) opt.lines = std::atoi(argv[i + 1]);
+		else if (std::strcmp(argv[i], "--seed") == 0) opt.seed = std::strtoul(argv[i + 1], nullptr, 10);
+		else if (std::strcmp(argv[i], "--reps") == 0) opt.reps = std::atoi(argv[i + 1]);
+		else if (std::strcmp(argv[i], "--filter") == 0) opt.filter = argv[i + 1];
+		else{
+			std::fprintf(stderr, "usage: %s [--lines n] [--seed n] [--reps n] [--filter substring]\n", argv[0]);
+			return 1;
+		}
+	}
+	Results out{ opt };
+	bench_front_end(out, opt);
+	bench_pools(out, opt);
+	bench_numbers(out, opt);
+}
@@ -0,0 +1,117 @@
+// scheduler_bench.cpp
+// measures task switch cost and how many blocked tasks one scheduler can hold
+// the resume callback stands in for the interpreter, so the numbers are
+// the scheduler's own overhead on top of running the tasks' code
+// build: cmake target scheduler_bench
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include "scheduler.h"
+
+namespace{
+
+	using namespace emily;
+
+	double seconds_since(std::chrono::steady_clock::time_point start){
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// a continuation shaped like a task suspended a few calls deep
+	Value make_task(MemoryManager& mm, int frames){
+		Value cont = mm.create(ValType::Continuation);
+		mm.get<Continuation>(cont).stack.resize(frames, StackFrame{});
+		return cont;
+	}
+
+	// tasks yields times each, all round robin
+	void bench_yield(int tasks, int yields){
+		MemoryManager mm;
+		std::vector<int> left(tasks, yields);
+		Scheduler sched{ mm, [&](Scheduler& s, int id, Value cont, Value){
+			if (left[id]-- > 0) s.yield(cont);
+			else{
+				mm.deref(cont);
+				s.finish(Value{ ValType::Null });
+			}
+		} };
+		for (int i = 0; i < tasks; ++i) sched.detach(sched.spawn(make_task(mm, 4)));
+		auto start = std::chrono::steady_clock::now();
+		sched.run();
+		double ns = seconds_since(start) * 1e9 / ((double)tasks * (yields + 1));
+		std::printf("yield        %8d tasks %10.1f ns/switch\n", tasks, ns);
+	}
+
+	// pairs of tasks passing a message back and forth over two channels
+	void bench_ping_pong(int pairs, int messages){
+		MemoryManager mm;
+		std::vector<int> left(2 * pairs, messages);
+		std::vector<int> in(2 * pairs), out(2 * pairs);
+		Scheduler sched{ mm, [&](Scheduler& s, int id, Value cont, Value){
+			if (left[id]-- == 0){
+				mm.deref(cont);
+				s.finish(Value{ ValType::Null });
+				return;
+			}
+			s.send(out[id], Value{ ValType::True });
+			Value msg;
+			// each side keeps one message in flight, so its receive usually blocks
+			while (s.receive(in[id], cont, msg)){
+				if (left[id]-- == 0){
+					mm.deref(cont);
+					s.finish(Value{ ValType::Null });
+					return;
+				}
+				s.send(out[id], msg);
+			}
+		} };
+		for (int i = 0; i < pairs; ++i){
+			int a = sched.channel(), b = sched.channel();
+			int ping = sched.spawn(make_task(mm, 4));
+			int pong = sched.spawn(make_task(mm, 4));
+			in.resize(std::max<size_t>(in.size(), pong + 1));
+			out.resize(in.size());
+			left.resize(in.size(), messages);
+			in[ping] = a; out[ping] = b;
+			in[pong] = b; out[pong] = a;
+			sched.detach(ping);
+			sched.detach(pong);
+		}
+		auto start = std::chrono::steady_clock::now();
+		size_t deadlocked = sched.run();
+		double ns = seconds_since(start) * 1e9 / (2.0 * pairs * messages);
+		std::printf("ping-pong    %8d pairs %10.1f ns/message (%zu left blocked)\n", pairs, ns, deadlocked);
+	}
+
+	// spawns tasks that all block on one channel, then wakes them
+	void bench_capacity(int tasks){
+		MemoryManager mm;
+		Scheduler sched{ mm, [&](Scheduler& s, int, Value cont, Value resume){
+			Value msg;
+			if (resume.type == ValType::Null && !s.receive(0, cont, msg)) return;
+			mm.deref(cont);
+			s.finish(Value{ ValType::Null });
+		} };
+		sched.channel();
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < tasks; ++i) sched.detach(sched.spawn(make_task(mm, 4)));
+		sched.run();
+		double spawn = seconds_since(start);
+		MemorySnapshot snap = mm.snapshot(true);
+		const PoolStats& conts = snap.pools[(int)ValType::Continuation];
+		size_t bytes = conts.bytes + conts.heap_bytes;
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < tasks; ++i) sched.send(0, Value{ ValType::True });
+		sched.run();
+		double wake = seconds_since(start);
+		std::printf("blocked      %8d tasks %10.1f ns/spawn+block %10.1f ns/wake %8zu bytes/task\n",
+			tasks, spawn * 1e9 / tasks, wake * 1e9 / tasks, bytes / tasks);
+	}
+
+}
+
+int main(){
+	for (int n : { 1, 100, 10000 }) bench_yield(n, 1000000 / n);
+	for (int n : { 1, 1000 }) bench_ping_pong(n, 1000000 / n);
+	for (int n : { 10000, 1000000 }) bench_capacity(n);
+}
@@ -0,0 +1,79 @@
+// table_bench.cpp
+// compares emily::Table against the std::unordered_map it replaced
+// build: cmake target table_bench, or g++ -O2 -std=c++11 -I emily bench/table_bench.cpp emily/table.cpp emily/values.cpp
+
+#include <chrono>
+#include <cstdio>
+#include <unordered_map>
+#include "table.h"
+
+namespace{
+
+	using namespace emily;
+
+	typedef std::unordered_map<Value, Value> StdTable;
+
+	Value number(double d){
+		Value val;
+		val.type = ValType::Number;
+		val.number = d;
+		return val;
+	}
+
+	// times fn over reps repetitions, returns nanoseconds per repetition
+	template<typename F>
+	double time_ns(int reps, F fn){
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < reps; ++i) fn();
+		auto stop = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(stop - start).count() / reps;
+	}
+
+	// key patterns: array-like numbers and object-like atom indices
+	Value key(int i, bool atoms){
+		return atoms ? make_value(ValType::Atom, i) : number(i);
+	}
+
+	template<typename T>
+	void bench(const char* name, int n, bool atoms){
+		const int reps = n < 1000 ? 2000 : n < 100000 ? 100 : 5;
+		double sink = 0;
+		double insert = time_ns(reps, [&]{
+			T t;
+			for (int i = 0; i < n; ++i) t[key(i, atoms)] = number(i);
+			sink += t.size();
+		});
+		T t;
+		for (int i = 0; i < n; ++i) t[key(i, atoms)] = number(i);
+		double lookup = time_ns(reps, [&]{
+			for (int i = 0; i < n; ++i) sink += t.find(key(i, atoms))->second.number;
+		});
+		double miss = time_ns(reps, [&]{
+			for (int i = n; i < 2 * n; ++i) sink += t.count(key(i, atoms));
+		});
+		double iterate = time_ns(reps, [&]{
+			for (auto& entry : t) sink += entry.second.number;
+		});
+		double erase = time_ns(reps, [&]{
+			T copy = t;
+			for (int i = 0; i < n; i += 2) copy.erase(key(i, atoms));
+			sink += copy.size();
+		});
+		std::printf("%-14s %-7s %8d %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, atoms ? "atoms" : "numbers",
+			n, insert / n, lookup / n, miss / n, iterate / n, erase / n);
+		if (sink == -1) std::printf("\n");
+	}
+
+}
+
+int main(){
+	std::printf("%-14s %-7s %8s %10s %10s %10s %10s %10s\n", "table", "keys", "size",
+		"insert", "lookup", "miss", "iterate", "copy+erase");
+	std::printf("(ns per entry)\n");
+	for (int n : { 8, 64, 1000, 100000, 1000000 }){
+		for (bool atoms : { false, true }){
+			bench<StdTable>("unordered_map", n, atoms);
+			bench<emily::Table>("emily::Table", n, atoms);
+		}
+	}
+}
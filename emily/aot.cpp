@@ -0,0 +1,30 @@
+// aot.cpp
+
+#include <cstdio>
+#include <cstring>
+#include "aot.h"
+
+namespace emily{
+	namespace aot{
+
+		Runtime::Runtime(const Literal* literals) : out(standard_output()){
+			for (const Literal* lit = literals; lit->text != nullptr; ++lit)
+				prog.strings.push_back(std::string{ lit->text, lit->size });
+			constants = std::make_shared<const ConstantPool>(prog);
+			mm.set_constants(constants);
+		}
+
+		int runtime_error(Runtime& rt, const char* msg){
+			rt.out.flush();
+			std::fprintf(stderr, "Runtime Error: %s\n", msg);
+			return 1;
+		}
+
+		int finish(Runtime& rt){
+			if (rt.out.flush()) return 0;
+			std::fprintf(stderr, "Output Error: %s\n", std::strerror(rt.out.error()));
+			return 1;
+		}
+
+	}
+}
@@ -0,0 +1,157 @@
+// aot.h
+// runtime for programs translated to C++ by translate
+
+#ifndef __AOT_H__
+#define __AOT_H__
+
+#include <cstddef>
+#include <memory>
+#include "builtins.h"
+#include "memory.h"
+#include "output.h"
+
+namespace emily{
+	namespace aot{
+
+		// a string literal of the translated program, with its length, as it may hold nulls
+		struct Literal{
+			const char* text;
+			size_t size;
+		};
+
+		/**	Runtime of a translated program
+		 *	holds what the interpreter would: the memory manager, standard output,
+		 *	and the program's string literals as constants
+		 *	the program keeps only the literals, which print and the constants need
+		 */
+		class Runtime{
+			// first, so it outlives the constants, which refer to it
+			Program prog;
+
+		public:
+			// literals ends with an entry whose text is null
+			explicit Runtime(const Literal* literals);
+
+			MemoryManager mm;
+			Output& out;
+
+			const Program& program() const{ return prog; }
+			Value literal(int index) const{ return constants->literal(index); }
+
+		private:
+			std::shared_ptr<const ConstantPool> constants;
+
+			Runtime(const Runtime&);
+			Runtime& operator=(const Runtime&);
+		};
+
+		// reports the error, after anything the program printed, and returns the exit status
+		int runtime_error(Runtime& rt, const char* msg);
+		// flushes what the program printed and returns the exit status,
+		// reporting output that could not be written
+		int finish(Runtime& rt);
+
+		// runs a translated program, a class constructed from the runtime with a run member
+		template<typename Script>
+		int run(const Literal* literals){
+			Runtime rt{ literals };
+			try{
+				Script{ rt }.run();
+			}
+			catch (RuntimeError& e){
+				return runtime_error(rt, e.what());
+			}
+			return finish(rt);
+		}
+
+		inline Value null(){ return Value{ ValType::Null }; }
+		inline Value boolean(bool b){ return Value{ b ? ValType::True : ValType::Null }; }
+		// only null is false
+		inline bool truthy(Value val){ return val.type != ValType::Null; }
+
+		// operations with the builtins' results, inlined for two Integers or two Numbers;
+		// anything else, including Integer overflow, goes to the builtin
+		inline Value add(MemoryManager& mm, Value a, Value b){
+			if (a.type == ValType::Integer && b.type == ValType::Integer){
+				long long sum = (long long)((unsigned long long)a.integer + (unsigned long long)b.integer);
+				if (((a.integer ^ sum) & (b.integer ^ sum)) >= 0) return make_integer(sum);
+			}
+			else if (a.type == ValType::Number && b.type == ValType::Number) return make_number(a.number + b.number);
+			Value args[2] = { a, b };
+			return builtin_add(mm, args);
+		}
+
+		inline Value minus(MemoryManager& mm, Value a, Value b){
+			if (a.type == ValType::Integer && b.type == ValType::Integer){
+				long long diff = (long long)((unsigned long long)a.integer - (unsigned long long)b.integer);
+				if (((a.integer ^ b.integer) & (a.integer ^ diff)) >= 0) return make_integer(diff);
+			}
+			else if (a.type == ValType::Number && b.type == ValType::Number) return make_number(a.number - b.number);
+			Value args[2] = { a, b };
+			return builtin_minus(mm, args);
+		}
+
+		inline Value times(MemoryManager& mm, Value a, Value b){
+			// products of integers under 2^31 cannot overflow
+			const long long small = 1LL << 31;
+			if (a.type == ValType::Integer && b.type == ValType::Integer &&
+				a.integer > -small && a.integer < small && b.integer > -small && b.integer < small)
+				return make_integer(a.integer * b.integer);
+			if (a.type == ValType::Number && b.type == ValType::Number) return make_number(a.number * b.number);
+			Value args[2] = { a, b };
+			return builtin_times(mm, args);
+		}
+
+		inline Value divide(MemoryManager& mm, Value a, Value b){
+			if (a.type == ValType::Number && b.type == ValType::Number) return make_number(a.number / b.number);
+			Value args[2] = { a, b };
+			return builtin_divide(mm, args);
+		}
+
+		inline Value mod(MemoryManager& mm, Value a, Value b){
+			Value args[2] = { a, b };
+			return builtin_mod(mm, args);
+		}
+
+		inline Value negate(MemoryManager& mm, Value a){
+			if (a.type == ValType::Number) return make_number(-a.number);
+			return builtin_negate(mm, &a);
+		}
+
+		// comparisons with NaN are false, as they are for the builtins
+		inline Value lt(MemoryManager& mm, Value a, Value b){
+			if (a.type == ValType::Integer && b.type == ValType::Integer) return boolean(a.integer < b.integer);
+			if (a.type == ValType::Number && b.type == ValType::Number) return boolean(a.number < b.number);
+			Value args[2] = { a, b };
+			return builtin_lt(mm, args);
+		}
+
+		inline Value lte(MemoryManager& mm, Value a, Value b){
+			if (a.type == ValType::Integer && b.type == ValType::Integer) return boolean(a.integer <= b.integer);
+			if (a.type == ValType::Number && b.type == ValType::Number) return boolean(a.number <= b.number);
+			Value args[2] = { a, b };
+			return builtin_lte(mm, args);
+		}
+
+		inline Value gt(MemoryManager& mm, Value a, Value b){
+			if (a.type == ValType::Integer && b.type == ValType::Integer) return boolean(a.integer > b.integer);
+			if (a.type == ValType::Number && b.type == ValType::Number) return boolean(a.number > b.number);
+			Value args[2] = { a, b };
+			return builtin_gt(mm, args);
+		}
+
+		inline Value gte(MemoryManager& mm, Value a, Value b){
+			if (a.type == ValType::Integer && b.type == ValType::Integer) return boolean(a.integer >= b.integer);
+			if (a.type == ValType::Number && b.type == ValType::Number) return boolean(a.number >= b.number);
+			Value args[2] = { a, b };
+			return builtin_gte(mm, args);
+		}
+
+		inline Value eq(Value a, Value b){
+			return boolean(a == b);
+		}
+
+	}
+}
+
+#endif
@@ -0,0 +1,130 @@
+// builtins.cpp
+
+#include <climits>
+#include <cmath>
+#include "builtins.h"
+
+namespace emily{
+
+	namespace{
+#define EMILY_BUILTIN_ENTRY(id, str, argc, kind, fn) { Kw::id, str, argc, ClosureThis::kind, fn },
+		const Builtin registry[] = { EMILY_KEYWORDS(EMILY_BUILTIN_ENTRY) };
+#undef EMILY_BUILTIN_ENTRY
+
+		Value boolean(bool b){
+			return Value{ b ? ValType::True : ValType::Null };
+		}
+
+		double number(Value val){
+			if (!is_number(val))
+				throw RuntimeError{ "arithmetic on a value that is not a number" };
+			return number_value(val);
+		}
+
+		bool integers(const Value* args){
+			return args[0].type == ValType::Integer && args[1].type == ValType::Integer;
+		}
+
+		// integer arithmetic that reports overflow instead of wrapping, so the
+		// caller can redo the operation in floating point
+		bool add_overflows(long long a, long long b){
+			return b > 0 ? a > LLONG_MAX - b : a < LLONG_MIN - b;
+		}
+
+		bool sub_overflows(long long a, long long b){
+			return b < 0 ? a > LLONG_MAX + b : a < LLONG_MIN + b;
+		}
+
+		bool mul_overflows(long long a, long long b){
+			if (a == 0 || b == 0) return false;
+			if (a > 0) return b > 0 ? a > LLONG_MAX / b : b < LLONG_MIN / a;
+			return b > 0 ? a < LLONG_MIN / b : a < LLONG_MAX / b;
+		}
+
+		// Integer arguments compare exactly, as doubles would lose precision past 2^53
+		int compare(const Value* args){
+			if (integers(args))
+				return args[0].integer < args[1].integer ? -1 : args[0].integer > args[1].integer ? 1 : 0;
+			double a = number(args[0]), b = number(args[1]);
+			// unordered, so every comparison with NaN is false
+			if (a != a || b != b) return 2;
+			return a < b ? -1 : a > b ? 1 : 0;
+		}
+	}
+
+	const Builtin& builtin(int id){
+		return registry[id];
+	}
+
+	Value builtin_eq(MemoryManager&, const Value* args){
+		return boolean(args[0] == args[1]);
+	}
+
+	Value builtin_not(MemoryManager&, const Value* args){
+		return boolean(args[0].type == ValType::Null);
+	}
+
+	Value builtin_nullfn(MemoryManager&, const Value*){
+		return Value{ ValType::Null };
+	}
+
+	Value builtin_negate(MemoryManager&, const Value* args){
+		if (args[0].type == ValType::Integer && args[0].integer != LLONG_MIN)
+			return make_integer(-args[0].integer);
+		return make_number(-number(args[0]));
+	}
+
+	Value builtin_add(MemoryManager&, const Value* args){
+		if (integers(args) && !add_overflows(args[0].integer, args[1].integer))
+			return make_integer(args[0].integer + args[1].integer);
+		return make_number(number(args[0]) + number(args[1]));
+	}
+
+	Value builtin_minus(MemoryManager&, const Value* args){
+		if (integers(args) && !sub_overflows(args[0].integer, args[1].integer))
+			return make_integer(args[0].integer - args[1].integer);
+		return make_number(number(args[0]) - number(args[1]));
+	}
+
+	Value builtin_times(MemoryManager&, const Value* args){
+		if (integers(args) && !mul_overflows(args[0].integer, args[1].integer))
+			return make_integer(args[0].integer * args[1].integer);
+		return make_number(number(args[0]) * number(args[1]));
+	}
+
+	Value builtin_divide(MemoryManager&, const Value* args){
+		// only a division with no remainder stays an Integer
+		if (integers(args)){
+			long long a = args[0].integer, b = args[1].integer;
+			if (b != 0 && !(a == LLONG_MIN && b == -1) && a % b == 0)
+				return make_integer(a / b);
+		}
+		return make_number(number(args[0]) / number(args[1]));
+	}
+
+	Value builtin_mod(MemoryManager&, const Value* args){
+		// like fmod, the result takes the sign of the dividend
+		if (integers(args) && args[1].integer != 0)
+			return make_integer(args[1].integer == -1 ? 0 : args[0].integer % args[1].integer);
+		return make_number(std::fmod(number(args[0]), number(args[1])));
+	}
+
+	Value builtin_lt(MemoryManager&, const Value* args){
+		return boolean(compare(args) == -1);
+	}
+
+	Value builtin_lte(MemoryManager&, const Value* args){
+		int order = compare(args);
+		return boolean(order == -1 || order == 0);
+	}
+
+	Value builtin_gt(MemoryManager&, const Value* args){
+		return boolean(compare(args) == 1);
+	}
+
+	Value builtin_gte(MemoryManager&, const Value* args){
+		int order = compare(args);
+		return boolean(order == 1 || order == 0);
+	}
+
+}
@@ -0,0 +1,56 @@
+// builtins.h
+
+#ifndef __BUILTINS_H__
+#define __BUILTINS_H__
+
+#include <stdexcept>
+#include "memory.h"
+
+namespace emily{
+
+	// thrown by builtins on errors in the program being run
+	class RuntimeError : public std::runtime_error{
+	public:
+		explicit RuntimeError(const char* msg) : std::runtime_error{ msg }{}
+	};
+
+	// args holds this first for builtins with this kind Current, then argc arguments
+	// returns a new reference
+	typedef Value(*BuiltinPtr)(MemoryManager& mm, const Value* args);
+
+	struct Builtin{
+		int id;				// keyword id, also the index in the registry
+		const char* name;
+		int argc;
+		ClosureThis thisKind;
+		BuiltinPtr fn;		// null if the interpreter implements the builtin itself
+	};
+
+	/**	Builtin registry
+	 *	one entry for each keyword, built from keywords.h at compile time,
+	 *	so every program and interpreter shares it and none allocates for builtins
+	 *	a BuiltinFunction value is the index of its entry
+	 */
+	const Builtin& builtin(int id);
+
+	inline Value builtin_value(int id){
+		return make_value(ValType::BuiltinFunction, id);
+	}
+
+	Value builtin_eq(MemoryManager& mm, const Value* args);
+	Value builtin_not(MemoryManager& mm, const Value* args);
+	Value builtin_nullfn(MemoryManager& mm, const Value* args);
+	Value builtin_negate(MemoryManager& mm, const Value* args);
+	Value builtin_add(MemoryManager& mm, const Value* args);
+	Value builtin_minus(MemoryManager& mm, const Value* args);
+	Value builtin_times(MemoryManager& mm, const Value* args);
+	Value builtin_divide(MemoryManager& mm, const Value* args);
+	Value builtin_mod(MemoryManager& mm, const Value* args);
+	Value builtin_lt(MemoryManager& mm, const Value* args);
+	Value builtin_lte(MemoryManager& mm, const Value* args);
+	Value builtin_gt(MemoryManager& mm, const Value* args);
+	Value builtin_gte(MemoryManager& mm, const Value* args);
+
+}
+
+#endif
@@ -0,0 +1,381 @@
+// collections.cpp
+
+#include <algorithm>
+#include <cmath>
+#include "builtins.h"
+#include "collections.h"
+
+namespace emily{
+
+	namespace{
+		// chunk size of the parallel builtins, fixed so results do not depend on the pool
+		const size_t ChunkSize = 1024;
+
+		bool truthy(Value val){
+			return val.type != ValType::Null;
+		}
+
+		// turns a reference owned by the caller into a counted one,
+		// which stays valid if the interpreter reconciles during a callback
+		void keep(MemoryManager& mm, Value val){
+			if (mm.deferred()) mm.ref(val);
+		}
+
+		// turns a counted reference back into one owned by the caller
+		void unkeep(MemoryManager& mm, Value val){
+			if (mm.deferred()) mm.deref(val);
+		}
+
+		// releases a reference owned by the caller
+		void drop(MemoryManager& mm, Value val){
+			if (!mm.deferred()) mm.deref(val);
+		}
+
+		// a copy of a table's entries, each holding a counted reference
+		struct Held{
+			MemoryManager& mm;
+			std::vector<TableEntry> entries;
+
+			Held(MemoryManager& mm, Value table) : mm(mm){
+				Table& t = mm.get<Table>(table);
+				entries.reserve(t.size());
+				for (const auto& entry : t){
+					entries.push_back(entry);
+					mm.ref(entry.first);
+					mm.ref(entry.second);
+				}
+			}
+
+			~Held(){
+				for (const auto& entry : entries){
+					mm.deref(entry.first);
+					mm.deref(entry.second);
+				}
+			}
+		};
+
+		// a new table, kept counted while it is filled in
+		struct Building{
+			MemoryManager& mm;
+			Handle<Table> handle;
+			bool finished;
+
+			explicit Building(MemoryManager& mm) : mm(mm), handle(mm.create<Table>()), finished{ false }{
+				keep(mm, handle.value());
+			}
+
+			Table& table(){
+				return mm.get(handle);
+			}
+
+			// returns the table as a reference owned by the caller
+			Value finish(){
+				finished = true;
+				unkeep(mm, handle.value());
+				return handle.value();
+			}
+
+			~Building(){
+				if (!finished){
+					unkeep(mm, handle.value());
+					drop(mm, handle.value());
+				}
+			}
+		};
+
+		// array of values, each of which gets a new counted reference
+		Value make_array(MemoryManager& mm, const std::vector<Value>& values){
+			Building out{ mm };
+			Table& table = out.table();
+			table.reserve(values.size());
+			for (size_t i = 0; i < values.size(); ++i)
+				table.insert(make_integer(i), mm.ref(values[i]));
+			return out.finish();
+		}
+
+		std::vector<Value> values_of(const Held& held){
+			std::vector<Value> values;
+			values.reserve(held.entries.size());
+			for (const auto& entry : held.entries) values.push_back(entry.second);
+			return values;
+		}
+	}
+
+	Value table_map(MemoryManager& mm, Value table, const UnaryFn& fn){
+		Held held{ mm, table };
+		Building out{ mm };
+		out.table().reserve(held.entries.size());
+		for (const auto& entry : held.entries){
+			Value result = fn(entry.second);
+			keep(mm, result);
+			// the closure may have grown the pools, but table storage does not move
+			out.table().insert(mm.ref(entry.first), result);
+		}
+		return out.finish();
+	}
+
+	Value table_filter(MemoryManager& mm, Value table, const UnaryFn& pred){
+		Held held{ mm, table };
+		std::vector<Value> kept;
+		for (const auto& entry : held.entries){
+			Value result = pred(entry.second);
+			bool keep_value = truthy(result);
+			drop(mm, result);
+			if (keep_value) kept.push_back(entry.second);
+		}
+		return make_array(mm, kept);
+	}
+
+	Value table_reduce(MemoryManager& mm, Value table, Value init, const BinaryFn& fn){
+		Held held{ mm, table };
+		Value acc = mm.ref(init);
+		try{
+			for (const auto& entry : held.entries){
+				Value result = fn(acc, entry.second);
+				keep(mm, result);
+				mm.deref(acc);
+				acc = result;
+			}
+		}
+		catch (...){
+			mm.deref(acc);
+			throw;
+		}
+		unkeep(mm, acc);
+		return acc;
+	}
+
+	Value table_sort(MemoryManager& mm, Value table, const BinaryFn& less){
+		Held held{ mm, table };
+		std::vector<Value> values = values_of(held);
+		std::stable_sort(values.begin(), values.end(), [&](Value a, Value b){
+			Value result = less(a, b);
+			drop(mm, result);
+			return truthy(result);
+		});
+		return make_array(mm, values);
+	}
+
+	Value table_range(MemoryManager& mm, double start, double end, double step){
+		if (!std::isfinite(start) || !std::isfinite(end) || !std::isfinite(step))
+			throw RuntimeError{ "range of a bound or step that is not a finite number" };
+		// a zero step gives an empty range, as does a step away from end
+		double span = step == 0 ? 0 : (end - start) / step;
+		if (span > MaxRange)
+			throw RuntimeError{ "range of too many elements" };
+		Building out{ mm };
+		if (span > 0){
+			size_t n = (size_t)std::ceil(span);
+			Table& table = out.table();
+			table.reserve(n);
+			// whole bounds small enough that every element is exact give Integers
+			const double exact = 9007199254740992.0;
+			bool whole = start == std::floor(start) && step == std::floor(step)
+				&& std::fabs(start) <= exact && std::fabs(end) <= exact && std::fabs(step) <= exact;
+			if (whole){
+				long long first = (long long)start, by = (long long)step;
+				for (size_t i = 0; i < n; ++i)
+					table.insert(make_integer(i), make_integer(first + (long long)i * by));
+			}
+			// multiplying rather than accumulating keeps every element exact for integer steps
+			else for (size_t i = 0; i < n; ++i)
+				table.insert(make_integer(i), make_number(start + i * step));
+		}
+		return out.finish();
+	}
+
+	WorkPool::WorkPool(unsigned threads)
+		: body{ nullptr }, count{ 0 }, chunk{ 1 }, next{ 0 }, generation{ 0 }, busy{ 0 }, stopping{ false }{
+		if (threads == 0) threads = std::thread::hardware_concurrency();
+		for (unsigned i = 1; i < threads; ++i)
+			workers.push_back(std::thread{ [this]{ work(); } });
+	}
+
+	WorkPool::~WorkPool(){
+		{
+			std::lock_guard<std::mutex> guard{ lock };
+			stopping = true;
+		}
+		start.notify_all();
+		for (auto& worker : workers) worker.join();
+	}
+
+	void WorkPool::run(size_t n, size_t size, const Body& fn){
+		if (n == 0) return;
+		std::unique_lock<std::mutex> guard{ lock };
+		body = &fn;
+		count = n;
+		chunk = size == 0 ? 1 : size;
+		next = 0;
+		error = nullptr;
+		++generation;
+		start.notify_all();
+		take_chunks(guard);
+		done.wait(guard, [this]{ return busy == 0; });
+		body = nullptr;
+		if (error){
+			std::exception_ptr e = error;
+			error = nullptr;
+			std::rethrow_exception(e);
+		}
+	}
+
+	unsigned WorkPool::threads() const{
+		return workers.size() + 1;
+	}
+
+	void WorkPool::work(){
+		std::unique_lock<std::mutex> guard{ lock };
+		unsigned seen = generation;
+		for (;;){
+			start.wait(guard, [&]{ return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+			take_chunks(guard);
+		}
+	}
+
+	// runs unclaimed chunks until none are left, with lock held between chunks
+	void WorkPool::take_chunks(std::unique_lock<std::mutex>& guard){
+		++busy;
+		while (next < count && !error){
+			size_t begin = next;
+			size_t end = std::min(count, begin + chunk);
+			next = end;
+			const Body& fn = *body;
+			guard.unlock();
+			try{
+				fn(begin, end);
+			}
+			catch (...){
+				guard.lock();
+				if (!error) error = std::current_exception();
+				continue;
+			}
+			guard.lock();
+		}
+		if (--busy == 0) done.notify_all();
+	}
+
+	bool parallel_safe(const Program& prog, const ClosureInfo& clos){
+		static const char* const ops[] = {
+			"plus", "minus", "times", "divide", "mod", "negate", "lt", "lte", "gt", "gte", "eq"
+		};
+		auto is_op = [&](int word){
+			for (auto op : ops)
+				if (prog.word(word) == op) return true;
+			return false;
+		};
+		auto is_binding = [&](int word){
+			for (const auto& tok : clos.bindings)
+				if (tok.index == word) return true;
+			return false;
+		};
+		std::vector<int> groups{ clos.group_idx };
+		while (!groups.empty()){
+			int g = groups.back();
+			groups.pop_back();
+			for (const auto& line : prog.groups[g]){
+				for (const auto& tok : line){
+					switch (tok.type){
+					case Tok::Number:
+					case Tok::Integer:
+					case Tok::HexNumber:
+					case Tok::OctNumber:
+					case Tok::BinNumber:
+					case Tok::FloatNumber:
+						break;
+					case Tok::Word:
+						if (!is_binding(tok.index) && tok.index != Kw::Not) return false;
+						break;
+					case Tok::Atom:
+						if (!is_op(tok.index)) return false;
+						break;
+					case Tok::Group:
+						// objects and scopes allocate
+						if (prog.group_kinds[tok.index] != '(') return false;
+						groups.push_back(tok.index);
+						break;
+					default:
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	Value parallel_map(MemoryManager& mm, WorkPool& pool, Value table, const UnaryFn& fn){
+		Held held{ mm, table };
+		std::vector<Value> results(held.entries.size());
+		pool.run(results.size(), ChunkSize, [&](size_t begin, size_t end){
+			for (size_t i = begin; i < end; ++i)
+				results[i] = fn(held.entries[i].second);
+		});
+		Building out{ mm };
+		Table& t = out.table();
+		t.reserve(results.size());
+		for (size_t i = 0; i < results.size(); ++i)
+			t.insert(mm.ref(held.entries[i].first), mm.ref(results[i]));
+		return out.finish();
+	}
+
+	Value parallel_filter(MemoryManager& mm, WorkPool& pool, Value table, const UnaryFn& pred){
+		Held held{ mm, table };
+		std::vector<char> keep_value(held.entries.size());
+		pool.run(keep_value.size(), ChunkSize, [&](size_t begin, size_t end){
+			for (size_t i = begin; i < end; ++i)
+				keep_value[i] = truthy(pred(held.entries[i].second));
+		});
+		std::vector<Value> kept;
+		for (size_t i = 0; i < keep_value.size(); ++i)
+			if (keep_value[i]) kept.push_back(held.entries[i].second);
+		return make_array(mm, kept);
+	}
+
+	Value parallel_reduce(MemoryManager& mm, WorkPool& pool, Value table, Value init, const BinaryFn& fn){
+		Held held{ mm, table };
+		std::vector<Value> values = values_of(held);
+		size_t chunks = (values.size() + ChunkSize - 1) / ChunkSize;
+		std::vector<Value> partial(chunks);
+		pool.run(chunks, 1, [&](size_t begin, size_t end){
+			for (size_t c = begin; c < end; ++c){
+				size_t first = c * ChunkSize, last = std::min(values.size(), first + ChunkSize);
+				Value acc = values[first];
+				for (size_t i = first + 1; i < last; ++i)
+					acc = fn(acc, values[i]);
+				partial[c] = acc;
+			}
+		});
+		Value acc = init;
+		for (auto val : partial)
+			acc = fn(acc, val);
+		// the result is init, a value in the table or an unmanaged value, all still alive
+		return mm.acquire(acc);
+	}
+
+	Value parallel_sort(MemoryManager& mm, WorkPool& pool, Value table, const BinaryFn& less){
+		Held held{ mm, table };
+		std::vector<Value> values = values_of(held);
+		auto cmp = [&](Value a, Value b){
+			return truthy(less(a, b));
+		};
+		size_t n = values.size();
+		// sort fixed chunks, then merge neighbouring runs, doubling the run length each pass
+		pool.run((n + ChunkSize - 1) / ChunkSize, 1, [&](size_t begin, size_t end){
+			for (size_t c = begin; c < end; ++c)
+				std::stable_sort(values.begin() + c * ChunkSize, values.begin() + std::min(n, (c + 1) * ChunkSize), cmp);
+		});
+		for (size_t width = ChunkSize; width < n; width *= 2){
+			pool.run((n + 2 * width - 1) / (2 * width), 1, [&](size_t begin, size_t end){
+				for (size_t p = begin; p < end; ++p){
+					size_t lo = p * 2 * width;
+					size_t mid = std::min(n, lo + width), hi = std::min(n, lo + 2 * width);
+					std::inplace_merge(values.begin() + lo, values.begin() + mid, values.begin() + hi, cmp);
+				}
+			});
+		}
+		return make_array(mm, values);
+	}
+
+}
@@ -0,0 +1,102 @@
+// collections.h
+
+#ifndef __COLLECTIONS_H__
+#define __COLLECTIONS_H__
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "memory.h"
+
+namespace emily{
+
+	// closures called by the collection builtins, supplied by the interpreter
+	typedef std::function<Value(Value)> UnaryFn;
+	typedef std::function<Value(Value, Value)> BinaryFn;
+
+	/**	Native collection builtins
+	 *	loops over table storage that would otherwise be written in emily,
+	 *	calling back into the interpreter only for the closure argument
+	 *	arrays are tables keyed by the numbers 0 to n - 1, in insertion order
+	 *	closures return new references, and a result is true unless it is null
+	 *	the closure may modify the table it is given, since the entries are
+	 *	copied and held before the first call
+	 *	each returns a new reference to its result
+	 */
+
+	// table with the same keys, each value replaced by fn(value)
+	Value table_map(MemoryManager& mm, Value table, const UnaryFn& fn);
+	// array of the values for which pred is true, in order
+	Value table_filter(MemoryManager& mm, Value table, const UnaryFn& pred);
+	// folds fn over the values in order, starting from init
+	Value table_reduce(MemoryManager& mm, Value table, Value init, const BinaryFn& fn);
+	// array of the values, stably sorted by less
+	Value table_sort(MemoryManager& mm, Value table, const BinaryFn& less);
+	// most elements table_range makes, which keeps a mistaken step from exhausting memory
+	const double MaxRange = 4294967296.0;
+	// array of the numbers from start up to but not including end, step apart
+	// Integers when start and step are whole, Numbers otherwise
+	// throws RuntimeError if a bound or the step is not finite, or if the range
+	// would have more than MaxRange elements
+	Value table_range(MemoryManager& mm, double start, double end, double step);
+
+	/**	Work pool
+	 *	threads that run a loop in fixed-size chunks, each thread taking the
+	 *	next unclaimed chunk until none are left, so faster threads take more
+	 *	the calling thread works too, and nested runs are not supported
+	 */
+	class WorkPool{
+	public:
+		typedef std::function<void(size_t begin, size_t end)> Body;
+
+		// 0 threads uses one per core; the caller counts as one of them
+		explicit WorkPool(unsigned threads = 0);
+		~WorkPool();
+
+		// calls body on each chunk of [0, n) and returns once all are done
+		// rethrows the first exception thrown by body
+		void run(size_t n, size_t chunk, const Body& body);
+		unsigned threads() const;
+
+	private:
+		std::vector<std::thread> workers;
+		std::mutex lock;
+		std::condition_variable start, done;
+		const Body* body;
+		size_t count, chunk, next;
+		unsigned generation, busy;
+		bool stopping;
+		std::exception_ptr error;
+
+		void work();
+		void take_chunks(std::unique_lock<std::mutex>& guard);
+
+		WorkPool(const WorkPool&);
+		WorkPool& operator=(const WorkPool&);
+	};
+
+	// true if calls to the closure can run on any thread at the same time:
+	// its body only does arithmetic and comparisons on numbers and its own arguments,
+	// so it neither reads variables through scopes nor touches the memory manager
+	bool parallel_safe(const Program& prog, const ClosureInfo& clos);
+
+	/**	Parallel collection builtins
+	 *	like the native builtins, for closures that are parallel_safe
+	 *	closures are called on pool threads and must not change reference counts:
+	 *	they return either unmanaged values or one of their arguments, unreferenced
+	 *	work is split into chunks of a fixed size and combined in order, so the
+	 *	result does not depend on the number of threads or how chunks were scheduled
+	 */
+	Value parallel_map(MemoryManager& mm, WorkPool& pool, Value table, const UnaryFn& fn);
+	Value parallel_filter(MemoryManager& mm, WorkPool& pool, Value table, const UnaryFn& pred);
+	// fn should be associative: each chunk is folded from its first value,
+	// then the chunk results are folded in order starting from init
+	Value parallel_reduce(MemoryManager& mm, WorkPool& pool, Value table, Value init, const BinaryFn& fn);
+	Value parallel_sort(MemoryManager& mm, WorkPool& pool, Value table, const BinaryFn& less);
+
+}
+
+#endif
@@ -0,0 +1,65 @@
+// constants.cpp
+// immortal strings for the literals of a program
+
+#include "memory.h"
+
+namespace emily{
+
+	ConstantPool::ConstantPool(const Program& prog)
+		: prog(prog), prog_id{ prog.id.value }, items{ nullptr }, count{ 0 }, bytes{ 0 }{
+		// literal index and hash of each distinct literal
+		std::vector<std::pair<int, size_t>> distinct;
+		first.reserve(prog.strings.size());
+		for (size_t i = 0; i < prog.strings.size(); ++i){
+			const std::string& str = prog.strings[i];
+			size_t h = hash_chars(str.data(), str.size());
+			int item = -1;
+			auto range = by_hash.equal_range(h);
+			for (auto it = range.first; it != range.second && item < 0; ++it){
+				if (prog.strings[distinct[it->second].first] == str) item = it->second;
+			}
+			if (item < 0){
+				item = distinct.size();
+				by_hash.insert(std::make_pair(h, item));
+				distinct.push_back(std::make_pair((int)i, h));
+			}
+			first.push_back(item);
+		}
+		count = distinct.size();
+		if (count == 0) return;
+
+		bytes = count * sizeof(String);
+		items = static_cast<String*>(allocate_page(bytes));
+		for (size_t i = 0; i < count; ++i){
+			const std::string& str = prog.strings[distinct[i].first];
+			new (&items[i]) String{ std::make_shared<std::string>(str), 0, str.size(), distinct[i].second, true };
+		}
+		protect_page(items, bytes, false);
+	}
+
+	ConstantPool::~ConstantPool(){
+		if (items == nullptr) return;
+		protect_page(items, bytes, true);
+		for (size_t i = 0; i < count; ++i) items[i].~String();
+		release_page(items, bytes);
+	}
+
+	const String& ConstantPool::string(Value val) const{
+#ifdef EMILY_CHECKED
+		if (!is_constant(val) || (size_t)~val.index >= count)
+			throw InternalError{ "Internal Error: attempted to access constant that does not exist" };
+#endif
+		return items[~val.index];
+	}
+
+	Value ConstantPool::find(const char* str, size_t len, size_t hash) const{
+		auto range = by_hash.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it){
+			const String& s = items[it->second];
+			if (s.length == len && std::char_traits<char>::compare(s.data(), str, len) == 0)
+				return make_value(ValType::String, ~it->second);
+		}
+		return Value{ ValType::Null };
+	}
+
+}
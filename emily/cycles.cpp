@@ -0,0 +1,168 @@
+// cycles.cpp
+
+#include <unordered_map>
+#include <unordered_set>
+#include "memory.h"
+
+namespace emily{
+
+	bool MemoryManager::set_buffered(Value val, bool buffered){
+		switch (val.type){
+		case ValType::String: return strings.set_buffered(val.index, buffered);
+		case ValType::UserClosure: return userClosures.set_buffered(val.index, buffered);
+		case ValType::BuiltinClosure: return builtinClosures.set_buffered(val.index, buffered);
+		case ValType::Continuation: return continuations.set_buffered(val.index, buffered);
+		case ValType::Table: return tables.set_buffered(val.index, buffered);
+		default: return false;
+		}
+	}
+
+	/**	synchronous trial deletion over the objects reachable from a batch of suspects
+	 *	an object whose reference count is higher than the number of references to it
+	 *	from inside that subgraph is referenced from outside, so it and everything it
+	 *	reaches are live; the rest of the subgraph is garbage held only by itself
+	 *	with a budget the subgraph is cut off after that many objects; the objects
+	 *	found but not traversed are left out of it, so references from them count
+	 *	as references from outside, and the cut only makes the collector miss garbage
+	 *	the suspect whose subgraph was cut stays buffered, and the next run may
+	 *	traverse twice as many objects, so garbage larger than the budget is still
+	 *	found after a few runs
+	 */
+	void MemoryManager::collect_cycles(size_t budget){
+		if (collecting || releasing) return;
+		// references from the stack are not counted, so only reconcile can collect
+		if (defer && stack_roots == nullptr) return;
+		collecting = true;
+		++cycles.collections;
+
+		// position of each object found in nodes, and the references to it
+		// from the objects traversed, the first traversed of nodes
+		std::unordered_map<Value, size_t> position;
+		std::vector<Value> nodes;
+		std::vector<int> internal;
+		size_t traversed = 0;
+		size_t taken = 0;
+		if (budget != 0 && cycle_retry > budget) budget = cycle_retry;
+		// take suspects, oldest first, while the last one's subgraph was traversed whole
+		while (taken < suspects.size() && traversed == nodes.size() && (budget == 0 || traversed < budget)){
+			Value root = suspects[taken++];
+			// suspects may have been freed since they were recorded, their slots reused,
+			// and objects with a count of 0 are not part of any cycle
+			if (refcount(root) < 0 || !set_buffered(root, false) || refcount(root) == 0) continue;
+			++cycles.suspects;
+			if (!position.insert(std::make_pair(root, nodes.size())).second) continue;
+			nodes.push_back(root);
+			internal.push_back(0);
+			for (; traversed < nodes.size() && (budget == 0 || traversed < budget); ++traversed){
+				each_ref(nodes[traversed], [&](Value ref){
+					// constants are never garbage
+					if (ref.type < ValType::String || is_constant(ref)) return;
+					auto found = position.insert(std::make_pair(ref, nodes.size()));
+					if (found.second){
+						nodes.push_back(ref);
+						internal.push_back(1);
+					}
+					else ++internal[found.first->second];
+				});
+			}
+		}
+		auto in_subgraph = [&](Value val){
+			auto it = position.find(val);
+			return it != position.end() && it->second < traversed;
+		};
+
+		// mark objects referenced from outside and everything they reach in the subgraph
+		std::vector<Value> live;
+		std::unordered_set<Value> reached;
+		for (size_t i = 0; i < traversed; ++i){
+			Value node = nodes[i];
+			if (refcount(node) > internal[i] || (stack_roots != nullptr && stack_roots->count(node) != 0)){
+				live.push_back(node);
+				reached.insert(node);
+			}
+		}
+		for (size_t i = 0; i < live.size(); ++i){
+			each_ref(live[i], [&](Value ref){
+				if (in_subgraph(ref) && reached.insert(ref).second)
+					live.push_back(ref);
+			});
+		}
+
+		std::vector<Value> garbage;
+		for (size_t i = 0; i < traversed; ++i){
+			if (reached.count(nodes[i]) == 0) garbage.push_back(nodes[i]);
+		}
+		// the suspect cut off is the last one taken, and is tried again first
+		// unless it is garbage itself
+		if (traversed < nodes.size()){
+			Value root = suspects[taken - 1];
+			if (reached.count(root) != 0){
+				set_buffered(root, true);
+				--taken;
+			}
+			cycle_retry = 2 * budget;
+		}
+		else cycle_retry = 0;
+		suspects.erase(suspects.begin(), suspects.begin() + taken);
+		if (!garbage.empty()){
+			std::unordered_set<Value> dead{ garbage.begin(), garbage.end() };
+			// each flood through garbage from an object not yet seen is one cycle
+			std::unordered_set<Value> seen;
+			std::vector<Value> work;
+			for (auto obj : garbage){
+				if (!seen.insert(obj).second) continue;
+				++cycles.cycles;
+				work.push_back(obj);
+				while (!work.empty()){
+					Value val = work.back();
+					work.pop_back();
+					each_ref(val, [&](Value ref){
+						if (dead.count(ref) != 0 && seen.insert(ref).second)
+							work.push_back(ref);
+					});
+				}
+			}
+			for (auto obj : garbage){
+				cycles.bytes += footprint(obj);
+				++cycles.objects;
+			}
+			for (auto obj : garbage)
+				reclaim(obj, dead);
+			if (free_budget == 0) release_pending();
+		}
+		collecting = false;
+	}
+
+	// frees garbage found by the collector
+	// references to other garbage are dropped, since those objects are freed directly
+	void MemoryManager::reclaim(Value val, const std::unordered_set<Value>& dead){
+		auto keep = [&](Value ref){
+			if (dead.count(ref) == 0) release(ref);
+		};
+		switch (val.type){
+		case ValType::String: release_string(val.index); break;
+		case ValType::UserClosure: for_each_ref(userClosures.take(val), keep); break;
+		case ValType::BuiltinClosure: for_each_ref(builtinClosures.take(val), keep); break;
+		case ValType::Continuation: for_each_ref(continuations.take(val), keep); break;
+		case ValType::Table:{
+			Table table = tables.take(val);
+			for_each_ref(table, keep);
+			break;
+		}
+		default: break;
+		}
+	}
+
+	void MemoryManager::set_cycle_threshold(size_t suspects){
+		cycle_threshold = suspects;
+	}
+
+	void MemoryManager::set_cycle_budget(size_t objects){
+		cycle_budget = objects;
+	}
+
+	const CycleStats& MemoryManager::cycle_stats() const{
+		return cycles;
+	}
+
+}
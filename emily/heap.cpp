@@ -0,0 +1,242 @@
+// heap.cpp
+// allocation site tagging and heap dumps
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include "memory.h"
+
+namespace emily{
+
+	void MemoryManager::set_site_sampling(unsigned every){
+		site_every = every;
+		site_countdown = every;
+		if (every != 0 && sites.empty()) sites.push_back(AllocSite{});
+	}
+
+	void MemoryManager::tag_site(Value val){
+		site_countdown = site_every;
+		long long key = (long long)current_site.line << 32 | (unsigned)current_site.column;
+		auto found = site_ids.find(key);
+		int id;
+		if (found != site_ids.end()) id = found->second;
+		else{
+			id = sites.size();
+			sites.push_back(current_site);
+			site_ids.emplace(key, id);
+		}
+		switch (val.type){
+		case ValType::String: strings.set_site(val.index, id); break;
+		case ValType::UserClosure: userClosures.set_site(val.index, id); break;
+		case ValType::BuiltinClosure: builtinClosures.set_site(val.index, id); break;
+		case ValType::Table: tables.set_site(val.index, id); break;
+		case ValType::Continuation: continuations.set_site(val.index, id); break;
+		default: break;
+		}
+	}
+
+	const AllocSite* MemoryManager::allocation_site(Value val) const{
+		if (refcount(val) < 0)
+			throw InternalError{ "Internal Error: attempted to get allocation site of freed object" };
+		int id = 0;
+		switch (val.type){
+		case ValType::String: id = strings.site(val.index); break;
+		case ValType::UserClosure: id = userClosures.site(val.index); break;
+		case ValType::BuiltinClosure: id = builtinClosures.site(val.index); break;
+		case ValType::Table: id = tables.site(val.index); break;
+		case ValType::Continuation: id = continuations.site(val.index); break;
+		default: break;
+		}
+		return id == 0 ? nullptr : &sites[id];
+	}
+
+	HeapDump MemoryManager::heap_dump(){
+		HeapDump dump{};
+		dump.sample_every = site_every;
+
+		// number every live object; the virtual root is number n
+		std::vector<Value> nodes;
+		std::unordered_map<Value, int> number;
+		auto add = [&](Value val){
+			number.emplace(val, nodes.size());
+			nodes.push_back(val);
+		};
+		strings.each(add);
+		userClosures.each(add);
+		builtinClosures.each(add);
+		tables.each(add);
+		continuations.each(add);
+		int n = nodes.size();
+		int root = n;
+
+		std::vector<std::vector<int>> succ(n + 1), pred(n + 1);
+		std::vector<int> incoming(n, 0);
+		std::vector<size_t> size(n + 1, 0);
+		for (int v = 0; v < n; ++v){
+			size[v] = footprint(nodes[v]);
+			each_ref(nodes[v], [&](Value ref){
+				if (ref.type < ValType::String) return;
+				auto found = number.find(ref);
+				if (found == number.end()) return;
+				succ[v].push_back(found->second);
+				++incoming[found->second];
+			});
+		}
+		// references not held by other objects come from the stack or the interpreter's roots
+		std::vector<bool> rooted(n);
+		for (int v = 0; v < n; ++v)
+			rooted[v] = incoming[v] == 0 || refcount(nodes[v]) > incoming[v];
+
+		// depth first numbering from the root; objects not reached, like garbage
+		// cycles not yet collected, become roots of their own
+		std::vector<int> post(n + 1, -1), order;
+		std::vector<bool> seen(n + 1, false);
+		std::vector<std::pair<int, size_t>> walk;
+		auto visit = [&](int start){
+			if (seen[start]) return;
+			seen[start] = true;
+			walk.push_back(std::make_pair(start, 0));
+			while (!walk.empty()){
+				int v = walk.back().first;
+				size_t& next = walk.back().second;
+				if (next < succ[v].size()){
+					int w = succ[v][next++];
+					if (!seen[w]){
+						seen[w] = true;
+						walk.push_back(std::make_pair(w, 0));
+					}
+				}
+				else{
+					post[v] = order.size();
+					order.push_back(v);
+					walk.pop_back();
+				}
+			}
+		};
+		for (int v = 0; v < n; ++v){
+			if (rooted[v]){
+				succ[root].push_back(v);
+				visit(v);
+			}
+		}
+		for (int v = 0; v < n; ++v){
+			if (!seen[v]){
+				succ[root].push_back(v);
+				visit(v);
+			}
+		}
+		post[root] = order.size();
+		order.push_back(root);
+		for (int v = 0; v <= n; ++v)
+			for (int w : succ[v]) pred[w].push_back(v);
+
+		// immediate dominators, by Cooper, Harvey and Kennedy's iterative algorithm
+		std::vector<int> idom(n + 1, -1);
+		idom[root] = root;
+		auto intersect = [&](int a, int b){
+			while (a != b){
+				while (post[a] < post[b]) a = idom[a];
+				while (post[b] < post[a]) b = idom[b];
+			}
+			return a;
+		};
+		for (bool changed = true; changed;){
+			changed = false;
+			for (int i = order.size() - 2; i >= 0; --i){
+				int v = order[i];
+				int dom = -1;
+				for (int p : pred[v]){
+					if (idom[p] == -1) continue;
+					dom = dom == -1 ? p : intersect(p, dom);
+				}
+				if (dom != idom[v]){
+					idom[v] = dom;
+					changed = true;
+				}
+			}
+		}
+
+		// an object retains itself and what it dominates, which comes before it in order
+		std::vector<size_t> retained = size;
+		for (int i = 0; i < (int)order.size() - 1; ++i)
+			retained[idom[order[i]]] += retained[order[i]];
+		// an object counts toward its type's retained bytes unless an object
+		// of the same type dominates it, which already counts them
+		std::vector<unsigned> above(n + 1, 0);
+		std::map<std::pair<int, int>, HeapSiteStats> by_site;
+		for (int i = order.size() - 2; i >= 0; --i){
+			int v = order[i];
+			int t = (int)nodes[v].type;
+			if (idom[v] != root)
+				above[v] = above[idom[v]] | 1u << (int)nodes[idom[v]].type;
+			HeapTypeStats& st = dump.types[t];
+			++st.count;
+			st.bytes += size[v];
+			if (!(above[v] & 1u << t)) st.retained += retained[v];
+
+			const AllocSite* site = allocation_site(nodes[v]);
+			if (site != nullptr){
+				HeapSiteStats& ss = by_site[std::make_pair(int(site - sites.data()), t)];
+				ss.site = *site;
+				ss.type = nodes[v].type;
+				++ss.count;
+				ss.bytes += size[v];
+			}
+		}
+		for (const auto& s : by_site) dump.sites.push_back(s.second);
+		return dump;
+	}
+
+	void write_heap_dump(std::ostream& os, const HeapDump& dump){
+		os << "emily-heap 1\nsample_every " << dump.sample_every << '\n';
+		for (int t = (int)ValType::String; t < ValTypeCount; ++t){
+			const HeapTypeStats& st = dump.types[t];
+			os << "type " << type_name((ValType)t) << ' ' << st.count << ' ' << st.bytes << ' ' << st.retained << '\n';
+		}
+		for (const auto& s : dump.sites){
+			os << "site " << s.site.line << ' ' << s.site.column << ' ' << type_name(s.type)
+				<< ' ' << s.count << ' ' << s.bytes << '\n';
+		}
+	}
+
+	namespace{
+		bool parse_type(const std::string& name, ValType& type){
+			for (int t = 0; t < ValTypeCount; ++t){
+				if (name == type_name((ValType)t)){
+					type = (ValType)t;
+					return true;
+				}
+			}
+			return false;
+		}
+	}
+
+	bool read_heap_dump(std::istream& is, HeapDump& dump){
+		dump = HeapDump{};
+		std::string word;
+		int version;
+		if (!(is >> word >> version) || word != "emily-heap" || version != 1) return false;
+		while (is >> word){
+			if (word == "sample_every"){
+				if (!(is >> dump.sample_every)) return false;
+			}
+			else if (word == "type"){
+				std::string name;
+				HeapTypeStats st;
+				ValType type;
+				if (!(is >> name >> st.count >> st.bytes >> st.retained) || !parse_type(name, type)) return false;
+				dump.types[(int)type] = st;
+			}
+			else if (word == "site"){
+				HeapSiteStats s;
+				std::string name;
+				if (!(is >> s.site.line >> s.site.column >> name >> s.count >> s.bytes) || !parse_type(name, s.type))
+					return false;
+				dump.sites.push_back(s);
+			}
+			else return false;
+		}
+		return true;
+	}
+
+}
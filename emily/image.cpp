@@ -0,0 +1,404 @@
+// image.cpp
+// heap images, for loading a prepared heap instead of building it again
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include "memory.h"
+
+namespace emily{
+
+	namespace{
+		const char ImageMagic[] = { 'e', 'm', 'i', 'm' };
+		const unsigned ImageVersion = 2;
+		// images are written in host byte order, so a host with the other order reads this differently
+		const unsigned ByteOrder = 0x01020304;
+		// bytes of a value as written: its type, then its payload
+		const size_t ValueBytes = sizeof(int) + sizeof(long long);
+
+		// identifies a program by its text and shape, so an image is not loaded
+		// into a program whose words, literals or groups have other indices
+		unsigned long long fingerprint(const Program& prog){
+			unsigned long long h = 0;
+			auto mix = [&h](unsigned long long x){ h = (h ^ x) * 1099511628211ULL; };
+			auto mix_text = [&mix](const std::vector<std::string>& texts){
+				mix(texts.size());
+				for (const auto& str : texts) mix(hash_chars(str.data(), str.size()));
+			};
+			mix_text(prog.words);
+			mix_text(prog.strings);
+			mix_text(prog.symbols);
+			mix(prog.numbers.size());
+			mix(prog.integers.size());
+			mix(prog.closures.size());
+			mix(prog.branches.size());
+			mix(prog.groups.size());
+			for (const auto& group : prog.groups){
+				mix(group.size());
+				for (const auto& line : group) mix(line.size());
+			}
+			return h;
+		}
+
+		template<typename T>
+		void put(std::string& out, const T& val){
+			out.append(reinterpret_cast<const char*>(&val), sizeof val);
+		}
+
+		void put(std::string& out, Value val){
+			put(out, (int)val.type);
+			long long payload;
+			if (val.type == ValType::Number) std::memcpy(&payload, &val.number, sizeof payload);
+			else if (val.type == ValType::Integer) payload = val.integer;
+			else payload = val.index;
+			put(out, payload);
+		}
+
+		void put(std::string& out, const std::vector<Value>& vals){
+			put(out, (unsigned long long)vals.size());
+			for (auto val : vals) put(out, val);
+		}
+
+		void put_object(std::string& out, const String& str, const Program&){
+			put(out, (unsigned long long)str.length);
+			out.append(str.data(), str.length);
+			put(out, (char)str.interned);
+		}
+
+		void put_object(std::string& out, const UserClosure& clos, const Program&){
+			put(out, clos.bound);
+			put(out, (unsigned long long)clos.info.bindings.size());
+			for (const auto& tok : clos.info.bindings) put(out, tok);
+			put(out, clos.info.group_idx);
+			put(out, (char)clos.info.has_return);
+			put(out, clos.thisBindings[0]);
+			put(out, clos.thisBindings[1]);
+			put(out, clos.envScope);
+			put(out, (int)clos.thisKind);
+		}
+
+		void put_object(std::string& out, const BuiltinClosure& clos, const Program&){
+			put(out, clos.builtin);
+			put(out, clos.bound);
+			put(out, clos.thisBindings[0]);
+			put(out, clos.thisBindings[1]);
+			put(out, clos.argc);
+			put(out, (int)clos.thisKind);
+		}
+
+		void put_object(std::string& out, Table& table, const Program&){
+			put(out, (unsigned long long)table.size());
+			for (const auto& entry : table){
+				put(out, entry.first);
+				put(out, entry.second);
+			}
+		}
+
+		// a frame's position is an iterator into the program, saved as its offset in the line
+		void put_object(std::string& out, const Continuation& cont, const Program& prog){
+			put(out, (unsigned long long)cont.stack.size());
+			for (const auto& frame : cont.stack){
+				put(out, frame.reg[0]);
+				put(out, frame.reg[1]);
+				put(out, frame.scope);
+				put(out, (int)frame.state);
+				put(out, frame.group);
+				put(out, frame.line);
+				int offset = -1;
+				if (frame.group >= 0 && frame.group < (int)prog.groups.size()
+					&& frame.line >= 0 && frame.line < (int)prog.groups[frame.group].size()){
+					const Line& line = prog.groups[frame.group][frame.line];
+					offset = 0;
+					for (auto it = line.begin(); it != line.end() && it != Line::const_iterator(frame.pos); ++it) ++offset;
+				}
+				put(out, offset);
+			}
+			put(out, cont.position);
+		}
+
+		template<typename T, ValType V>
+		void put_pool(std::string& out, MemPool<T, V>& pool, const Program& prog){
+			put(out, (unsigned long long)pool.stats().live);
+			pool.each([&](Value val){
+				put(out, val.index);
+				put(out, pool.refcount(val.index));
+				put(out, pool.site(val.index));
+				put_object(out, pool[val.index], prog);
+			});
+		}
+
+		// reads an image in place, failing on anything past its end
+		struct ImageReader{
+			const char* pos;
+			const char* end;
+
+			template<typename T>
+			bool get(T& val){
+				if ((size_t)(end - pos) < sizeof val) return false;
+				std::memcpy(&val, pos, sizeof val);
+				pos += sizeof val;
+				return true;
+			}
+
+			bool get(Value& val){
+				int type;
+				long long payload;
+				if (!get(type) || !get(payload) || type < 0 || type >= ValTypeCount) return false;
+				val.type = (ValType)type;
+				if (val.type == ValType::Number) std::memcpy(&val.number, &payload, sizeof payload);
+				else if (val.type == ValType::Integer) val.integer = payload;
+				else if (payload < INT_MIN || payload > INT_MAX) return false;
+				else val.index = (int)payload;
+				return true;
+			}
+
+			// a count of items of at least min_size bytes each, which must fit in what is left
+			bool count(size_t& n, size_t min_size){
+				unsigned long long c;
+				if (!get(c) || c > (unsigned long long)(end - pos) / min_size) return false;
+				n = (size_t)c;
+				return true;
+			}
+
+			bool get(std::vector<Value>& vals){
+				size_t n;
+				if (!count(n, ValueBytes)) return false;
+				vals.resize(n);
+				for (auto& val : vals)
+					if (!get(val)) return false;
+				return true;
+			}
+		};
+
+		bool get_object(ImageReader& in, String& str, const Program&){
+			size_t len;
+			char interned;
+			if (!in.count(len, 1)) return false;
+			str.buffer = std::make_shared<std::string>(in.pos, len);
+			in.pos += len;
+			str.offset = 0;
+			str.length = len;
+			if (!in.get(interned)) return false;
+			// the hash is not saved, as a file could hold one that does not match
+			str.hash = 0;
+			str.interned = interned != 0;
+			return true;
+		}
+
+		bool get_object(ImageReader& in, UserClosure& clos, const Program& prog){
+			size_t n;
+			char has_return;
+			int kind;
+			if (!in.get(clos.bound) || !in.count(n, sizeof(Token))) return false;
+			clos.info.bindings.resize(n);
+			for (auto& tok : clos.info.bindings)
+				if (!in.get(tok)) return false;
+			if (!in.get(clos.info.group_idx) || !in.get(has_return) || !in.get(clos.thisBindings[0])
+				|| !in.get(clos.thisBindings[1]) || !in.get(clos.envScope) || !in.get(kind))
+				return false;
+			clos.info.has_return = has_return != 0;
+			clos.thisKind = (ClosureThis)kind;
+			return clos.info.group_idx >= 0 && clos.info.group_idx < (int)prog.groups.size();
+		}
+
+		bool get_object(ImageReader& in, BuiltinClosure& clos, const Program&){
+			int kind;
+			if (!in.get(clos.builtin) || !in.get(clos.bound) || !in.get(clos.thisBindings[0])
+				|| !in.get(clos.thisBindings[1]) || !in.get(clos.argc) || !in.get(kind))
+				return false;
+			clos.thisKind = (ClosureThis)kind;
+			return clos.builtin >= 0 && clos.builtin < Kw::Count;
+		}
+
+		bool get_object(ImageReader& in, Table& table, const Program&){
+			size_t n;
+			if (!in.count(n, 2 * ValueBytes)) return false;
+			table.reserve(n);
+			for (size_t i = 0; i < n; ++i){
+				Value key, val;
+				if (!in.get(key) || !in.get(val)) return false;
+				if (!table.insert(key, val)) return false;
+			}
+			return true;
+		}
+
+		bool get_object(ImageReader& in, Continuation& cont, const Program& prog){
+			size_t n;
+			if (!in.count(n, 3 * ValueBytes + 4 * sizeof(int))) return false;
+			cont.stack.resize(n);
+			for (auto& frame : cont.stack){
+				int state, offset;
+				if (!in.get(frame.reg[0]) || !in.get(frame.reg[1]) || !in.get(frame.scope) || !in.get(state)
+					|| !in.get(frame.group) || !in.get(frame.line) || !in.get(offset))
+					return false;
+				frame.state = (RegState)state;
+				if (offset < 0) continue;
+				if (frame.group < 0 || frame.group >= (int)prog.groups.size()
+					|| frame.line < 0 || frame.line >= (int)prog.groups[frame.group].size())
+					return false;
+				// frames point into the program like those of a running stack, which never modifies it
+				Line& line = const_cast<Line&>(prog.groups[frame.group][frame.line]);
+				if ((size_t)offset > line.size()) return false;
+				frame.pos = std::next(line.begin(), offset);
+			}
+			return in.get(cont.position);
+		}
+
+		template<typename T, ValType V>
+		bool get_pool(ImageReader& in, MemPool<T, V>& pool, const Program& prog, size_t sites){
+			size_t n;
+			if (!in.count(n, 3 * sizeof(int))) return false;
+			for (size_t i = 0; i < n; ++i){
+				int index, count, site;
+				if (!in.get(index) || !in.get(count) || !in.get(site) || count < 0 || site < 0)
+					return false;
+				if (site != 0 && (size_t)site >= sites) return false;
+				T* item = pool.place(index, count, site);
+				if (item == nullptr || !get_object(in, *item, prog)) return false;
+			}
+			pool.relink();
+			return true;
+		}
+	}
+
+	bool MemoryManager::save_image(const char* path, const Program& prog, const std::vector<Value>& roots){
+		release_pending();
+		if (!zct.empty())
+			throw InternalError{ "Internal Error: attempted to save image with a nonempty zero count table" };
+		if (!literals.empty() && literal_prog != prog.id.value)
+			throw InternalError{ "Internal Error: attempted to save image with literals of another program" };
+
+		std::string out;
+		out.append(ImageMagic, sizeof ImageMagic);
+		put(out, ImageVersion);
+		put(out, ByteOrder);
+		put(out, fingerprint(prog));
+		put(out, (char)(constant_pool != nullptr));
+		put(out, roots);
+		put(out, literals);
+		// suspects freed since they were recorded are left behind
+		std::vector<Value> live_suspects;
+		for (auto val : suspects)
+			if (refcount(val) >= 0) live_suspects.push_back(val);
+		put(out, live_suspects);
+		put(out, (unsigned long long)sites.size());
+		for (const auto& site : sites){
+			put(out, site.line);
+			put(out, site.column);
+		}
+		put_pool(out, strings, prog);
+		put_pool(out, userClosures, prog);
+		put_pool(out, builtinClosures, prog);
+		put_pool(out, tables, prog);
+		put_pool(out, continuations, prog);
+
+		std::ofstream file{ path, std::ios::binary };
+		file.write(out.data(), out.size());
+		file.close();
+		return !file.fail();
+	}
+
+	bool MemoryManager::load_image(const char* path, const Program& prog, std::vector<Value>& roots){
+		MemorySnapshot snap = snapshot();
+		for (int t = (int)ValType::String; t < ValTypeCount; ++t){
+			if (snap.pools[t].live != 0)
+				throw InternalError{ "Internal Error: attempted to load image into a memory manager holding objects" };
+		}
+		if (!interned.empty() || !literals.empty())
+			throw InternalError{ "Internal Error: attempted to load image into a memory manager holding strings" };
+		roots.clear();
+		size_t bytes;
+		const char* data = map_file(path, bytes);
+		if (data == nullptr) return false;
+		// releases spare pages, so every page comes from the image
+		clear_heap();
+		bool ok = read_image(data, bytes, prog, roots);
+		unmap_file(data, bytes);
+		if (!ok){
+			clear_heap();
+			roots.clear();
+		}
+		return ok;
+	}
+
+	bool MemoryManager::read_image(const char* data, size_t bytes, const Program& prog, std::vector<Value>& roots){
+		ImageReader in{ data, data + bytes };
+		unsigned version, order;
+		unsigned long long print;
+		char has_constants;
+		if (bytes < sizeof ImageMagic || std::memcmp(data, ImageMagic, sizeof ImageMagic) != 0) return false;
+		in.pos += sizeof ImageMagic;
+		if (!in.get(version) || version != ImageVersion || !in.get(order) || order != ByteOrder
+			|| !in.get(print) || print != fingerprint(prog) || !in.get(has_constants))
+			return false;
+		if ((has_constants != 0) != (constant_pool != nullptr)) return false;
+		if (constant_pool && !constant_pool->serves(prog)) return false;
+
+		size_t site_count;
+		if (!in.get(roots) || !in.get(literals) || !in.get(suspects) || !in.count(site_count, 2 * sizeof(int)))
+			return false;
+		if (!literals.empty()){
+			if (literals.size() > prog.strings.size()) return false;
+			literal_prog = prog.id.value;
+		}
+		sites.resize(site_count);
+		for (size_t i = 0; i < site_count; ++i){
+			if (!in.get(sites[i].line) || !in.get(sites[i].column)) return false;
+			if (i != 0) site_ids.emplace((long long)((unsigned long long)(unsigned)sites[i].line << 32 | (unsigned)sites[i].column), (int)i);
+		}
+		if (!get_pool(in, strings, prog, site_count) || !get_pool(in, userClosures, prog, site_count)
+			|| !get_pool(in, builtinClosures, prog, site_count) || !get_pool(in, tables, prog, site_count)
+			|| !get_pool(in, continuations, prog, site_count) || in.pos != in.end)
+			return false;
+
+		// every reference must be to a live object or a constant, or a damaged
+		// image would only fail when the reference is followed
+		bool valid = true;
+		auto check = [&](Value val){
+			if (val.type < ValType::String) return;
+			if (is_constant(val))
+				valid = valid && val.type == ValType::String && constant_pool && (size_t)~val.index < constant_pool->size();
+			else valid = valid && refcount(val) >= 0;
+		};
+		for (auto val : roots) check(val);
+		for (auto val : literals) check(val);
+		for (auto val : suspects) check(val);
+		auto check_refs = [&](Value val){ each_ref(val, check); };
+		userClosures.each(check_refs);
+		builtinClosures.each(check_refs);
+		tables.each(check_refs);
+		continuations.each(check_refs);
+		if (!valid) return false;
+
+		// the flags of buffered suspects are not saved, so mark each suspect again once
+		std::vector<Value> saved;
+		saved.swap(suspects);
+		for (auto val : saved)
+			if (!is_constant(val) && !set_buffered(val, true)) suspects.push_back(val);
+		strings.each([&](Value val){
+			String& s = strings[val.index];
+			if (!s.interned) return;
+			s.hash = hash_chars(s.data(), s.length);
+			interned.insert(std::make_pair(s.hash, val.index));
+		});
+		return true;
+	}
+
+	// drops every object without releasing references, since all of them go
+	void MemoryManager::clear_heap(){
+		strings.clear();
+		userClosures.clear();
+		builtinClosures.clear();
+		tables.clear();
+		continuations.clear();
+		interned.clear();
+		literals.clear();
+		literal_prog = 0;
+		suspects.clear();
+		cycle_retry = 0;
+		sites.clear();
+		site_ids.clear();
+	}
+
+}
@@ -0,0 +1,172 @@
+// instrument.cpp
+
+#include <chrono>
+#include "instrument.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace emily{
+
+	namespace{
+		FrontEndStats stats{};
+
+		const char* const phase_names[PhaseCount] = { "tokenize", "do_macros", "elide_groups", "lower_control_flow" };
+
+		long long wall_now(){
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// cpu time used by the calling thread
+		long long cpu_now(){
+#ifdef _WIN32
+			FILETIME created, exited, kernel, user;
+			GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user);
+			ULARGE_INTEGER k, u;
+			k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+			u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+			return (long long)(k.QuadPart + u.QuadPart) * 100;
+#else
+			timespec ts;
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+			return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+		}
+
+		// hardware counters of this process, opened on first use
+		// reading gives -1 where the counter is unavailable
+		class Counters{
+			int cycles_fd;
+			int misses_fd;
+
+		public:
+			Counters() : cycles_fd{ -1 }, misses_fd{ -1 }{
+#ifdef __linux__
+				cycles_fd = open(PERF_COUNT_HW_CPU_CYCLES);
+				misses_fd = open(PERF_COUNT_HW_CACHE_MISSES);
+#endif
+			}
+
+			~Counters(){
+#ifdef __linux__
+				if (cycles_fd >= 0) close(cycles_fd);
+				if (misses_fd >= 0) close(misses_fd);
+#endif
+			}
+
+			long long cycles() const{ return read(cycles_fd); }
+			long long cache_misses() const{ return read(misses_fd); }
+
+		private:
+#ifdef __linux__
+			static int open(unsigned long long config){
+				perf_event_attr attr;
+				std::memset(&attr, 0, sizeof attr);
+				attr.size = sizeof attr;
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = config;
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				// fails if the kernel does not allow it, and the counter is reported as unavailable
+				return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+			}
+#endif
+
+			static long long read(int fd){
+#ifdef __linux__
+				long long value;
+				if (fd >= 0 && ::read(fd, &value, sizeof value) == sizeof value) return value;
+#endif
+				(void)fd;
+				return -1;
+			}
+		};
+
+		Counters& counters(){
+			static Counters c;
+			return c;
+		}
+
+		size_t count_tokens(const Program& prog){
+			size_t n = 0;
+			for (const auto& group : prog.groups)
+				for (const auto& line : group) n += line.size();
+			return n;
+		}
+
+		// adds the counter change since start, or marks it unavailable
+		void add_counter(long long& total, long long start, long long end){
+			if (start < 0 || end < 0 || total < 0) total = -1;
+			else total += end - start;
+		}
+	}
+
+	FrontEndStats& front_end_stats(){
+		return stats;
+	}
+
+	void reset_front_end_stats(){
+		stats = FrontEndStats{};
+	}
+
+	PhaseTimer::PhaseTimer(Phase phase, const Program& prog)
+		: phase{ phase }, prog(prog),
+		groups_before{ prog.groups.size() }, closures_before{ prog.closures.size() }{
+		Counters& hw = counters();
+		cycles_start = hw.cycles();
+		misses_start = hw.cache_misses();
+		cpu_start = cpu_now();
+		wall_start = wall_now();
+	}
+
+	PhaseTimer::~PhaseTimer(){
+		long long wall_end = wall_now();
+		long long cpu_end = cpu_now();
+		Counters& hw = counters();
+		long long cycles_end = hw.cycles();
+		long long misses_end = hw.cache_misses();
+
+		PhaseStats& st = stats.phases[(int)phase];
+		++st.runs;
+		st.wall_ns += wall_end - wall_start;
+		st.cpu_ns += cpu_end - cpu_start;
+		add_counter(st.cycles, cycles_start, cycles_end);
+		add_counter(st.cache_misses, misses_start, misses_end);
+		st.tokens = count_tokens(prog);
+		// a phase that failed may have returned an empty program
+		if (prog.groups.size() > groups_before) st.groups += prog.groups.size() - groups_before;
+		if (prog.closures.size() > closures_before) st.closures += prog.closures.size() - closures_before;
+	}
+
+	void write_json(std::ostream& os, const FrontEndStats& st){
+		os << "{\"phases\":{";
+		for (int p = 0; p < PhaseCount; ++p){
+			const PhaseStats& ph = st.phases[p];
+			os << (p ? "," : "") << '"' << phase_names[p] << "\":{"
+				<< "\"runs\":" << ph.runs
+				<< ",\"wall_ns\":" << ph.wall_ns
+				<< ",\"cpu_ns\":" << ph.cpu_ns
+				<< ",\"cycles\":" << ph.cycles
+				<< ",\"cache_misses\":" << ph.cache_misses
+				<< ",\"tokens\":" << ph.tokens
+				<< ",\"groups\":" << ph.groups
+				<< ",\"closures\":" << ph.closures << '}';
+		}
+		os << "},\"transforms\":{";
+		for (int t = 0; t < TransformCount; ++t)
+			os << (t ? "," : "") << '"' << transform_name(t) << "\":" << st.transforms[t];
+		os << "},\"intern\":{\"calls\":" << st.intern_calls << ",\"misses\":" << st.intern_misses
+			<< "},\"sym\":{\"calls\":" << st.sym_calls << ",\"misses\":" << st.sym_misses << "},\"branches\":" << st.branches << "}\n";
+	}
+
+}
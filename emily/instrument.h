@@ -0,0 +1,88 @@
+// instrument.h
+
+#ifndef __INSTRUMENT_H__
+#define __INSTRUMENT_H__
+
+#include <ostream>
+#include "macro.h"
+
+namespace emily{
+
+	// phases of the compile pipeline
+	enum class Phase{
+		Tokenize,
+		DoMacros,
+		ElideGroups,
+		LowerControlFlow
+	};
+	const int PhaseCount = 4;
+
+	// measurements of one phase, summed over every time it ran
+	struct PhaseStats{
+		size_t runs;
+		long long wall_ns;
+		long long cpu_ns;		// cpu time of the calling thread
+		long long cycles;		// hardware counters, -1 if unavailable
+		long long cache_misses;
+		size_t tokens;			// tokens in the program when the phase finished
+		size_t groups;			// groups created by the phase
+		size_t closures;		// closures created by the phase
+	};
+
+	/**	Front end statistics
+	 *	filled in by tokenize, do_macros, elide_groups, lower_control_flow and the interning
+	 *	functions of Program when the interpreter is built with EMILY_INSTRUMENT;
+	 *	otherwise the instrumentation is compiled out and these stay zero
+	 *	hardware counters are read through perf_event on Linux, when permitted
+	 *	the front end runs on one thread, so the counters are not synchronized
+	 */
+	struct FrontEndStats{
+		PhaseStats phases[PhaseCount];
+		size_t transforms[TransformCount];	// times each transform was applied
+		size_t intern_calls;
+		size_t intern_misses;	// calls that added a new word
+		size_t sym_calls;
+		size_t sym_misses;		// calls that added a new symbol
+		size_t branches;		// lines lowered to branch tokens
+	};
+
+	// statistics since the last reset
+	FrontEndStats& front_end_stats();
+	void reset_front_end_stats();
+
+	// writes front end statistics as a single line of JSON
+	void write_json(std::ostream& os, const FrontEndStats& stats);
+
+	/**	Phase timer
+	 *	measures one run of a phase of prog from construction to destruction
+	 *	the program's tokens, groups and closures are counted after the clocks stop
+	 */
+	class PhaseTimer{
+		Phase phase;
+		const Program& prog;
+		size_t groups_before;
+		size_t closures_before;
+		long long wall_start;
+		long long cpu_start;
+		long long cycles_start;
+		long long misses_start;
+
+	public:
+		PhaseTimer(Phase phase, const Program& prog);
+		~PhaseTimer();
+
+		PhaseTimer(const PhaseTimer&) = delete;
+		PhaseTimer& operator=(const PhaseTimer&) = delete;
+	};
+
+#ifdef EMILY_INSTRUMENT
+#define EMILY_PHASE(phase, prog) ::emily::PhaseTimer emily_phase_timer_{ ::emily::Phase::phase, prog }
+#define EMILY_COUNT(counter) (++::emily::front_end_stats().counter)
+#else
+#define EMILY_PHASE(phase, prog) ((void)0)
+#define EMILY_COUNT(counter) ((void)0)
+#endif
+
+}
+
+#endif
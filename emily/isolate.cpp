@@ -0,0 +1,200 @@
+// isolate.cpp
+
+#include "isolate.h"
+
+namespace emily{
+
+	Clone::Clone() : root{ ValType::Null }{}
+
+	Clone Clone::capture(MemoryManager& mm, Value val){
+		Clone clone;
+		// number each reachable object by its position among objects of its type
+		std::unordered_map<Value, int> ids;
+		std::vector<Value> order;
+		int next[ValTypeCount] = {};
+		auto visit = [&](Value v){
+			if (v.type < ValType::String) return;
+			if (ids.insert(std::make_pair(v, next[(int)v.type])).second){
+				++next[(int)v.type];
+				order.push_back(v);
+			}
+		};
+		visit(val);
+		for (size_t i = 0; i < order.size(); ++i)
+			mm.each_ref(order[i], visit);
+
+		auto remap = [&](Value v){
+			return v.type < ValType::String ? v : make_value(v.type, ids[v]);
+		};
+		clone.root = remap(val);
+		for (auto v : order){
+			switch (v.type){
+			case ValType::String:{
+				const String& str = mm.string(v);
+				clone.strings.push_back(str.str());
+				clone.interned.push_back(str.interned);
+				break;
+			}
+			case ValType::UserClosure:{
+				UserClosure clos = mm.get<UserClosure>(v);
+				map_refs(clos, remap);
+				clone.userClosures.push_back(clos);
+				break;
+			}
+			case ValType::BuiltinClosure:{
+				BuiltinClosure clos = mm.get<BuiltinClosure>(v);
+				map_refs(clos, remap);
+				clone.builtinClosures.push_back(clos);
+				break;
+			}
+			case ValType::Table:{
+				std::vector<TableEntry> entries;
+				for (const auto& entry : mm.get<Table>(v))
+					entries.push_back(TableEntry{ remap(entry.first), remap(entry.second) });
+				clone.tables.push_back(std::move(entries));
+				break;
+			}
+			case ValType::Continuation:{
+				Continuation cont = mm.get<Continuation>(v);
+				map_refs(cont, remap);
+				clone.continuations.push_back(cont);
+				break;
+			}
+			default: break;
+			}
+		}
+		return clone;
+	}
+
+	Value Clone::restore(MemoryManager& mm) const{
+		// create every object first, so references between them can be filled in
+		std::vector<Value> made[ValTypeCount];
+		for (size_t i = 0; i < strings.size(); ++i)
+			made[(int)ValType::String].push_back(interned[i] ? mm.intern(strings[i]) : mm.create_string(strings[i]));
+		for (size_t i = 0; i < userClosures.size(); ++i)
+			made[(int)ValType::UserClosure].push_back(mm.create(ValType::UserClosure));
+		for (size_t i = 0; i < builtinClosures.size(); ++i)
+			made[(int)ValType::BuiltinClosure].push_back(mm.create(ValType::BuiltinClosure));
+		for (size_t i = 0; i < tables.size(); ++i)
+			made[(int)ValType::Table].push_back(mm.create(ValType::Table));
+		for (size_t i = 0; i < continuations.size(); ++i)
+			made[(int)ValType::Continuation].push_back(mm.create(ValType::Continuation));
+
+		// each reference stored in an object is counted
+		auto remap = [&](Value v){
+			return v.type < ValType::String ? v : mm.ref(made[(int)v.type][v.index]);
+		};
+		for (size_t i = 0; i < userClosures.size(); ++i){
+			UserClosure& clos = mm.get<UserClosure>(made[(int)ValType::UserClosure][i]);
+			clos = userClosures[i];
+			map_refs(clos, remap);
+		}
+		for (size_t i = 0; i < builtinClosures.size(); ++i){
+			BuiltinClosure& clos = mm.get<BuiltinClosure>(made[(int)ValType::BuiltinClosure][i]);
+			clos = builtinClosures[i];
+			map_refs(clos, remap);
+		}
+		for (size_t i = 0; i < tables.size(); ++i){
+			Table& table = mm.get<Table>(made[(int)ValType::Table][i]);
+			table.reserve(tables[i].size());
+			for (const auto& entry : tables[i])
+				table.insert(remap(entry.first), remap(entry.second));
+		}
+		for (size_t i = 0; i < continuations.size(); ++i){
+			Continuation& cont = mm.get<Continuation>(made[(int)ValType::Continuation][i]);
+			cont = continuations[i];
+			map_refs(cont, remap);
+		}
+
+		Value result = root.type < ValType::String ? root : made[(int)root.type][root.index];
+		// drop the references held since creation, except the root's, which goes to the caller
+		// with deferred counting, creation held no reference
+		if (!mm.deferred()){
+			for (int t = (int)ValType::String; t < ValTypeCount; ++t){
+				for (auto v : made[t])
+					if (!(v == result)) mm.deref(v);
+			}
+		}
+		return result;
+	}
+
+	MessageChannel::MessageChannel() : closed{ false }{}
+
+	void MessageChannel::send(Clone msg){
+		{
+			std::lock_guard<std::mutex> guard{ lock };
+			queue.push_back(std::move(msg));
+		}
+		ready.notify_one();
+	}
+
+	bool MessageChannel::receive(Clone& msg){
+		std::unique_lock<std::mutex> guard{ lock };
+		ready.wait(guard, [this]{ return !queue.empty() || closed; });
+		if (queue.empty()) return false;
+		msg = std::move(queue.front());
+		queue.pop_front();
+		return true;
+	}
+
+	bool MessageChannel::try_receive(Clone& msg){
+		std::lock_guard<std::mutex> guard{ lock };
+		if (queue.empty()) return false;
+		msg = std::move(queue.front());
+		queue.pop_front();
+		return true;
+	}
+
+	void MessageChannel::close(){
+		{
+			std::lock_guard<std::mutex> guard{ lock };
+			closed = true;
+		}
+		ready.notify_all();
+	}
+
+	Isolate::Isolate(std::shared_ptr<const Program> prog, Entry entry, std::shared_ptr<const ConstantPool> constants)
+		: prog{ prog }, entry{ entry }{
+		if (constants){
+			if (!constants->serves(*prog))
+				throw InternalError{ "Internal Error: attempted to start isolate with constants of another program" };
+			mm.set_constants(std::move(constants));
+		}
+	}
+
+	Isolate::~Isolate(){
+		join();
+	}
+
+	void Isolate::start(){
+		thread = std::thread{ [this]{ entry(*this); } };
+	}
+
+	void Isolate::join(){
+		if (thread.joinable()) thread.join();
+	}
+
+	const Program& Isolate::program() const{
+		return *prog;
+	}
+
+	MemoryManager& Isolate::memory(){
+		return mm;
+	}
+
+	ExecStack& Isolate::stack(){
+		return exec;
+	}
+
+	void Isolate::send(MessageChannel& ch, Value val){
+		ch.send(Clone::capture(mm, val));
+	}
+
+	bool Isolate::receive(MessageChannel& ch, Value& val){
+		Clone msg;
+		if (!ch.receive(msg)) return false;
+		val = msg.restore(mm);
+		return true;
+	}
+
+}
@@ -0,0 +1,105 @@
+// isolate.h
+
+#ifndef __ISOLATE_H__
+#define __ISOLATE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "memory.h"
+
+namespace emily{
+
+	/**	Structured clone
+	 *	a copy of the graph of objects reachable from a value, independent of any
+	 *	memory manager, so it can be moved to another isolate and recreated there
+	 *	values inside the clone refer to other cloned objects of the same type by
+	 *	their position in the clone
+	 *	closures and continuations keep pointing into the shared program
+	 */
+	class Clone{
+	public:
+		Clone();
+		// copies the graph reachable from val out of mm
+		static Clone capture(MemoryManager& mm, Value val);
+		// recreates the graph in mm, returning a new reference to the copy of the root
+		Value restore(MemoryManager& mm) const;
+
+	private:
+		Value root;
+		std::vector<std::string> strings;
+		std::vector<bool> interned;
+		std::vector<UserClosure> userClosures;
+		std::vector<BuiltinClosure> builtinClosures;
+		std::vector<std::vector<TableEntry>> tables;
+		std::vector<Continuation> continuations;
+	};
+
+	/**	Message channel
+	 *	thread safe queue of clones for passing values between isolates
+	 */
+	class MessageChannel{
+		std::mutex lock;
+		std::condition_variable ready;
+		std::deque<Clone> queue;
+		bool closed;
+
+	public:
+		MessageChannel();
+		void send(Clone msg);
+		// waits for a message, returns false once the channel is closed and empty
+		bool receive(Clone& msg);
+		// returns false immediately if there is no message
+		bool try_receive(Clone& msg);
+		// wakes every receiver; messages already sent can still be received
+		void close();
+	};
+
+	/**	Isolate class
+	 *	an interpreter instance running on its own thread, with its own memory
+	 *	manager and execution stack
+	 *	isolates share one expanded program, which none of them may modify,
+	 *	and exchange values only by cloning them through message channels
+	 *	isolates given the same constant pool share its literals instead of
+	 *	each making their own copies
+	 */
+	class Isolate{
+	public:
+		typedef std::function<void(Isolate&)> Entry;
+
+		// constants, if given, must be the constants of prog
+		Isolate(std::shared_ptr<const Program> prog, Entry entry, std::shared_ptr<const ConstantPool> constants = nullptr);
+		// joins the thread if it is still running
+		~Isolate();
+
+		// runs entry on a new thread
+		void start();
+		void join();
+
+		const Program& program() const;
+		MemoryManager& memory();
+		ExecStack& stack();
+
+		// clones val into ch
+		void send(MessageChannel& ch, Value val);
+		// receives a clone from ch into this isolate's memory
+		// returns false once the channel is closed and empty
+		bool receive(MessageChannel& ch, Value& val);
+
+	private:
+		std::shared_ptr<const Program> prog;
+		MemoryManager mm;
+		ExecStack exec;
+		Entry entry;
+		std::thread thread;
+
+		Isolate(const Isolate&);
+		Isolate& operator=(const Isolate&);
+	};
+
+}
+
+#endif
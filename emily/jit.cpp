@@ -0,0 +1,696 @@
+// jit.cpp
+// baseline JIT: each operation of a closure body becomes a fixed template of
+// x86-64 code that works on stack slots, with guards that bail out to the interpreter
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "jit.h"
+
+namespace emily{
+
+	namespace{
+		// registers, numbered as in instruction encodings
+		enum Reg{ RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+		// condition codes, added to the opcodes of jcc and setcc
+		enum Cond{
+			CondO = 0x0, CondAE = 0x3, CondE = 0x4, CondNE = 0x5, CondA = 0x7, CondNP = 0xB,
+			CondL = 0xC, CondGE = 0xD, CondLE = 0xE, CondG = 0xF, Always = -1
+		};
+
+		// compiled code keeps its arguments in callee saved registers, so calls keep them
+		const Reg Memory = R13;
+		const Reg Args = RBX;
+		const Reg Out = R12;
+
+		const int ValueSize = sizeof(Value);
+		const int PayloadOffset = offsetof(Value, number);
+		// slots past this many make a closure too big for a baseline compile
+		const int MaxSlots = 4096;
+		// a compiled closure is given up on once it has bailed out this often, and more often than not
+		const size_t BailLimit = 64;
+
+		class Assembler{
+		public:
+			std::vector<unsigned char> code;
+
+			void byte(int b){ code.push_back((unsigned char)b); }
+
+			void imm32(int v){
+				for (int i = 0; i < 4; ++i) byte((unsigned)v >> (8 * i));
+			}
+
+			void imm64(long long v){
+				for (int i = 0; i < 8; ++i) byte((unsigned long long)v >> (8 * i));
+			}
+
+			// op reg, [base + disp32], with an optional mandatory prefix before the REX prefix
+			void op_mem(int prefix, bool wide, std::initializer_list<int> opcode, int reg, int base, int disp){
+				if (prefix) byte(prefix);
+				rex(wide, reg, base);
+				for (int b : opcode) byte(b);
+				byte(0x80 | (reg & 7) << 3 | (base & 7));
+				// rsp and r12 as a base need a SIB byte
+				if ((base & 7) == RSP) byte(0x24);
+				imm32(disp);
+			}
+
+			// op reg, rm, both registers
+			void op_reg(int prefix, bool wide, std::initializer_list<int> opcode, int reg, int rm){
+				if (prefix) byte(prefix);
+				rex(wide, reg, rm);
+				for (int b : opcode) byte(b);
+				byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+			}
+
+			void load(Reg r, Reg base, int disp){ op_mem(0, true, { 0x8B }, r, base, disp); }
+			void store(Reg base, int disp, Reg r){ op_mem(0, true, { 0x89 }, r, base, disp); }
+			void move(Reg dst, Reg src){ op_reg(0, true, { 0x89 }, src, dst); }
+			void lea(Reg r, Reg base, int disp){ op_mem(0, true, { 0x8D }, r, base, disp); }
+
+			void move_imm(Reg r, long long v){
+				rex(true, 0, r);
+				byte(0xB8 + (r & 7));
+				imm64(v);
+			}
+
+			// loads a slot into xmm register x, converting it from an integer if needed
+			void load_sd(int x, Reg base, int disp, bool integer){
+				if (integer) op_mem(0xF2, true, { 0x0F, 0x2A }, x, base, disp);
+				else op_mem(0xF2, false, { 0x0F, 0x10 }, x, base, disp);
+			}
+
+			void store_sd(Reg base, int disp, int x){ op_mem(0xF2, false, { 0x0F, 0x11 }, x, base, disp); }
+
+			// sets al to the condition, zero extended to rax
+			void set(int cond){
+				byte(0x0F);
+				byte(0x90 + cond);
+				byte(0xC0);
+				byte(0x0F);
+				byte(0xB6);
+				byte(0xC0);
+			}
+
+			// returns the position of the displacement, for bind
+			size_t jump(int cond){
+				if (cond == Always) byte(0xE9);
+				else{
+					byte(0x0F);
+					byte(0x80 + cond);
+				}
+				imm32(0);
+				return code.size() - 4;
+			}
+
+			// points the jump at to the current position
+			void bind(size_t at){
+				int rel = (int)(code.size() - (at + 4));
+				std::memcpy(&code[at], &rel, 4);
+			}
+
+			// jumps back to target, a position already emitted
+			void jump_back(int cond, size_t target){
+				size_t at = jump(cond);
+				int rel = (int)target - (int)(at + 4);
+				std::memcpy(&code[at], &rel, 4);
+			}
+
+			void call(const void* fn){
+				move_imm(RAX, (long long)fn);
+				byte(0xFF);
+				byte(0xD0);
+			}
+
+		private:
+			void rex(bool wide, int reg, int rm){
+				int prefix = 0x40 | (wide ? 8 : 0) | (reg & 8) >> 1 | (rm & 8) >> 3;
+				if (prefix != 0x40) byte(prefix);
+			}
+		};
+
+		// loads element key of the table at table into out, returning its type,
+		// or -1 if the table has no such key
+		// array-like tables are indexed directly, others through the hash index
+		int load_element(MemoryManager* mm, const Value* table, long long key, int integer, long long* out){
+			Table& t = mm->get<Table>(*table);
+			double num = 0;
+			const TableEntry* found = nullptr;
+			if (integer){
+				if (key >= 0) found = t.array_entry((size_t)key);
+			}
+			else{
+				std::memcpy(&num, &key, sizeof num);
+				if (num >= 0 && num < 9007199254740992.0 && num == std::floor(num)) found = t.array_entry((size_t)num);
+			}
+			if (found == nullptr){
+				auto it = t.find(integer ? make_integer(key) : make_number(num));
+				if (it == t.end()) return -1;
+				found = &*it;
+			}
+			Value val = found->second;
+			if (val.type == ValType::Integer) *out = val.integer;
+			else if (val.type == ValType::Number) std::memcpy(out, &val.number, sizeof *out);
+			return (int)val.type;
+		}
+
+		double call_fmod(double a, double b){
+			return std::fmod(a, b);
+		}
+
+		// what a slot holds, known when the code is compiled
+		enum Kind{ IntKind, NumKind, BoolKind, TableKind };
+
+		// a compiled value: a stack slot, or for a table argument, its position in args
+		struct Operand{
+			Kind kind;
+			int slot;
+			int arg;
+			Kind element;	// kind of a table's elements
+		};
+
+		// compiles one closure in a single pass, choosing each operation's template
+		// from the kinds of its operands; returns false on anything it does not handle
+		class Compiler{
+			const Program& prog;
+			MemoryManager& mm;
+			const ClosureInfo& clos;
+			const Value* args;
+			Assembler as;
+			std::vector<Operand> params;
+			std::vector<size_t> bails;
+			int slots;
+
+		public:
+			Compiler(const Program& prog, MemoryManager& mm, const ClosureInfo& clos, const Value* args)
+				: prog(prog), mm(mm), clos(clos), args(args), slots{ 0 }{}
+
+			bool compile(std::vector<unsigned char>& code){
+				if (clos.has_return) return false;
+				// prologue, leaving rsp 16 byte aligned for calls
+				as.byte(0x55);						// push rbp
+				as.move(RBP, RSP);
+				as.byte(0x53);						// push rbx
+				as.byte(0x41); as.byte(0x54);		// push r12
+				as.byte(0x41); as.byte(0x55);		// push r13
+				as.byte(0x48); as.byte(0x81); as.byte(0xEC);	// sub rsp, frame
+				size_t frame = as.code.size();
+				as.imm32(0);
+				as.move(Memory, RDI);
+				as.move(Args, RSI);
+				as.move(Out, RDX);
+
+				if (!guard_args()) return false;
+				Operand result;
+				if (!group(clos.group_idx, true, result) || !store_result(result)) return false;
+
+				as.byte(0xB8);						// mov eax, 1
+				as.imm32(1);
+				size_t done = as.jump(Always);
+				for (auto at : bails) as.bind(at);
+				as.byte(0x31); as.byte(0xC0);		// xor eax, eax
+				as.bind(done);
+				as.lea(RSP, RBP, -24);
+				as.byte(0x41); as.byte(0x5D);		// pop r13
+				as.byte(0x41); as.byte(0x5C);		// pop r12
+				as.byte(0x5B);						// pop rbx
+				as.byte(0x5D);						// pop rbp
+				as.byte(0xC3);						// ret
+
+				// three pushes leave rsp 8 bytes off alignment
+				int bytes = 8 * slots + (slots % 2 == 0 ? 8 : 0);
+				std::memcpy(&as.code[frame], &bytes, 4);
+				code.swap(as.code);
+				return true;
+			}
+
+		private:
+			int disp(int slot){ return -32 - 8 * slot; }
+
+			bool make(Kind kind, Operand& out){
+				if (slots == MaxSlots) return false;
+				out = Operand{ kind, slots++, -1, kind };
+				return true;
+			}
+
+			void bail(int cond){ bails.push_back(as.jump(cond)); }
+
+			// checks each argument has the type it had at compile time, and copies numbers to slots
+			bool guard_args(){
+				for (size_t i = 0; i < clos.bindings.size(); ++i){
+					Value arg = args[i];
+					int at = (int)i * ValueSize;
+					Operand op;
+					if (arg.type == ValType::Integer || arg.type == ValType::Number){
+						if (!make(arg.type == ValType::Integer ? IntKind : NumKind, op)) return false;
+						as.op_mem(0, false, { 0x81 }, 7, Args, at);	// cmp dword [args + at], type
+						as.imm32((int)arg.type);
+						bail(CondNE);
+						as.load(RAX, Args, at + PayloadOffset);
+						as.store(RBP, disp(op.slot), RAX);
+					}
+					else if (arg.type == ValType::Table){
+						// specialized on the type of the first element
+						Table& t = mm.get<Table>(arg);
+						if (t.empty()) return false;
+						ValType element = t.begin()->second.type;
+						if (element != ValType::Integer && element != ValType::Number) return false;
+						op = Operand{ TableKind, -1, (int)i, element == ValType::Integer ? IntKind : NumKind };
+						as.op_mem(0, false, { 0x81 }, 7, Args, at);
+						as.imm32((int)ValType::Table);
+						bail(CondNE);
+					}
+					else return false;
+					params.push_back(op);
+				}
+				return true;
+			}
+
+			bool store_result(const Operand& res){
+				switch (res.kind){
+				case IntKind:
+				case NumKind:
+					as.op_mem(0, false, { 0xC7 }, 0, Out, 0);	// mov dword [out], type
+					as.imm32((int)(res.kind == IntKind ? ValType::Integer : ValType::Number));
+					as.load(RAX, RBP, disp(res.slot));
+					as.store(Out, PayloadOffset, RAX);
+					return true;
+				case BoolKind:
+					// 1 and 0 are the types True and Null
+					as.load(RAX, RBP, disp(res.slot));
+					as.op_mem(0, false, { 0x89 }, RAX, Out, 0);
+					return true;
+				default:
+					return false;
+				}
+			}
+
+			// the value of the last line of group g; lines before it run for their guards
+			// only closure and branch bodies, which run in place, may be braces
+			bool group(int g, bool body, Operand& out){
+				char kind = prog.group_kinds[g];
+				if (kind != '(' && !(body && kind == '{')) return false;
+				bool any = false;
+				for (const auto& ln : prog.groups[g]){
+					if (ln.empty()) continue;
+					if (!line(ln, out)) return false;
+					any = true;
+				}
+				return any;
+			}
+
+			// tokens apply to the value so far from left to right
+			bool line(const Line& ln, Operand& out){
+				auto tk = ln.begin();
+				Operand cur;
+				if (tk->type == Tok::Word && tk->index == Kw::Not && param(Kw::Not) < 0){
+					Operand operand;
+					if (++tk == ln.end() || !token(*tk++, false, operand) || !logical_not(operand, cur)) return false;
+				}
+				else if (!token(*tk++, false, cur)) return false;
+				// each operation's result goes to a new operand, as its templates read
+				// the operands after choosing the result's slot
+				while (tk != ln.end()){
+					Operand next;
+					if (tk->type == Tok::Atom){
+						int op = operation(tk->index);
+						Operand rhs;
+						if (++tk, op == Kw::Negate){
+							if (!negate(cur, next)) return false;
+						}
+						else if (op < 0 || tk == ln.end() || !token(*tk++, false, rhs) || !binary(op, cur, rhs, next))
+							return false;
+					}
+					else if (cur.kind == TableKind){
+						Operand key;
+						if (!token(*tk++, false, key) || !index(cur, key, next)) return false;
+					}
+					else return false;
+					cur = next;
+				}
+				out = cur;
+				return true;
+			}
+
+			bool token(const Token& tok, bool body, Operand& out){
+				switch (tok.type){
+				case Tok::Integer:
+					if (!make(IntKind, out)) return false;
+					as.move_imm(RAX, prog.integers[tok.index]);
+					as.store(RBP, disp(out.slot), RAX);
+					return true;
+				case Tok::Number:{
+					long long bits;
+					std::memcpy(&bits, &prog.numbers[tok.index], sizeof bits);
+					if (!make(NumKind, out)) return false;
+					as.move_imm(RAX, bits);
+					as.store(RBP, disp(out.slot), RAX);
+					return true;
+				}
+				case Tok::Word:{
+					int p = param(tok.index);
+					if (p < 0) return false;
+					out = params[p];
+					return true;
+				}
+				case Tok::Group: return group(tok.index, body, out);
+				case Tok::Branch: return branch(prog.branches[tok.index], out);
+				default: return false;
+				}
+			}
+
+			// the argument bound to word, or -1; later bindings shadow earlier ones
+			int param(int word){
+				for (int i = (int)clos.bindings.size() - 1; i >= 0; --i)
+					if (clos.bindings[i].index == word) return i;
+				return -1;
+			}
+
+			// the builtin an operator method names, or -1
+			int operation(int word){
+				static const struct{ const char* name; int kw; } ops[] = {
+					{ "plus", Kw::Add }, { "minus", Kw::Minus }, { "times", Kw::Times },
+					{ "divide", Kw::Divide }, { "mod", Kw::Mod }, { "negate", Kw::Negate },
+					{ "lt", Kw::Lt }, { "lte", Kw::Lte }, { "gt", Kw::Gt }, { "gte", Kw::Gte }, { "eq", Kw::Eq }
+				};
+				for (const auto& op : ops)
+					if (prog.word(word) == op.name) return op.kw;
+				return -1;
+			}
+
+			bool numeric(const Operand& op){ return op.kind == IntKind || op.kind == NumKind; }
+
+			// a condition picks the code that runs, and the code it skips never runs
+			// anything but a boolean is true; if and while give null
+			bool branch(const BranchInfo& br, Operand& out){
+				switch (br.op){
+				case Kw::Tern: return tern(br, out);
+				case Kw::If: return branch_if(br, out);
+				case Kw::While: return branch_while(br, out);
+				default: return false;
+				}
+			}
+
+			bool tern(const BranchInfo& br, Operand& out){
+				Operand cond, yes, no;
+				if (!token(br.operands[0], false, cond)) return false;
+				if (cond.kind != BoolKind) return token(br.operands[1], true, out);
+				as.load(RAX, RBP, disp(cond.slot));
+				as.op_reg(0, true, { 0x85 }, RAX, RAX);		// test rax, rax
+				size_t to_no = as.jump(CondE);
+				if (!token(br.operands[1], true, yes) || yes.kind == TableKind || !make(yes.kind, out)) return false;
+				as.load(RAX, RBP, disp(yes.slot));
+				as.store(RBP, disp(out.slot), RAX);
+				size_t to_end = as.jump(Always);
+				as.bind(to_no);
+				if (!token(br.operands[2], true, no) || no.kind != yes.kind) return false;
+				as.load(RAX, RBP, disp(no.slot));
+				as.store(RBP, disp(out.slot), RAX);
+				as.bind(to_end);
+				return true;
+			}
+
+			// a forward jump over the body when the condition is null
+			bool branch_if(const BranchInfo& br, Operand& out){
+				Operand cond, body;
+				if (!token(br.operands[0], false, cond)) return false;
+				size_t skip = 0;
+				if (cond.kind == BoolKind){
+					as.load(RAX, RBP, disp(cond.slot));
+					as.op_reg(0, true, { 0x85 }, RAX, RAX);
+					skip = as.jump(CondE);
+				}
+				if (!token(br.operands[1], true, body)) return false;
+				if (cond.kind == BoolKind) as.bind(skip);
+				return null_result(out);
+			}
+
+			// the condition is tested at the top, and the body jumps back to it
+			// compiled code changes no variables, so a loop that is entered only
+			// ends by bailing out, as the interpreter would only end it with an error
+			bool branch_while(const BranchInfo& br, Operand& out){
+				Operand cond, body;
+				size_t top = as.code.size();
+				if (!token(br.operands[0], true, cond)) return false;
+				size_t done = 0;
+				if (cond.kind == BoolKind){
+					as.load(RAX, RBP, disp(cond.slot));
+					as.op_reg(0, true, { 0x85 }, RAX, RAX);
+					done = as.jump(CondE);
+				}
+				if (!token(br.operands[1], true, body)) return false;
+				as.jump_back(Always, top);
+				if (cond.kind == BoolKind) as.bind(done);
+				return null_result(out);
+			}
+
+			// null is the boolean 0
+			bool null_result(Operand& out){
+				if (!make(BoolKind, out)) return false;
+				as.op_reg(0, false, { 0x31 }, RAX, RAX);		// xor eax, eax
+				as.store(RBP, disp(out.slot), RAX);
+				return true;
+			}
+
+			bool binary(int op, const Operand& l, const Operand& r, Operand& out){
+				switch (op){
+				case Kw::Eq: return equal(l, r, out);
+				case Kw::Lt: case Kw::Lte: case Kw::Gt: case Kw::Gte: return compare(op, l, r, out);
+				default: return arithmetic(op, l, r, out);
+				}
+			}
+
+			// integers stay integers unless they overflow, which bails out, as the
+			// interpreter's result would be a Number; a division is a Number when
+			// it leaves a remainder, and bails out when it does not
+			bool arithmetic(int op, const Operand& l, const Operand& r, Operand& out){
+				if (!numeric(l) || !numeric(r)) return false;
+				if (l.kind == IntKind && r.kind == IntKind && op != Kw::Divide){
+					if (!make(IntKind, out)) return false;
+					as.load(RAX, RBP, disp(l.slot));
+					as.load(RCX, RBP, disp(r.slot));
+					switch (op){
+					case Kw::Add: as.op_reg(0, true, { 0x01 }, RCX, RAX); bail(CondO); break;
+					case Kw::Minus: as.op_reg(0, true, { 0x29 }, RCX, RAX); bail(CondO); break;
+					case Kw::Times: as.op_reg(0, true, { 0x0F, 0xAF }, RAX, RCX); bail(CondO); break;
+					case Kw::Mod:{
+						// a zero divisor gives NaN, a Number
+						as.op_reg(0, true, { 0x85 }, RCX, RCX);
+						bail(CondE);
+						as.op_reg(0, true, { 0x83 }, 7, RCX);	// cmp rcx, -1
+						as.byte(0xFF);
+						size_t minus_one = as.jump(CondE);
+						as.byte(0x48); as.byte(0x99);			// cqo
+						as.op_reg(0, true, { 0xF7 }, 7, RCX);	// idiv rcx
+						as.move(RAX, RDX);
+						size_t done = as.jump(Always);
+						as.bind(minus_one);
+						as.byte(0x31); as.byte(0xC0);
+						as.bind(done);
+						break;
+					}
+					default: return false;
+					}
+					as.store(RBP, disp(out.slot), RAX);
+					return true;
+				}
+				if (!make(NumKind, out)) return false;
+				size_t inexact = 0;
+				bool integers = l.kind == IntKind && r.kind == IntKind;
+				if (integers){
+					as.load(RAX, RBP, disp(l.slot));
+					as.load(RCX, RBP, disp(r.slot));
+					as.op_reg(0, true, { 0x85 }, RCX, RCX);
+					inexact = as.jump(CondE);
+					as.op_reg(0, true, { 0x83 }, 7, RCX);
+					as.byte(0xFF);
+					bail(CondE);
+					as.byte(0x48); as.byte(0x99);
+					as.op_reg(0, true, { 0xF7 }, 7, RCX);
+					as.op_reg(0, true, { 0x85 }, RDX, RDX);
+					bail(CondE);
+					as.bind(inexact);
+				}
+				as.load_sd(0, RBP, disp(l.slot), l.kind == IntKind);
+				as.load_sd(1, RBP, disp(r.slot), r.kind == IntKind);
+				switch (op){
+				case Kw::Add: as.op_reg(0xF2, false, { 0x0F, 0x58 }, 0, 1); break;
+				case Kw::Minus: as.op_reg(0xF2, false, { 0x0F, 0x5C }, 0, 1); break;
+				case Kw::Times: as.op_reg(0xF2, false, { 0x0F, 0x59 }, 0, 1); break;
+				case Kw::Divide: as.op_reg(0xF2, false, { 0x0F, 0x5E }, 0, 1); break;
+				case Kw::Mod: as.call((const void*)&call_fmod); break;
+				default: return false;
+				}
+				as.store_sd(RBP, disp(out.slot), 0);
+				return true;
+			}
+
+			// unordered comparisons are false, as they are in the interpreter
+			bool compare(int op, const Operand& l, const Operand& r, Operand& out){
+				if (!numeric(l) || !numeric(r) || !make(BoolKind, out)) return false;
+				if (l.kind == IntKind && r.kind == IntKind){
+					as.load(RAX, RBP, disp(l.slot));
+					as.op_mem(0, true, { 0x3B }, RAX, RBP, disp(r.slot));	// cmp rax, r
+					as.set(op == Kw::Lt ? CondL : op == Kw::Lte ? CondLE : op == Kw::Gt ? CondG : CondGE);
+				}
+				else{
+					as.load_sd(0, RBP, disp(l.slot), l.kind == IntKind);
+					as.load_sd(1, RBP, disp(r.slot), r.kind == IntKind);
+					// lt and lte compare r with l, so both only hold when ordered
+					if (op == Kw::Lt || op == Kw::Lte) as.op_reg(0x66, false, { 0x0F, 0x2E }, 1, 0);
+					else as.op_reg(0x66, false, { 0x0F, 0x2E }, 0, 1);
+					as.set(op == Kw::Lt || op == Kw::Gt ? CondA : CondAE);
+				}
+				as.store(RBP, disp(out.slot), RAX);
+				return true;
+			}
+
+			// an Integer equals a Number only if the Number is exactly that integer
+			bool equal(const Operand& l, const Operand& r, Operand& out){
+				if (l.kind == TableKind || r.kind == TableKind || !make(BoolKind, out)) return false;
+				if (l.kind == r.kind && l.kind != NumKind){
+					as.load(RAX, RBP, disp(l.slot));
+					as.op_mem(0, true, { 0x3B }, RAX, RBP, disp(r.slot));
+					as.set(CondE);
+				}
+				else if (l.kind == NumKind && r.kind == NumKind){
+					as.load_sd(0, RBP, disp(l.slot), false);
+					as.load_sd(1, RBP, disp(r.slot), false);
+					as.op_reg(0x66, false, { 0x0F, 0x2E }, 0, 1);
+					// equal and ordered
+					as.byte(0x0F); as.byte(0x94); as.byte(0xC0);	// sete al
+					as.byte(0x0F); as.byte(0x9B); as.byte(0xC1);	// setnp cl
+					as.byte(0x20); as.byte(0xC8);					// and al, cl
+					as.byte(0x0F); as.byte(0xB6); as.byte(0xC0);	// movzx eax, al
+				}
+				else if (numeric(l) && numeric(r)){
+					const Operand& i = l.kind == IntKind ? l : r;
+					const Operand& d = l.kind == IntKind ? r : l;
+					as.load_sd(0, RBP, disp(d.slot), false);
+					as.op_reg(0xF2, true, { 0x0F, 0x2C }, RAX, 0);	// cvttsd2si rax, xmm0
+					as.op_reg(0xF2, true, { 0x0F, 0x2A }, 1, RAX);	// cvtsi2sd xmm1, rax
+					as.op_reg(0x66, false, { 0x0F, 0x2E }, 0, 1);
+					as.byte(0x0F); as.byte(0x94); as.byte(0xC1);	// sete cl
+					as.byte(0x0F); as.byte(0x9B); as.byte(0xC2);	// setnp dl
+					as.byte(0x20); as.byte(0xD1);					// and cl, dl
+					as.op_mem(0, true, { 0x3B }, RAX, RBP, disp(i.slot));
+					as.byte(0x0F); as.byte(0x94); as.byte(0xC0);	// sete al
+					as.byte(0x20); as.byte(0xC8);					// and al, cl
+					as.byte(0x0F); as.byte(0xB6); as.byte(0xC0);
+				}
+				// a boolean never equals a number
+				else as.op_reg(0, false, { 0x31 }, RAX, RAX);
+				as.store(RBP, disp(out.slot), RAX);
+				return true;
+			}
+
+			bool negate(const Operand& val, Operand& out){
+				if (!numeric(val) || !make(val.kind, out)) return false;
+				as.load(RAX, RBP, disp(val.slot));
+				// the negation of the smallest integer is a Number
+				if (val.kind == IntKind){
+					as.op_reg(0, true, { 0xF7 }, 3, RAX);	// neg rax
+					bail(CondO);
+				}
+				else{
+					as.op_reg(0, true, { 0x0F, 0xBA }, 7, RAX);	// btc rax, 63
+					as.byte(63);
+				}
+				as.store(RBP, disp(out.slot), RAX);
+				return true;
+			}
+
+			// only null is false, so not of a number or table is false
+			bool logical_not(const Operand& val, Operand& out){
+				if (!make(BoolKind, out)) return false;
+				if (val.kind == BoolKind){
+					as.load(RAX, RBP, disp(val.slot));
+					as.op_reg(0, false, { 0x83 }, 6, RAX);	// xor eax, 1
+					as.byte(1);
+				}
+				else as.op_reg(0, false, { 0x31 }, RAX, RAX);
+				as.store(RBP, disp(out.slot), RAX);
+				return true;
+			}
+
+			bool index(const Operand& table, const Operand& key, Operand& out){
+				if (!numeric(key) || !make(table.element, out)) return false;
+				as.move(RDI, Memory);
+				as.lea(RSI, Args, table.arg * ValueSize);
+				as.load(RDX, RBP, disp(key.slot));
+				as.byte(0xB9);							// mov ecx, imm32
+				as.imm32(key.kind == IntKind);
+				as.lea(R8, RBP, disp(out.slot));
+				as.call((const void*)&load_element);
+				as.byte(0x3D);							// cmp eax, imm32
+				as.imm32((int)(table.element == IntKind ? ValType::Integer : ValType::Number));
+				bail(CondNE);
+				return true;
+			}
+		};
+	}
+
+	Jit::Jit(const Program& prog, MemoryManager& mm, unsigned threshold)
+		: prog(prog), mm(mm), threshold{ threshold }, counters{}{}
+
+	Jit::~Jit(){
+		for (const auto& page : pages) munmap(page.first, page.second);
+	}
+
+	Jit::Entry& Jit::entry(int closure){
+		if ((size_t)closure >= entries.size())
+			entries.resize(prog.closures.size() > (size_t)closure ? prog.closures.size() : closure + 1, Entry{});
+		return entries[closure];
+	}
+
+	bool Jit::call(int closure, const Value* args, Value& result){
+		Entry& e = entry(closure);
+		if (e.code == nullptr){
+			if (e.rejected || ++e.count < threshold) return false;
+			if (compile(closure, args) == nullptr) return false;
+		}
+		if (e.code(&mm, args, &result)){
+			++e.runs;
+			++counters.runs;
+			return true;
+		}
+		++counters.bailouts;
+		if (++e.bailouts >= BailLimit && e.bailouts > e.runs){
+			e.code = nullptr;
+			e.rejected = true;
+			++counters.discarded;
+		}
+		return false;
+	}
+
+	void Jit::loop(int closure){
+		++entry(closure).count;
+	}
+
+	Jit::Code Jit::compile(int closure, const Value* args){
+		Entry& e = entry(closure);
+		std::vector<unsigned char> code;
+		if (!Compiler{ prog, mm, prog.closures[closure], args }.compile(code)){
+			e.rejected = true;
+			++counters.rejected;
+			return nullptr;
+		}
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t bytes = (code.size() + page - 1) / page * page;
+		void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) throw std::bad_alloc{};
+		std::memcpy(mem, code.data(), code.size());
+		mprotect(mem, bytes, PROT_READ | PROT_EXEC);
+		pages.push_back(std::make_pair(mem, bytes));
+		e.code = reinterpret_cast<Code>(mem);
+		e.rejected = false;
+		e.runs = e.bailouts = 0;
+		++counters.compiled;
+		counters.code_bytes += code.size();
+		return e.code;
+	}
+
+}
@@ -0,0 +1,82 @@
+// jit.h
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <vector>
+#include "memory.h"
+
+namespace emily{
+
+	// counters kept by the JIT
+	struct JitStats{
+		size_t compiled;	// closures compiled to native code
+		size_t rejected;	// closures that became hot but could not be compiled
+		size_t discarded;	// compiled closures given up on after bailing out too often
+		size_t runs;		// calls that completed in native code
+		size_t bailouts;	// calls that bailed out to the interpreter
+		size_t code_bytes;	// bytes of machine code generated
+	};
+
+	/**	Baseline JIT
+	 *	compiles hot closures to x86-64 machine code, one template per operation
+	 *	a closure can be compiled if its body only does arithmetic, comparisons,
+	 *	not and lowered tern, if and while branches on its arguments and numeric
+	 *	literals, and loads from tables passed as arguments; anything else stays
+	 *	interpreted
+	 *	code is specialized on the types of the arguments it was compiled with:
+	 *	Integer, Number, or a table of Integers or Numbers, whose elements are
+	 *	found without hashing when it is array-like
+	 *	guards check those types on every call, and a guard failure, an Integer
+	 *	overflow, an exact Integer division or a missing element bails out, so the
+	 *	caller runs the closure in the interpreter instead, as if it had not been
+	 *	compiled; compiled bodies have no side effects, so nothing is undone
+	 *	only built on x86-64 Linux, as the emily_jit target (EMILY_JIT)
+	 */
+	class Jit{
+	public:
+		// returns 1 with the result in result, or 0 to bail out
+		// results are numbers or booleans, so they hold no references
+		typedef int(*Code)(MemoryManager* mm, const Value* args, Value* result);
+
+		// a closure becomes hot once its calls and loop iterations reach threshold
+		Jit(const Program& prog, MemoryManager& mm, unsigned threshold = 1000);
+		~Jit();
+
+		// counts a call of closure with its arguments, in binding order, and runs it
+		// in native code once it is hot; returns false if the interpreter must run it
+		bool call(int closure, const Value* args, Value& result);
+		// counts one iteration of a loop in closure
+		void loop(int closure);
+		// compiles closure for the types of args now, whatever its counters
+		// returns null if it cannot be compiled
+		Code compile(int closure, const Value* args);
+
+		const JitStats& stats() const{ return counters; }
+
+	private:
+		struct Entry{
+			unsigned count;
+			bool rejected;
+			Code code;
+			size_t runs;
+			size_t bailouts;
+		};
+
+		const Program& prog;
+		MemoryManager& mm;
+		unsigned threshold;
+		std::vector<Entry> entries;
+		// executable pages holding compiled code, with their sizes
+		std::vector<std::pair<void*, size_t>> pages;
+		JitStats counters;
+
+		Entry& entry(int closure);
+
+		Jit(const Jit&);
+		Jit& operator=(const Jit&);
+	};
+
+}
+
+#endif
@@ -3,20 +3,97 @@
 #ifndef __KEYWORDS_H__
 #define __KEYWORDS_H__
 
+#include <cstring>
 #include <string>
-#include <vector>
 
 namespace emily{
 
-	const std::vector<std::string> keywords = {
-		"has", "set", "let", "parent", "!id", "current", "this", "super", "return",
-		"package", "project", "directory", "internal", "nonlocal", "private", "exportLet",
-		"eq", "null", "true", "print", "println", "ln", "sp", "do", "loop", "if", "while",
-		"not", "and", "or", "xor", "nullfn", "tern", "append", "each", "negate", "add",
-		"minus", "times", "divide", "mod", "lt", "lte", "gt", "gte", "thisTransplant",
-		"thisFreeze", "thisInit", "thisUpdate", "check", "scope", "!type"
-	};
+	/**	Keyword table
+	 *	X(id, spelling, argc, this kind, function) for each keyword
+	 *	a keyword's position is its word index in every program and its id in
+	 *	the builtin registry, so new keywords go at the end
+	 *	argc, this kind and function describe the builtin the keyword names;
+	 *	a null function means the interpreter implements it itself
+	 */
+#define EMILY_KEYWORDS(X) \
+	X(Has, "has", 1, Current, nullptr) \
+	X(Set, "set", 2, Current, nullptr) \
+	X(Let, "let", 2, Current, nullptr) \
+	X(Parent, "parent", 0, Blank, nullptr) \
+	X(Id, "!id", 0, Blank, nullptr) \
+	X(CurrentScope, "current", 0, Blank, nullptr) \
+	X(This, "this", 0, Blank, nullptr) \
+	X(Super, "super", 0, Blank, nullptr) \
+	X(Return, "return", 1, Blank, nullptr) \
+	X(Package, "package", 0, Blank, nullptr) \
+	X(Project, "project", 0, Blank, nullptr) \
+	X(Directory, "directory", 0, Blank, nullptr) \
+	X(Internal, "internal", 0, Blank, nullptr) \
+	X(Nonlocal, "nonlocal", 0, Blank, nullptr) \
+	X(Private, "private", 0, Blank, nullptr) \
+	X(ExportLet, "exportLet", 2, Current, nullptr) \
+	X(Eq, "eq", 1, Current, builtin_eq) \
+	X(Null, "null", 0, Blank, nullptr) \
+	X(True, "true", 0, Blank, nullptr) \
+	X(Print, "print", 1, Blank, nullptr) \
+	X(Println, "println", 1, Blank, nullptr) \
+	X(Ln, "ln", 0, Blank, nullptr) \
+	X(Sp, "sp", 0, Blank, nullptr) \
+	X(Do, "do", 1, Blank, nullptr) \
+	X(Loop, "loop", 1, Blank, nullptr) \
+	X(If, "if", 2, Blank, nullptr) \
+	X(While, "while", 2, Blank, nullptr) \
+	X(Not, "not", 1, Blank, builtin_not) \
+	X(And, "and", 2, Blank, nullptr) \
+	X(Or, "or", 2, Blank, nullptr) \
+	X(Xor, "xor", 2, Blank, nullptr) \
+	X(Nullfn, "nullfn", 1, Blank, builtin_nullfn) \
+	X(Tern, "tern", 3, Blank, nullptr) \
+	X(Append, "append", 1, Current, nullptr) \
+	X(Each, "each", 1, Current, nullptr) \
+	X(Negate, "negate", 0, Current, builtin_negate) \
+	X(Add, "add", 1, Current, builtin_add) \
+	X(Minus, "minus", 1, Current, builtin_minus) \
+	X(Times, "times", 1, Current, builtin_times) \
+	X(Divide, "divide", 1, Current, builtin_divide) \
+	X(Mod, "mod", 1, Current, builtin_mod) \
+	X(Lt, "lt", 1, Current, builtin_lt) \
+	X(Lte, "lte", 1, Current, builtin_lte) \
+	X(Gt, "gt", 1, Current, builtin_gt) \
+	X(Gte, "gte", 1, Current, builtin_gte) \
+	X(ThisTransplant, "thisTransplant", 1, Blank, nullptr) \
+	X(ThisFreeze, "thisFreeze", 1, Blank, nullptr) \
+	X(ThisInit, "thisInit", 1, Blank, nullptr) \
+	X(ThisUpdate, "thisUpdate", 1, Blank, nullptr) \
+	X(Check, "check", 2, Blank, nullptr) \
+	X(Scope, "scope", 0, Blank, nullptr) \
+	X(Type, "!type", 1, Blank, nullptr)
+
+	namespace Kw{
+#define EMILY_KEYWORD_ID(id, str, argc, kind, fn) id,
+		enum Keyword{
+			EMILY_KEYWORDS(EMILY_KEYWORD_ID)
+			Count
+		};
+#undef EMILY_KEYWORD_ID
+	}
+
+	// spelling of keyword kw
+	inline const char* keyword_name(int kw){
+#define EMILY_KEYWORD_NAME(id, str, argc, kind, fn) str,
+		static const char* const names[] = { EMILY_KEYWORDS(EMILY_KEYWORD_NAME) };
+#undef EMILY_KEYWORD_NAME
+		return names[kw];
+	}
+
+	// keyword spelled str, or -1 if str is not a keyword
+	inline int find_keyword(const std::string& str){
+		for (int kw = 0; kw < Kw::Count; ++kw){
+			if (std::strcmp(keyword_name(kw), str.c_str()) == 0) return kw;
+		}
+		return -1;
+	}
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,5 +1,6 @@
 // macro.cpp
 
+#include "instrument.h"
 #include "macro.h"
 
 namespace emily{
@@ -356,7 +357,8 @@ namespace emily{
 		return true;
 	}
 
-	bool do_macros(Program& prog){
+	bool do_macros(Program& prog, MacroTimes* times){
+		EMILY_PHASE(DoMacros, prog);
 		std::vector<Macro> macros{ built_in_macros.rbegin(), built_in_macros.rend() };
 		// TODO (maybe): add user defined macros, then stable sort
 		bool result = true;
@@ -366,6 +368,8 @@ namespace emily{
 					auto is_op = [&mac, &prog](Token tok){
 						return tok.type == Tok::Symbol && prog.symbols[tok.index] == mac.sym;
 					};
+					std::chrono::steady_clock::time_point start;
+					if (times) start = std::chrono::steady_clock::now();
 					// probably a better way to structure this loop
 					for (;;) {
 						CodePos pos;
@@ -406,11 +410,14 @@ namespace emily{
 								result &= macro_backtick(prog, line, pos); break;
 							case Transform::UserDefined: break; // not implemented
 							}
+							if (times) ++times->applied[(int)mac.fn];
+							EMILY_COUNT(transforms[(int)mac.fn]);
 							// set the iterator to a known value since it may have been invalidated
 							pos = line.begin();
 						}
 						if (pos == line.end()) break;
 					}
+					if (times) times->time[(int)mac.fn] += std::chrono::steady_clock::now() - start;
 				}
 				for (auto& tok : line){
 					if (tok.type == Tok::Symbol){
@@ -423,22 +430,146 @@ namespace emily{
 		return result;
 	}
 
+	namespace{
+		// replaces tokens for plain groups of one token with that token
+		void elide(Program& prog){
+			for (auto& group : prog.groups){
+				for (auto& line : group){
+					for (auto& token : line){
+						while (token.type == Tok::Group){
+							if (prog.group_kinds[token.index] == '(' &&
+								prog.groups[token.index].size() == 1 && 
+								prog.groups[token.index].back().size() == 1){
+								int i = token.index;
+								token = prog.groups[i].back().back();
+								prog.groups[i].clear();
+							}
+							else break;
+						}
+					}
+				}
+			}
+		}
+	}
+
 	void elide_groups(Program& prog){
+		EMILY_PHASE(ElideGroups, prog);
+		elide(prog);
+	}
+
+	namespace{
+		// number of operands the builtin takes, or 0 if it is not lowered
+		int lowered_argc(int kw){
+			switch (kw){
+			case Kw::And: case Kw::Or: case Kw::Xor: case Kw::If: case Kw::While: return 2;
+			case Kw::Tern: return 3;
+			default: return 0;
+			}
+		}
+
+		// true if the body of clos, run in place, would behave as it does in its own scope:
+		// it defines no variables and does not look at the scope itself, or at this and
+		// super, which in place would be those of the enclosing closure
+		bool runs_in_place(const Program& prog, const ClosureInfo& clos){
+			if (!clos.bindings.empty() || clos.has_return) return false;
+			std::vector<int> groups{ clos.group_idx };
+			while (!groups.empty()){
+				int g = groups.back();
+				groups.pop_back();
+				for (const auto& line : prog.groups[g]){
+					for (const auto& tok : line){
+						switch (tok.type){
+						case Tok::Atom:
+							if (tok.index == Kw::Let || tok.index == Kw::ExportLet) return false;
+							break;
+						case Tok::Word:
+							if (tok.index == Kw::CurrentScope || tok.index == Kw::Scope ||
+								tok.index == Kw::Parent || tok.index == Kw::Private ||
+								tok.index == Kw::This || tok.index == Kw::Super) return false;
+							break;
+						case Tok::Group:
+							groups.push_back(tok.index);
+							break;
+						}
+					}
+				}
+			}
+			return true;
+		}
+
+		// keywords used as keys or closure bindings anywhere in prog
+		// a key is an atom, or the word after .let, .set or .exportLet
+		std::vector<bool> rebound_keywords(const Program& prog){
+			std::vector<bool> rebound(Kw::Count, false);
+			for (const auto& group : prog.groups){
+				for (const auto& line : group){
+					bool key = false;
+					for (const auto& tok : line){
+						if ((tok.type == Tok::Atom || (key && tok.type == Tok::Word)) && tok.index < Kw::Count)
+							rebound[tok.index] = true;
+						key = tok.type == Tok::Atom &&
+							(tok.index == Kw::Let || tok.index == Kw::Set || tok.index == Kw::ExportLet);
+					}
+				}
+			}
+			for (const auto& clos : prog.closures)
+				for (const auto& tok : clos.bindings)
+					if (tok.index < Kw::Count) rebound[tok.index] = true;
+			return rebound;
+		}
+	}
+
+	size_t lower_control_flow(Program& prog){
+		EMILY_PHASE(LowerControlFlow, prog);
+		std::vector<bool> rebound = rebound_keywords(prog);
+		size_t lowered = 0;
 		for (auto& group : prog.groups){
 			for (auto& line : group){
-				for (auto& token : line){
-					while (token.type == Tok::Group){
-						if (prog.group_kinds[token.index] == '(' &&
-							prog.groups[token.index].size() == 1 && 
-							prog.groups[token.index].back().size() == 1){
-							int i = token.index;
-							token = prog.groups[i].back().back();
-							prog.groups[i].clear();
-						}
-						else break;
+				if (line.empty() || line.front().type != Tok::Word) continue;
+				int op = line.front().index;
+				int argc = op < Kw::Count && !rebound[op] ? lowered_argc(op) : 0;
+				if (argc == 0 || (int)line.size() != argc + 1) continue;
+
+				BranchInfo br{ op };
+				bool ok = true;
+				int i = 0;
+				for (auto tk = std::next(line.begin()); tk != line.end(); ++tk, ++i){
+					// the condition of if and tern is a value, not a closure
+					bool condition = i == 0 && (op == Kw::If || op == Kw::Tern);
+					if (condition){
+						br.operands[i] = *tk;
+						continue;
+					}
+					if (tk->type != Tok::Closure || !runs_in_place(prog, prog.closures[tk->index])){
+						ok = false;
+						break;
 					}
+					// the closure stays in prog.closures, unused, as tokens, the JIT and
+					// the profiler refer to closures by index
+					int body = prog.closures[tk->index].group_idx;
+					br.operands[i] = Token{ Tok::Group, body, tk->line, tk->column };
+				}
+				if (!ok) continue;
+
+				Token tok{ Tok::Branch, (int)prog.branches.size(), line.front().line, line.front().column };
+				prog.branches.push_back(br);
+				line = Line{ tok };
+				++lowered;
+				EMILY_COUNT(branches);
+			}
+		}
+		// groups around a lowered line, and bodies of a single token, are now elided too
+		elide(prog);
+		for (auto& br : prog.branches){
+			for (auto& operand : br.operands){
+				if (operand.type == Tok::Group && prog.group_kinds[operand.index] == '(' &&
+					prog.groups[operand.index].size() == 1 && prog.groups[operand.index].back().size() == 1){
+					int i = operand.index;
+					operand = prog.groups[i].back().back();
+					prog.groups[i].clear();
 				}
 			}
 		}
+		return lowered;
 	}
-}
\ No newline at end of file
+}
@@ -4,6 +4,7 @@
 #define __MACRO_H__
 
 #include <algorithm>
+#include <chrono>
 #include <iterator>
 #include <queue>
 #include <vector>
@@ -104,14 +105,47 @@ namespace emily{
 	bool macro_unary_prefix(Program& prog, Line& line, CodePos tk, const char* str);
 	bool macro_backtick(Program& prog, Line& line, CodePos tk);
 
+	const int TransformCount = (int)Transform::UserDefined + 1;
+
+	// name of the transform, as in the Transform enum
+	inline const char* transform_name(int t){
+		static const char* const names[TransformCount] = {
+			"Comma", "Atom", "Assignment", "ClosureConstruct", "Question", "ApplyRight",
+			"MakeShortCircuit", "Ifndef", "MakeSplitter", "MakeSplitterInvert",
+			"MakeDualModeSplitter", "MakeUnary", "MakePrefixUnary", "Backtick", "UserDefined"
+		};
+		return names[t];
+	}
+
+	// time spent in each transform, including searching lines for its symbol
+	struct MacroTimes{
+		std::chrono::nanoseconds time[TransformCount];
+		size_t applied[TransformCount];	// number of times the transform was applied
+	};
+
 	// for each line in prog, performs each macro in order of descending priority
 	// returns true if all macros succeeded without errors
 	// returns false if any macros encountered a syntax error
-	bool do_macros(Program& prog);
+	// adds the time taken by each transform to times, if given
+	bool do_macros(Program& prog, MacroTimes* times = nullptr);
 
 	// removes unnecessary plain groups containing single tokens
 	void elide_groups(Program& prog);
 
+	/**
+	 *	replaces lines of the shapes the boolean, ternary and loop macros produce,
+	 *	and ^(a) ^(b), or, xor, tern (c) ^(a) ^(b), if (c) ^(b) and while ^(c) ^(b),
+	 *	with branch tokens, so they run as jumps without making closures
+	 *	only closures with no bindings or return whose bodies could run in the
+	 *	enclosing scope are lowered, and a keyword the program rebinds anywhere,
+	 *	as a key or a closure binding, keeps its generic meaning everywhere
+	 *	bodies that use this or super are not lowered, as they would see the
+	 *	enclosing closure's; the closures lowered stay in prog.closures, unused,
+	 *	so the indices of the others do not change
+	 *	run after do_macros and elide_groups; returns the number of lines lowered
+	 */
+	size_t lower_control_flow(Program& prog);
+
 }
 
 #endif
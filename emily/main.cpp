@@ -52,6 +52,7 @@ repeatWith starting                                             # Begin)");
 
 	do_macros(prog);
 	elide_groups(prog);
+	lower_control_flow(prog);
 	std::cout << prog;
 	std::cin.get();
 }
\ No newline at end of file
@@ -2,67 +2,103 @@
 
 #include "memory.h"
 
-namespace emily{
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-	template<>
-	std::string& MemoryManager::get<std::string>(Value val){
-		if (val.type != ValType::String)
-			throw std::exception{ "Internal Error: attempted to get string from non-string value" };
-		return strings[val];
-	}
+namespace emily{
 
-	template<>
-	BuiltinFun& MemoryManager::get<BuiltinFun>(Value val){
-		if (val.type != ValType::BuiltinFunction)
-			throw std::exception{ "Internal Error: attempted to get BuiltinFun from non-BuiltinFun value" };
-		return builtinFuns[val];
+	void* allocate_page(size_t bytes){
+#ifdef _WIN32
+		void* page = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (page == nullptr) throw std::bad_alloc{};
+#else
+		void* page = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (page == MAP_FAILED) throw std::bad_alloc{};
+#endif
+		return page;
 	}
 
-	template<>
-	UserClosure& MemoryManager::get<UserClosure>(Value val){
-		if (val.type != ValType::UserClosure)
-			throw std::exception{ "Internal Error: attempted to get UserClosure from non-UserClosure value" };
-		return userClosures[val];
+	void release_page(void* page, size_t bytes){
+#ifdef _WIN32
+		VirtualFree(page, 0, MEM_RELEASE);
+#else
+		munmap(page, bytes);
+#endif
 	}
 
-	template<>
-	BuiltinClosure& MemoryManager::get<BuiltinClosure>(Value val){
-		if (val.type != ValType::BuiltinClosure)
-			throw std::exception{ "Internal Error: attempted to get BuiltinClosure from non-BuiltinClosure value" };
-		return builtinClosures[val];
+	void protect_page(void* page, size_t bytes, bool writable){
+#ifdef _WIN32
+		DWORD old;
+		VirtualProtect(page, bytes, writable ? PAGE_READWRITE : PAGE_READONLY, &old);
+#else
+		mprotect(page, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ);
+#endif
 	}
 
-	template<>
-	Table& MemoryManager::get<Table>(Value val){
-		if (val.type != ValType::Table)
-			throw std::exception{ "Internal Error: attempted to get Table from non-Table value" };
-		return tables[val];
+	const char* map_file(const char* path, size_t& bytes){
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return nullptr;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0){
+			CloseHandle(file);
+			return nullptr;
+		}
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (mapping == nullptr) return nullptr;
+		// the view keeps the mapping open
+		void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (data == nullptr) return nullptr;
+		bytes = (size_t)size.QuadPart;
+		return static_cast<const char*>(data);
+#else
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) return nullptr;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0){
+			close(fd);
+			return nullptr;
+		}
+		void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) return nullptr;
+		bytes = st.st_size;
+		return static_cast<const char*>(data);
+#endif
 	}
 
-	template<>
-	Continuation& MemoryManager::get<Continuation>(Value val){
-		if (val.type != ValType::Continuation)
-			throw std::exception{ "Internal Error: attempted to get Continuation from non-Continuation value" };
-		return continuations[val];
+	void unmap_file(const char* data, size_t bytes){
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(const_cast<char*>(data), bytes);
+#endif
 	}
 
 	Value MemoryManager::create(ValType v){
 		switch (v){
-		case ValType::String: return strings.create();
-		case ValType::BuiltinFunction: return builtinFuns.create();
-		case ValType::UserClosure: return userClosures.create();
-		case ValType::BuiltinClosure: return builtinClosures.create();
-		case ValType::Table: return tables.create();
-		case ValType::Continuation: return continuations.create();
+		case ValType::String: return create<String>().value();
+		case ValType::UserClosure: return create<UserClosure>().value();
+		case ValType::BuiltinClosure: return create<BuiltinClosure>().value();
+		case ValType::Table: return create<Table>().value();
+		case ValType::Continuation: return create<Continuation>().value();
 		default:
-			throw std::exception{ "Internal Error: attempted to allocate object of an unmanaged type" };
+			throw InternalError{ "Internal Error: attempted to allocate object of an unmanaged type" };
 		}
 	}
 
 	Value MemoryManager::ref(Value val){
+		if (is_constant(val)) return val;
 		switch (val.type){
 		case ValType::String: strings.ref(val); break;
-		case ValType::BuiltinFunction: builtinFuns.ref(val); break;
 		case ValType::UserClosure: userClosures.ref(val); break;
 		case ValType::BuiltinClosure: builtinClosures.ref(val); break;
 		case ValType::Continuation: continuations.ref(val); break;
@@ -73,9 +109,9 @@ namespace emily{
 	}
 
 	int MemoryManager::refcount(Value val) const{
+		if (is_constant(val)) return INT_MAX;
 		switch (val.type){
 		case ValType::String: return strings.refcount(val);
-		case ValType::BuiltinFunction: return builtinFuns.refcount(val);
 		case ValType::UserClosure: return userClosures.refcount(val);
 		case ValType::BuiltinClosure: return builtinClosures.refcount(val);
 		case ValType::Continuation: return continuations.refcount(val);
@@ -84,33 +120,170 @@ namespace emily{
 		}
 	}
 
+	namespace{
+		// deref takes any value, so checks that it is a counted object before dropping it
+		template<typename T, ValType V>
+		int counted(const MemPool<T, V>& pool, Value val){
+			pool.check(val);
+			if (pool.count(val.index) < 1)
+				throw InternalError{ "Internal Error: attempted to dereference object with no references" };
+			return val.index;
+		}
+	}
+
 	void MemoryManager::deref(Value val){
+		if (is_constant(val)) return;
 		switch (val.type){
-		case ValType::String: strings.deref(val); break;
-		case ValType::BuiltinFunction: builtinFuns.deref(val); break;
-		case ValType::UserClosure: userClosures.deref(val); break;
-		case ValType::BuiltinClosure: builtinClosures.deref(val); break;
-		case ValType::Continuation: continuations.deref(val); break;
-		case ValType::Table: 
-			if (refcount(val) == 1) free(val);
-			else tables.deref(val);
-		default: return;
+		case ValType::String: drop(strings, counted(strings, val)); break;
+		case ValType::UserClosure: drop(userClosures, counted(userClosures, val)); break;
+		case ValType::BuiltinClosure: drop(builtinClosures, counted(builtinClosures, val)); break;
+		case ValType::Continuation: drop(continuations, counted(continuations, val)); break;
+		case ValType::Table: drop(tables, counted(tables, val)); break;
+		default: break;
 		}
 	}
 
+	// frees an object, queueing the references it held for release
 	void MemoryManager::free(Value val){
+		if (is_constant(val))
+			throw InternalError{ "Internal Error: attempted to free constant" };
 		switch (val.type){
-		case ValType::String: strings.free(val); break;
-		case ValType::BuiltinFunction: builtinFuns.free(val); break;
-		case ValType::UserClosure: userClosures.free(val); break;
-		case ValType::BuiltinClosure: builtinClosures.free(val); break;
-		case ValType::Continuation: continuations.free(val); break;
-		case ValType::Table:
-			for (auto pair : get<Table>(val)){
-				deref(pair.second);
-			}
-			tables.free(val);
+		case ValType::String:
+			strings.check(val);
+			release_string(val.index);
+			return;
+		case ValType::UserClosure: release_refs(userClosures.take(val)); break;
+		case ValType::BuiltinClosure: release_refs(builtinClosures.take(val)); break;
+		case ValType::Continuation: release_refs(continuations.take(val)); break;
+		case ValType::Table: release_refs(tables.take(val)); break;
 		default: return;
 		}
+		if (free_budget == 0) release_pending();
+	}
+
+	void MemoryManager::release_refs(UserClosure&& clos){
+		for_each_ref(clos, [this](Value ref){ release(ref); });
 	}
+
+	void MemoryManager::release_refs(BuiltinClosure&& clos){
+		for_each_ref(clos, [this](Value ref){ release(ref); });
+	}
+
+	void MemoryManager::release_refs(Continuation&& cont){
+		for_each_ref(cont, [this](Value ref){ release(ref); });
+	}
+
+	// a table's entries are released a few at a time from the dying list
+	void MemoryManager::release_refs(Table&& table){
+		std::vector<TableEntry> entries = table.take_entries();
+		if (!entries.empty()) dying.push_back(std::move(entries));
+	}
+
+	void MemoryManager::set_free_budget(size_t budget){
+		free_budget = budget;
+	}
+
+	void MemoryManager::release_pending(size_t budget){
+		// derefs made while releasing only add to the work lists
+		if (releasing) return;
+		releasing = true;
+		for (size_t steps = 0; budget == 0 || steps < budget; ++steps){
+			if (!pending.empty()){
+				Value val = pending.back();
+				pending.pop_back();
+				deref(val);
+			}
+			else if (!dying.empty()){
+				if (dying.back().empty()){
+					dying.pop_back();
+					continue;
+				}
+				TableEntry entry = dying.back().back();
+				dying.back().pop_back();
+				release(entry.first);
+				release(entry.second);
+			}
+			else break;
+		}
+		releasing = false;
+	}
+
+	size_t MemoryManager::pending_frees() const{
+		size_t count = pending.size();
+		for (const auto& entries : dying) count += entries.size();
+		return count;
+	}
+
+	void MemoryManager::set_deferred(bool enable){
+		if (!zct.empty())
+			throw InternalError{ "Internal Error: attempted to change reference counting mode with a nonempty zero count table" };
+		defer = enable;
+	}
+
+	bool MemoryManager::deferred() const{
+		return defer;
+	}
+
+	Value MemoryManager::acquire(Value val){
+		return defer ? val : ref(val);
+	}
+
+	void MemoryManager::reconcile(const ExecStack& stack, const std::vector<Value>& roots){
+		std::unordered_set<Value> referenced{ roots.begin(), roots.end() };
+		for (const auto& frame : stack){
+			referenced.insert(frame.reg[0]);
+			referenced.insert(frame.reg[1]);
+			referenced.insert(frame.scope);
+		}
+		std::vector<Value> keep;
+		std::unordered_set<Value> kept;
+		// freeing an object can send the objects it referenced to the table,
+		// so repeat until it stays empty
+		while (!zct.empty()){
+			std::vector<Value> work;
+			work.swap(zct);
+			for (auto val : work){
+				// skip objects counted again since, and duplicates already freed
+				if (refcount(val) != 0) continue;
+				if (referenced.count(val) != 0){
+					if (kept.insert(val).second) keep.push_back(val);
+				}
+				else free(val);
+			}
+		}
+		zct.swap(keep);
+		if (cycle_threshold != 0 && suspects.size() >= cycle_threshold){
+			stack_roots = &referenced;
+			collect_cycles(cycle_budget);
+			stack_roots = nullptr;
+		}
+	}
+
+	size_t MemoryManager::zero_count() const{
+		return zct.size();
+	}
+
+	size_t MemoryManager::footprint(Value val){
+		// constants belong to their pool, not to the heap
+		if (is_constant(val)) return 0;
+		switch (val.type){
+		case ValType::String:{
+			const String& str = strings[val];
+			// a shared buffer is counted by each string in proportion to its view
+			return sizeof(String) + str.length;
+		}
+		case ValType::UserClosure:{
+			const UserClosure& clos = userClosures[val];
+			return sizeof(UserClosure) + clos.bound.capacity() * sizeof(Value)
+				+ clos.info.bindings.capacity() * sizeof(Token);
+		}
+		case ValType::BuiltinClosure:
+			return sizeof(BuiltinClosure) + builtinClosures[val].bound.capacity() * sizeof(Value);
+		case ValType::Table: return sizeof(Table) + tables[val].memory();
+		case ValType::Continuation:
+			return sizeof(Continuation) + continuations[val].stack.capacity() * sizeof(StackFrame);
+		default: return 0;
+		}
+	}
+
 }
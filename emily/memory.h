@@ -3,142 +3,1025 @@
 #ifndef __MEMORY_H__
 #define __MEMORY_H__
 
-#include <stack>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <istream>
+#include <iterator>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include "table.h"
 #include "values.h"
 
 namespace emily{
 
+	// thrown on misuse of managed memory, which means the interpreter has a bug
+	class InternalError : public std::logic_error{
+	public:
+		explicit InternalError(const char* msg) : std::logic_error{ msg }{}
+	};
+
+	// maps each managed object type to its ValType
+	template<typename T> struct type_of;
+	template<> struct type_of<String>{ static const ValType value = ValType::String; };
+	template<> struct type_of<UserClosure>{ static const ValType value = ValType::UserClosure; };
+	template<> struct type_of<BuiltinClosure>{ static const ValType value = ValType::BuiltinClosure; };
+	template<> struct type_of<Table>{ static const ValType value = ValType::Table; };
+	template<> struct type_of<Continuation>{ static const ValType value = ValType::Continuation; };
+
+	/**	Typed handle
+	 *	refers to a managed object whose type is known at compile time, so
+	 *	operations on it dispatch to the right pool without a type switch
+	 *	and are only validated in a checked build (EMILY_CHECKED)
+	 *	constants have no handles, since they are not in any pool
+	 */
+	template<typename T>
+	struct Handle{
+		int index;
+
+		Value value() const{ return make_value(type_of<T>::value, index); }
+	};
+
+	// converts a value the caller knows to be of type T
+	template<typename T>
+	Handle<T> handle(Value val){
+#ifdef EMILY_CHECKED
+		if (val.type != type_of<T>::value)
+			throw InternalError{ "Internal Error: attempted to make handle of incorrect type" };
+#endif
+		Handle<T> h;
+		h.index = val.index;
+		return h;
+	}
+
+	// allocates and releases memory for pool pages directly from the OS,
+	// so memory of released pages is returned instead of kept by the heap
+	void* allocate_page(size_t bytes);
+	void release_page(void* page, size_t bytes);
+	// makes pages from allocate_page read-only, or writable again
+	void protect_page(void* page, size_t bytes, bool writable);
+	// maps a whole file read-only, returning null if it cannot be opened or is empty
+	const char* map_file(const char* path, size_t& bytes);
+	void unmap_file(const char* data, size_t bytes);
+
+	// constants are objects of managed types with negative indices, which live
+	// in a ConstantPool instead of a memory pool and are never counted or freed
+	inline bool is_constant(Value val){
+		return val.type >= ValType::String && val.index < 0;
+	}
+
+	// memory statistics of one pool
+	// counters are compiled out when EMILY_NO_MEMORY_STATS is defined
+	struct PoolStats{
+		size_t live;		// objects currently allocated
+		size_t peak;		// highest number of live objects
+		size_t allocs;		// objects created
+		size_t frees;		// objects freed
+		size_t reused;		// objects created in a slot that held a freed object
+		size_t free_slots;	// free slots in allocated pages
+		size_t pages;		// allocated pages
+		size_t bytes;		// bytes of allocated pages
+		size_t heap_bytes;	// bytes owned by objects outside their pages, only in a deep snapshot
+	};
+
 	/**	Memory pool class
-	 *	allocates new objects and associates them w/ an index by storing them in a vector
-	 *	objects are reference counted
+	 *	allocates new objects in fixed size pages and associates them w/ an index
+	 *	objects never move, so references to them stay valid until they are freed
+	 *	each object is stored next to its reference count, and freed slots form
+	 *	a free list through the page; a page with no objects is returned to the OS
+	 *	a live object may have a count of 0 while it is only referenced from the stack,
+	 *	freed slots have a count of Freed
+	 *	each page also keeps a bit per slot marking objects buffered as cycle suspects
 	 */
 	template <typename T, ValType V>
 	class MemPool{
-		std::vector<T> items;
-		std::vector<int> refs;
-		std::stack<int> freed;
+		static const int Freed = -1;
+		static const int PageBits = 8;
+		static const int PageSize = 1 << PageBits;
+		// empty pages kept instead of released, so a pool at a page boundary does not thrash
+		static const int SparePages = 1;
+
+		struct Slot{
+			int refs;
+			union{
+				int next;	// next free slot in the page, while freed
+				int site;	// allocation site of the object, while live
+			};
+			typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+
+			T& item(){ return *reinterpret_cast<T*>(&storage); }
+		};
+
+		struct Page{
+			int live;	// slots holding objects
+			int free;	// first free slot, -1 if the page is full
+			int touched;	// slots at or above this index have never held an object
+			bool listed;	// whether the page is in the open list
+			unsigned buffered[PageSize / 32];	// bit per slot, cleared when the slot is freed
+			Slot slots[PageSize];
+		};
+
+		std::vector<Page*> pages;	// released pages are null
+		std::vector<int> open;		// pages that may have free slots
+		std::vector<int> released;	// indices of released pages, for reuse
+		int spare = 0;				// empty pages not yet released
+		size_t page_count = 0;
+#ifndef EMILY_NO_MEMORY_STATS
+		size_t allocs = 0;
+		size_t frees = 0;
+		size_t reused = 0;
+		size_t peak = 0;
+#endif
+
+		MemPool(const MemPool&);
+		MemPool& operator=(const MemPool&);
+
+		Slot* slot(int index) const;
+		Slot& live_slot(int index) const;
+		Slot& at(int index) const;
+		int new_page();
+
+	public:
+		MemPool();
+		~MemPool();
+		Value create(int count = 1);
 
+		// operations by index, for callers that already know the object's type
+		// and that it is live; only validated in a checked build
 		void ref(int index);
+		// safe on freed objects, which have a count of Freed
 		int refcount(int index) const;
+		// count of a live object
+		int count(int index) const;
 		void deref(int index);
+		void decrement(int index);
 		void free(int index);
+		T take(int index);
 		T& operator[](int index);
+		// allocation site of a live object, 0 if it was not tagged
+		int site(int index) const;
+		void set_site(int index, int site);
+		// sets whether the live object is buffered as a cycle suspect, returning whether it was
+		bool set_buffered(int index, bool buffered);
 
-	public:
-		Value create();
+		// operations by value check the type and that the object is live
+		void check(Value val) const;
 		void ref(Value val);
 		int refcount(Value val) const;
 		void deref(Value val);
+		// drops a reference without freeing the object when the count reaches 0
+		void decrement(Value val);
 		void free(Value val);
+		// frees an object, returning its contents
+		T take(Value val);
 		T& operator[](Value val);
+		// calls f on each live object
+		template<typename F>
+		void each(F f);
+		PoolStats stats() const;
+
+		// restoring a heap image
+		// creates an object at index, which must be free, allocating its page if needed
+		// returns null if index is negative or already holds an object
+		T* place(int index, int count, int site);
+		// rebuilds the free lists and the open list once every object is placed
+		void relink();
+		// destroys every object and releases every page, without releasing references
+		void clear();
+	};
+
+	// calls f on each value an object holds a reference to
+	template<typename F>
+	void for_each_ref(const UserClosure& clos, F f){
+		for (auto val : clos.bound) f(val);
+		f(clos.thisBindings[0]);
+		f(clos.thisBindings[1]);
+		f(clos.envScope);
+	}
+
+	template<typename F>
+	void for_each_ref(const BuiltinClosure& clos, F f){
+		for (auto val : clos.bound) f(val);
+		f(clos.thisBindings[0]);
+		f(clos.thisBindings[1]);
+	}
+
+	template<typename F>
+	void for_each_ref(const Continuation& cont, F f){
+		for (const auto& frame : cont.stack){
+			f(frame.reg[0]);
+			f(frame.reg[1]);
+			f(frame.scope);
+		}
+	}
+
+	template<typename F>
+	void for_each_ref(Table& table, F f){
+		for (const auto& entry : table){
+			f(entry.first);
+			f(entry.second);
+		}
+	}
+
+	// replaces each value an object holds a reference to with f(value)
+	template<typename F>
+	void map_refs(UserClosure& clos, F f){
+		for (auto& val : clos.bound) val = f(val);
+		clos.thisBindings[0] = f(clos.thisBindings[0]);
+		clos.thisBindings[1] = f(clos.thisBindings[1]);
+		clos.envScope = f(clos.envScope);
+	}
+
+	template<typename F>
+	void map_refs(BuiltinClosure& clos, F f){
+		for (auto& val : clos.bound) val = f(val);
+		clos.thisBindings[0] = f(clos.thisBindings[0]);
+		clos.thisBindings[1] = f(clos.thisBindings[1]);
+	}
+
+	template<typename F>
+	void map_refs(Continuation& cont, F f){
+		for (auto& frame : cont.stack){
+			frame.reg[0] = f(frame.reg[0]);
+			frame.reg[1] = f(frame.reg[1]);
+			frame.scope = f(frame.scope);
+		}
+	}
+
+	// statistics kept by the cycle collector
+	struct CycleStats{
+		size_t collections;	// number of times the collector ran
+		size_t suspects;	// candidate roots examined
+		size_t cycles;		// groups of garbage found
+		size_t objects;		// objects reclaimed
+		size_t bytes;		// estimated bytes reclaimed
+	};
+
+	// state of the whole heap at one time
+	struct MemorySnapshot{
+		long long time;					// steady clock time in nanoseconds
+		PoolStats pools[ValTypeCount];	// indexed by ValType
+		size_t pending;					// references waiting to be released
+		size_t zero_count;				// objects in the zero count table
+		size_t suspects;				// possible cycle roots
+		CycleStats cycles;
+	};
+
+	// writes a snapshot as a single line of JSON
+	// with a previous snapshot, also writes allocation and free rates per second
+	void write_json(std::ostream& os, const MemorySnapshot& snap, const MemorySnapshot* previous = nullptr);
+
+	// source position of the expression that allocated an object
+	struct AllocSite{
+		int line;
+		int column;
+	};
+
+	// live objects of one type
+	struct HeapTypeStats{
+		size_t count;
+		size_t bytes;		// footprint of the objects themselves
+		size_t retained;	// bytes that would be freed along with them
+	};
+
+	// live objects of one type tagged with one allocation site
+	struct HeapSiteStats{
+		AllocSite site;
+		ValType type;
+		size_t count;
+		size_t bytes;
+	};
+
+	// live objects by type and, for sampled objects, by allocation site
+	struct HeapDump{
+		unsigned sample_every;	// one in this many allocations was tagged, 0 if none were
+		HeapTypeStats types[ValTypeCount];	// indexed by ValType
+		std::vector<HeapSiteStats> sites;
+	};
+
+	// writes a heap dump in a line based text format that read_heap_dump reads back
+	void write_heap_dump(std::ostream& os, const HeapDump& dump);
+	// returns false if is does not hold a heap dump
+	bool read_heap_dump(std::istream& is, HeapDump& dump);
+
+	// FNV-1a over the characters of a string, never 0
+	size_t hash_chars(const char* str, size_t len);
+
+	/**	Constant pool
+	 *	immortal strings for the literals of a program, made once when it is loaded
+	 *	and shared by every memory manager that runs it, on any thread
+	 *	literal i is the string ~i, or the constant of the first equal literal,
+	 *	so equal literals are one object and interning their text finds it
+	 *	constants are interned and hashed in advance, and their pages are read-only
+	 *	once the pool is built, so using one never writes to it
+	 *	the program must outlive the pool, and the pool serves it only while
+	 *	it keeps the id it had when the pool was built
+	 */
+	class ConstantPool{
+		const Program& prog;
+		unsigned long long prog_id;
+		String* items;			// one per distinct literal, in read-only pages
+		size_t count;
+		size_t bytes;			// size of the pages holding items
+		std::vector<int> first;	// for each literal, the item holding its text
+		std::unordered_multimap<size_t, int> by_hash;
+
+		ConstantPool(const ConstantPool&);
+		ConstantPool& operator=(const ConstantPool&);
+
+	public:
+		explicit ConstantPool(const Program& prog);
+		~ConstantPool();
+
+		const Program& program() const{ return prog; }
+		// true if the literals are those of prog
+		bool serves(const Program& p) const{ return p.id.value == prog_id; }
+		// number of distinct literals
+		size_t size() const{ return count; }
+		Value literal(int index) const{ return make_value(ValType::String, ~first[index]); }
+		const String& string(Value val) const;
+		// the constant with the given characters, or null if there is none
+		Value find(const char* str, size_t len, size_t hash) const;
 	};
 
 	/**	Memory manager class
 	 *	keeps a memory pool for each managed type
-	 *	TODO: probably intern builtin functions somewhere else
+	 *	builtin functions are not managed: they live in the builtin registry
+	 *	string literals may be constants from a shared ConstantPool, which every
+	 *	operation accepts wherever it accepts a string
 	 */
 	class MemoryManager{
-		MemPool<std::string, ValType::String> strings;
+		MemPool<String, ValType::String> strings;
 		MemPool<BuiltinClosure, ValType::BuiltinClosure> builtinClosures;
-		MemPool<BuiltinFun, ValType::BuiltinFunction> builtinFuns;
 		MemPool<UserClosure, ValType::UserClosure> userClosures;
 		MemPool<Table, ValType::Table> tables;
 		MemPool<Continuation, ValType::Continuation> continuations;
 
 	public:
 		Value create(ValType v);
+		// ref and deref do nothing to constants, whose count is always INT_MAX
 		Value ref(Value val);
 		int refcount(Value val) const;
 		void deref(Value val);
 		void free(Value val);
 		template<typename T>
 		T& get(Value val);
+
+		// typed operations, dispatched at compile time
+		template<typename T>
+		Handle<T> create();
+		template<typename T>
+		T& get(Handle<T> h);
+		template<typename T>
+		Handle<T> ref(Handle<T> h);
+		template<typename T>
+		void deref(Handle<T> h);
+		template<typename T>
+		void free(Handle<T> h);
+
+		// string heap
+		// strings are immutable once created
+		Value create_string(std::string str);
+		// the string val, which may be a constant
+		const String& string(Value val);
+		// returns the unique interned string equal to str, creating it if needed
+		Value intern(const std::string& str);
+		// returns the unique interned string equal to the string str, which becomes
+		// it if there is none; table keys compare strings by index, so a string made
+		// at run time is interned before it is used as one
+		Value intern(Value str);
+		// returns the interned string for the literal prog.strings[index]
+		// literals are cached, so evaluating one again does not allocate,
+		// or are constants when this manager has the constants of prog
+		Value literal(const Program& prog, int index);
+		Value concat(Value l, Value r);
+		// substrings of constants copy their characters, since a constant's buffer
+		// may be shared with other threads and must not be appended to
+		Value substr(Value str, size_t pos, size_t len);
+		// hash of the characters of str, cached in the string for interning it
+		size_t hash(Value str);
+
+		// sets how many references of dead objects are released per allocation
+		// 0 releases them as soon as an object is freed
+		void set_free_budget(size_t budget);
+		// releases references of dead objects until at most budget steps were taken
+		// a budget of 0 releases all of them
+		void release_pending(size_t budget = 0);
+		// number of dead objects and references still waiting to be released
+		size_t pending_frees() const;
+
+		// calls f on each value the object val holds a reference to
+		template<typename F>
+		void each_ref(Value val, F f);
+		// estimated bytes used by the object val, including memory it owns
+		size_t footprint(Value val);
+
+		// cycle collector
+		// reference counting alone never frees objects that refer to each other,
+		// so objects that survive a deref are remembered as suspects, once each,
+		// and periodically checked for being referenced only from garbage
+		// runs the collector over the objects reachable from the oldest suspects,
+		// traversing at most budget objects, or from all of them if budget is 0
+		// suspects whose objects were not reached stay buffered for the next run,
+		// as does one whose objects were cut off, which the next run then retries
+		// with twice the budget
+		void collect_cycles(size_t budget = 0);
+		// sets how many suspects accumulate before an allocation runs the collector
+		// 0 disables automatic collection
+		void set_cycle_threshold(size_t suspects);
+		// sets how many objects an automatic collection traverses
+		void set_cycle_budget(size_t objects);
+		const CycleStats& cycle_stats() const;
+
+		// deferred reference counting
+		// when enabled, references held by the execution stack are not counted:
+		// new objects start with a count of 0, and objects whose count drops to 0
+		// go into the zero count table instead of being freed
+		// may only be changed while the zero count table is empty
+		void set_deferred(bool enable);
+		bool deferred() const;
+		// returns val as a new reference for the caller,
+		// counted unless references from the stack are deferred
+		Value acquire(Value val);
+		// at a safe point, frees the objects in the zero count table that are not
+		// referenced from stack or from roots, then runs the cycle collector if due
+		void reconcile(const ExecStack& stack, const std::vector<Value>& roots = {});
+		size_t zero_count() const;
+
+		// constants
+		// literals and interned strings equal to them become constants of pool,
+		// which this manager keeps alive; must be set before any string is interned
+		void set_constants(std::shared_ptr<const ConstantPool> pool);
+		const ConstantPool* constants() const{ return constant_pool.get(); }
+
+		// heap images
+		// an image holds every live object at its index with its count, the intern
+		// table, the literal cache and a set of roots, such as the global scope
+		// of a program run up to some point, so another process can load it
+		// instead of running the program again; values are indices, so nothing
+		// needs relocating, and loading costs one pass over the file
+		// images are only valid for the same program, built the same way
+		// saves to path, returning false if it cannot be written
+		// pending frees are released first; the zero count table must be empty
+		bool save_image(const char* path, const Program& prog, const std::vector<Value>& roots);
+		// loads an image saved for prog into this manager, which must hold no objects
+		// and have the constants of prog if and only if the saving manager did
+		// roots receive the saved roots, whose references now belong to the caller
+		// returns false, leaving the manager empty, if the file is missing or does
+		// not hold a valid image for prog
+		bool load_image(const char* path, const Program& prog, std::vector<Value>& roots);
+
+		// memory statistics
+		// a shallow snapshot only reads counters, a deep one also visits every
+		// object to measure the memory it owns outside the pools
+		MemorySnapshot snapshot(bool deep = false);
+		// writes a snapshot as JSON to os every interval, checked on allocation
+		// a null os stops the dump
+		void set_stats_dump(std::ostream* os, std::chrono::milliseconds interval);
+
+		// allocation sites
+		// the interpreter sets the current site to the token it is evaluating,
+		// and one in every allocations is tagged with it; 0 disables tagging
+		// the tag is kept in the object's slot, so tagging costs no memory
+		void set_site_sampling(unsigned every);
+		void set_allocation_site(const Token& tok){ current_site = AllocSite{ tok.line, tok.column }; }
+		// site the object val was tagged with, or null if it was not sampled
+		const AllocSite* allocation_site(Value val) const;
+		// visits every live object to count them by type and by site, and to find
+		// the bytes each object retains: those of the objects it dominates, which
+		// are only reachable through it from the objects referenced from outside the heap
+		HeapDump heap_dump();
+
+	private:
+		// maps string hashes to indices of interned strings
+		std::unordered_multimap<size_t, int> interned;
+		// the interned string or constant with these characters, or null
+		Value find_interned(const char* str, size_t len, size_t hash);
+		// interned values of literals, indexed like Program::strings
+		// each cached literal holds one reference
+		std::vector<Value> literals;
+		// id of the program the cache holds literals of, 0 for none
+		unsigned long long literal_prog = 0;
+		std::shared_ptr<const ConstantPool> constant_pool;
+
+		// work lists of references held by freed objects
+		// freeing is iterative, so dropping a deep structure does not recurse
+		std::vector<Value> pending;
+		std::vector<std::vector<TableEntry>> dying;
+		size_t free_budget = 0;
+		bool releasing = false;
+
+		// objects that survived a deref and may be part of a garbage cycle
+		// objects are flagged in their pool while buffered, so each is listed once,
+		// though the slot of a freed suspect may be reused before its entry is taken
+		std::vector<Value> suspects;
+		size_t cycle_threshold = 10000;
+		size_t cycle_budget = 0;
+		size_t cycle_retry = 0;	// budget for retrying a suspect cut off by the last run
+		bool collecting = false;
+		CycleStats cycles{};
+
+		// objects with a count of 0 that may still be referenced from the stack
+		std::vector<Value> zct;
+		bool defer = false;
+		// values referenced from the stack while reconciling
+		const std::unordered_set<Value>* stack_roots = nullptr;
+
+		// periodic statistics dump
+		std::ostream* stats_out = nullptr;
+		std::chrono::milliseconds stats_interval;
+		MemorySnapshot stats_last;
+		unsigned stats_ticks = 0;
+
+		// allocation site tagging; site ids index sites, and 0 means untagged
+		unsigned site_every = 0;
+		unsigned site_countdown = 0;
+		AllocSite current_site{};
+		std::vector<AllocSite> sites;
+		std::unordered_map<long long, int> site_ids;
+
+		template<typename T>
+		MemPool<T, type_of<T>::value>& pool();
+		template<typename T, ValType V>
+		void drop(MemPool<T, V>& pool, int index);
+		void dump_stats();
+		void tag_site(Value val);
+		template<typename T, ValType V>
+		void suspect(MemPool<T, V>& pool, int index);
+		bool set_buffered(Value val, bool buffered);
+		void reclaim(Value val, const std::unordered_set<Value>& dead);
+		void release_string(int index);
+		void release(Value val);
+		// queues the references held by a freed object
+		void release_refs(UserClosure&& clos);
+		void release_refs(BuiltinClosure&& clos);
+		void release_refs(Continuation&& cont);
+		void release_refs(Table&& table);
+		bool read_image(const char* data, size_t bytes, const Program& prog, std::vector<Value>& roots);
+		void clear_heap();
 	};
 
 	// IMPLEMENTATION BEGINS HERE
 
+	template<> inline MemPool<String, ValType::String>& MemoryManager::pool<String>(){ return strings; }
+	template<> inline MemPool<UserClosure, ValType::UserClosure>& MemoryManager::pool<UserClosure>(){ return userClosures; }
+	template<> inline MemPool<BuiltinClosure, ValType::BuiltinClosure>& MemoryManager::pool<BuiltinClosure>(){ return builtinClosures; }
+	template<> inline MemPool<Table, ValType::Table>& MemoryManager::pool<Table>(){ return tables; }
+	template<> inline MemPool<Continuation, ValType::Continuation>& MemoryManager::pool<Continuation>(){ return continuations; }
+
+	template<typename T>
+	T& MemoryManager::get(Value val){
+		return pool<T>()[val];
+	}
+
+	template<typename T>
+	Handle<T> MemoryManager::create(){
+		if (free_budget != 0 && (!pending.empty() || !dying.empty()))
+			release_pending(free_budget);
+		// with deferred counting, collection waits for a safe point where the stack is known
+		if (!defer && cycle_threshold != 0 && suspects.size() >= cycle_threshold)
+			collect_cycles(cycle_budget);
+		// a new object is referenced only by its creator, which is on the stack
+		Handle<T> h{ pool<T>().create(defer ? 0 : 1).index };
+		if (defer) zct.push_back(h.value());
+		if (site_every != 0 && --site_countdown == 0) tag_site(h.value());
+		if (stats_out != nullptr && ++stats_ticks % 1024 == 0) dump_stats();
+		return h;
+	}
+
+	template<typename T>
+	T& MemoryManager::get(Handle<T> h){
+		return pool<T>()[h.index];
+	}
+
+	template<typename T>
+	Handle<T> MemoryManager::ref(Handle<T> h){
+		pool<T>().ref(h.index);
+		return h;
+	}
+
+	template<typename T>
+	void MemoryManager::deref(Handle<T> h){
+		drop(pool<T>(), h.index);
+	}
+
+	// frees an object, queueing the references it held for release
+	template<typename T>
+	void MemoryManager::free(Handle<T> h){
+		release_refs(pool<T>().take(h.index));
+		if (free_budget == 0) release_pending();
+	}
+
+	// strings hold no references, but may have to leave the intern table
+	template<>
+	inline void MemoryManager::free(Handle<String> h){
+		release_string(h.index);
+	}
+
+	// drops a counted reference to a live object in pool
+	// the last reference frees the object, which queues its own references,
+	// or with deferred counting moves it to the zero count table
 	template<typename T, ValType V>
-	Value MemPool<T, V>::create(){
-		if (freed.empty()){
-			items.push_back(T{});
-			refs.push_back(1);
-			return Value{ V, items.size() - 1 };
+	void MemoryManager::drop(MemPool<T, V>& pool, int index){
+		if (pool.count(index) != 1){
+			pool.decrement(index);
+			// only containers can be part of a cycle
+			if (V != ValType::String) suspect(pool, index);
+		}
+		else if (defer){
+			pool.decrement(index);
+			zct.push_back(make_value(V, index));
+		}
+		else free(Handle<T>{ index });
+	}
+
+	// remembers an object that survived a deref
+	// an object already buffered is not listed again, so repeated decrements
+	// of one object count once toward the threshold
+	template<typename T, ValType V>
+	void MemoryManager::suspect(MemPool<T, V>& pool, int index){
+		if (!collecting && !pool.set_buffered(index, true)) suspects.push_back(make_value(V, index));
+	}
+
+	inline void MemoryManager::release(Value val){
+		if (val.type >= ValType::String) pending.push_back(val);
+	}
+
+	template<typename F>
+	void MemoryManager::each_ref(Value val, F f){
+		switch (val.type){
+		case ValType::UserClosure: for_each_ref(userClosures[val], f); break;
+		case ValType::BuiltinClosure: for_each_ref(builtinClosures[val], f); break;
+		case ValType::Continuation: for_each_ref(continuations[val], f); break;
+		case ValType::Table: for_each_ref(tables[val], f); break;
+		default: break;
+		}
+	}
+
+	template<typename T, ValType V>
+	MemPool<T, V>::MemPool(){}
+
+	template<typename T, ValType V>
+	MemPool<T, V>::~MemPool(){
+		clear();
+	}
+
+	// returns the slot for index, or null if its page was released
+	template<typename T, ValType V>
+	typename MemPool<T, V>::Slot* MemPool<T, V>::slot(int index) const{
+		size_t page = index >> PageBits;
+		if (index < 0 || page >= pages.size() || pages[page] == nullptr) return nullptr;
+		return &pages[page]->slots[index & (PageSize - 1)];
+	}
+
+	template<typename T, ValType V>
+	typename MemPool<T, V>::Slot& MemPool<T, V>::live_slot(int index) const{
+		Slot* s = slot(index);
+		if (s == nullptr || s->refs == Freed)
+			throw InternalError{ "Internal Error: attempted to access freed object" };
+		return *s;
+	}
+
+	// the slot for a live object, found without branches unless checked
+	template<typename T, ValType V>
+	typename MemPool<T, V>::Slot& MemPool<T, V>::at(int index) const{
+#ifdef EMILY_CHECKED
+		return live_slot(index);
+#else
+		return pages[index >> PageBits]->slots[index & (PageSize - 1)];
+#endif
+	}
+
+	// allocates a page with every slot free, returns its index
+	template<typename T, ValType V>
+	int MemPool<T, V>::new_page(){
+		Page* page = new (allocate_page(sizeof(Page))) Page;
+		page->live = 0;
+		page->free = 0;
+		page->touched = 0;
+		page->listed = true;
+		std::fill(std::begin(page->buffered), std::end(page->buffered), 0u);
+		for (int i = 0; i < PageSize; ++i){
+			page->slots[i].refs = Freed;
+			page->slots[i].next = i + 1 < PageSize ? i + 1 : -1;
+		}
+		int idx;
+		if (released.empty()){
+			idx = pages.size();
+			pages.push_back(page);
 		}
 		else{
-			refs[freed.top()] = 1;
-			int idx = freed.top();
-			freed.pop();
-			return Value{ V, idx };
+			idx = released.back();
+			released.pop_back();
+			pages[idx] = page;
+		}
+		open.push_back(idx);
+		++spare;
+		++page_count;
+		return idx;
+	}
+
+	template<typename T, ValType V>
+	Value MemPool<T, V>::create(int count){
+		// drop pages that filled up or were released since they were listed
+		while (!open.empty() && (pages[open.back()] == nullptr || pages[open.back()]->free == -1)){
+			if (pages[open.back()] != nullptr) pages[open.back()]->listed = false;
+			open.pop_back();
 		}
+		int idx = open.empty() ? new_page() : open.back();
+		Page& page = *pages[idx];
+		int s = page.free;
+		Slot& slot = page.slots[s];
+		page.free = slot.next;
+		if (page.live++ == 0) --spare;
+		new (&slot.storage) T();
+		slot.refs = count;
+		slot.site = 0;
+#ifndef EMILY_NO_MEMORY_STATS
+		// fresh slots are handed out in ascending order after any freed ones
+		if (s < page.touched) ++reused;
+		else page.touched = s + 1;
+		if (++allocs - frees > peak) peak = allocs - frees;
+#endif
+		return make_value(V, (idx << PageBits) | s);
 	}
 
 	template<typename T, ValType V>
 	void MemPool<T, V>::ref(int index){
-		if (refs[index] > 0) ++refs[index];
-		else throw std::exception{ "Internal Error: attempted to reference freed object" };
+		++at(index).refs;
 	}
 
 	template<typename T, ValType V>
 	void MemPool<T, V>::ref(Value val){
 		if (val.type != V)
-			throw std::exception{ "Internal Error: attempted to reference object of incorrect type" };
-		ref(val.index);
+			throw InternalError{ "Internal Error: attempted to reference object of incorrect type" };
+		Slot* s = slot(val.index);
+		if (s != nullptr && s->refs != Freed) ++s->refs;
+		else throw InternalError{ "Internal Error: attempted to reference freed object" };
 	}
 
 	template<typename T, ValType V>
 	int MemPool<T, V>::refcount(int index) const{
-		return refs[index];
+		Slot* s = slot(index);
+		return s == nullptr ? Freed : s->refs;
+	}
+
+	template<typename T, ValType V>
+	int MemPool<T, V>::count(int index) const{
+		return at(index).refs;
+	}
+
+	template<typename T, ValType V>
+	void MemPool<T, V>::check(Value val) const{
+		if (val.type != V)
+			throw InternalError{ "Internal Error: attempted to access object of incorrect type" };
+		live_slot(val.index);
 	}
 
 	template<typename T, ValType V>
 	int MemPool<T, V>::refcount(Value val) const{
 		if (val.type != V)
-			throw std::exception{ "Internal Error: attempted to get refcount of object of incorrect type" };
+			throw InternalError{ "Internal Error: attempted to get refcount of object of incorrect type" };
 		return refcount(val.index);
 	}
 
 	template<typename T, ValType V>
 	void MemPool<T, V>::deref(int index){
-		if (refs[index] > 1) --refs[index];
-		else if (refs[index] == 1) free(index);
-		else throw std::exception{ "Internal Error: attempted to dereference freed object" };
+		Slot& s = at(index);
+#ifdef EMILY_CHECKED
+		if (s.refs < 1)
+			throw InternalError{ "Internal Error: attempted to dereference object with no references" };
+#endif
+		if (--s.refs == 0) free(index);
 	}
 
 	template<typename T, ValType V>
 	void MemPool<T, V>::deref(Value val){
 		if (val.type != V)
-			throw std::exception{ "Internal Error: attempted to dereference object of incorrect type" };
+			throw InternalError{ "Internal Error: attempted to dereference object of incorrect type" };
+		if (live_slot(val.index).refs < 1)
+			throw InternalError{ "Internal Error: attempted to dereference object with no references" };
 		deref(val.index);
 	}
 
+	template<typename T, ValType V>
+	void MemPool<T, V>::decrement(int index){
+		Slot& s = at(index);
+#ifdef EMILY_CHECKED
+		if (s.refs < 1)
+			throw InternalError{ "Internal Error: attempted to dereference object with no references" };
+#endif
+		--s.refs;
+	}
+
+	template<typename T, ValType V>
+	void MemPool<T, V>::decrement(Value val){
+		if (val.type != V)
+			throw InternalError{ "Internal Error: attempted to dereference object of incorrect type" };
+		if (live_slot(val.index).refs < 1)
+			throw InternalError{ "Internal Error: attempted to dereference object with no references" };
+		decrement(val.index);
+	}
+
 	template<typename T, ValType V>
 	void MemPool<T, V>::free(int index){
-		if (refs[index] < 1)
-			throw std::exception{ "Internal Error: attempted to free already freed object" };
-		items[index] = T{};
-		refs[index] = 0;
-		freed.push(index);
+#ifdef EMILY_CHECKED
+		Slot* s = slot(index);
+		if (s == nullptr || s->refs == Freed)
+			throw InternalError{ "Internal Error: attempted to free already freed object" };
+#else
+		Slot* s = &at(index);
+#endif
+		int idx = index >> PageBits;
+		Page& page = *pages[idx];
+		s->item().~T();
+		s->refs = Freed;
+		page.buffered[(index & (PageSize - 1)) >> 5] &= ~(1u << (index & 31));
+#ifndef EMILY_NO_MEMORY_STATS
+		++frees;
+#endif
+		s->next = page.free;
+		page.free = index & (PageSize - 1);
+		if (!page.listed){
+			page.listed = true;
+			open.push_back(idx);
+		}
+		if (--page.live == 0){
+			if (spare < SparePages) ++spare;
+			else{
+				// the open list skips released pages lazily
+				release_page(pages[idx], sizeof(Page));
+				pages[idx] = nullptr;
+				released.push_back(idx);
+				--page_count;
+			}
+		}
+	}
+
+	template<typename T, ValType V>
+	T MemPool<T, V>::take(int index){
+		T item{ std::move(at(index).item()) };
+		free(index);
+		return item;
+	}
+
+	template<typename T, ValType V>
+	T MemPool<T, V>::take(Value val){
+		if (val.type != V)
+			throw InternalError{ "Internal Error: attempted to free object of incorrect type" };
+		live_slot(val.index);
+		return take(val.index);
 	}
 
 	template<typename T, ValType V>
 	void MemPool<T, V>::free(Value val){
 		if (val.type != V)
-			throw std::exception{ "Internal Error: attempted to free object of incorrect type" };
+			throw InternalError{ "Internal Error: attempted to free object of incorrect type" };
+		Slot* s = slot(val.index);
+		if (s == nullptr || s->refs == Freed)
+			throw InternalError{ "Internal Error: attempted to free already freed object" };
 		free(val.index);
 	}
 
 	template<typename T, ValType V>
 	T& MemPool<T, V>::operator[](int index){
-		if (refs[index] > 0) return items[index];
-		else throw std::exception{ "Internal Error: attempted to access freed object" };
+		return at(index).item();
+	}
+
+	template<typename T, ValType V>
+	int MemPool<T, V>::site(int index) const{
+		return at(index).site;
+	}
+
+	template<typename T, ValType V>
+	void MemPool<T, V>::set_site(int index, int site){
+		at(index).site = site;
+	}
+
+	template<typename T, ValType V>
+	bool MemPool<T, V>::set_buffered(int index, bool buffered){
+		at(index);
+		unsigned& word = pages[index >> PageBits]->buffered[(index & (PageSize - 1)) >> 5];
+		unsigned bit = 1u << (index & 31);
+		bool was = (word & bit) != 0;
+		if (buffered) word |= bit;
+		else word &= ~bit;
+		return was;
 	}
 
 	template<typename T, ValType V>
 	T& MemPool<T, V>::operator[](Value val){
 		if (val.type != V)
-			throw std::exception{ "Internal Error: attempted to access object of incorrect type" };
-		return operator[](val.index);
+			throw InternalError{ "Internal Error: attempted to access object of incorrect type" };
+		return live_slot(val.index).item();
+	}
+
+	template<typename T, ValType V>
+	template<typename F>
+	void MemPool<T, V>::each(F f){
+		for (size_t p = 0; p < pages.size(); ++p){
+			if (pages[p] == nullptr || pages[p]->live == 0) continue;
+			for (int i = 0; i < PageSize; ++i){
+				if (pages[p]->slots[i].refs != Freed) f(make_value(V, (p << PageBits) | i));
+			}
+		}
+	}
+
+	template<typename T, ValType V>
+	T* MemPool<T, V>::place(int index, int count, int site){
+		if (index < 0) return nullptr;
+		size_t p = index >> PageBits;
+		int s = index & (PageSize - 1);
+		if (p >= pages.size()) pages.resize(p + 1, nullptr);
+		if (pages[p] == nullptr){
+			Page* page = new (allocate_page(sizeof(Page))) Page;
+			page->live = 0;
+			page->free = -1;
+			page->touched = 0;
+			page->listed = false;
+			std::fill(std::begin(page->buffered), std::end(page->buffered), 0u);
+			for (auto& slot : page->slots) slot.refs = Freed;
+			pages[p] = page;
+			++page_count;
+		}
+		Page& page = *pages[p];
+		Slot& slot = page.slots[s];
+		if (slot.refs != Freed) return nullptr;
+		new (&slot.storage) T();
+		slot.refs = count;
+		slot.site = site;
+		++page.live;
+		if (s >= page.touched) page.touched = s + 1;
+#ifndef EMILY_NO_MEMORY_STATS
+		if (++allocs - frees > peak) peak = allocs - frees;
+#endif
+		return &slot.item();
+	}
+
+	template<typename T, ValType V>
+	void MemPool<T, V>::relink(){
+		open.clear();
+		released.clear();
+		spare = 0;
+		for (size_t p = 0; p < pages.size(); ++p){
+			Page* page = pages[p];
+			if (page == nullptr){
+				released.push_back(p);
+				continue;
+			}
+			// free slots are handed out in ascending order, as in a new page
+			page->free = -1;
+			for (int i = PageSize - 1; i >= 0; --i){
+				if (page->slots[i].refs != Freed) continue;
+				page->slots[i].next = page->free;
+				page->free = i;
+			}
+			page->listed = page->free != -1;
+			if (page->listed) open.push_back(p);
+			if (page->live == 0) ++spare;
+		}
+	}
+
+	template<typename T, ValType V>
+	void MemPool<T, V>::clear(){
+		for (auto page : pages){
+			if (page == nullptr) continue;
+			for (auto& slot : page->slots){
+				if (slot.refs != Freed) slot.item().~T();
+			}
+			release_page(page, sizeof(Page));
+		}
+		pages.clear();
+		open.clear();
+		released.clear();
+		spare = 0;
+		page_count = 0;
+#ifndef EMILY_NO_MEMORY_STATS
+		allocs = frees = reused = peak = 0;
+#endif
+	}
+
+	template<typename T, ValType V>
+	PoolStats MemPool<T, V>::stats() const{
+		PoolStats st{};
+		for (auto page : pages){
+			if (page != nullptr) st.live += page->live;
+		}
+		st.pages = page_count;
+		st.bytes = page_count * sizeof(Page);
+		st.free_slots = page_count * PageSize - st.live;
+#ifndef EMILY_NO_MEMORY_STATS
+		st.peak = peak;
+		st.allocs = allocs;
+		st.frees = frees;
+		st.reused = reused;
+#endif
+		return st;
 	}
 
 }
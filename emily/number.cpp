@@ -0,0 +1,424 @@
+// number.cpp
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "number.h"
+#include "number_tables.h"
+
+namespace emily{
+
+	namespace{
+		// powers of ten that are exact as doubles
+		const double exact_powers[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		const int MaxExactPower = 22;
+		const unsigned long long MaxExactInteger = 1ULL << 53;
+		// digits that always fit in the mantissa accumulator
+		const int MaxDigits = 19;
+
+		int digit_value(char c){
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			return 99;
+		}
+
+		// digits the slow path keeps; midpoints between doubles have at most 767
+		// significant digits, so a nonzero digit standing for the rest rounds the same
+		const int MaxSlowDigits = 800;
+
+		// the conversion of the standard library, which is correctly rounded
+		// the digits are copied to a stack buffer as an integer and exponent, which
+		// has no decimal point and so reads the same in every locale
+		double parse_slow(const char* begin, const char* end){
+			char buf[MaxSlowDigits + 32];
+			int len = 0;
+			long long exponent = 0;
+			bool truncated = false;
+			const char* p = begin;
+			for (; p != end && *p >= '0' && *p <= '9'; ++p){
+				if (len == 0 && *p == '0') continue;
+				if (len < MaxSlowDigits) buf[len++] = *p;
+				else{
+					++exponent;
+					truncated |= *p != '0';
+				}
+			}
+			if (p != end && *p == '.'){
+				for (++p; p != end && *p >= '0' && *p <= '9'; ++p){
+					if (len == 0 && *p == '0') --exponent;
+					else if (len < MaxSlowDigits){
+						buf[len++] = *p;
+						--exponent;
+					}
+					else truncated |= *p != '0';
+				}
+			}
+			if (len == 0) return 0;
+			if (truncated){
+				buf[len++] = '1';
+				--exponent;
+			}
+			if (p != end && (*p == 'e' || *p == 'E')){
+				++p;
+				bool negative = p != end && *p == '-';
+				if (p != end && (*p == '-' || *p == '+')) ++p;
+				long long e = 0;
+				for (; p != end && *p >= '0' && *p <= '9'; ++p){
+					if (e < 100000) e = e * 10 + (*p - '0');
+				}
+				exponent += negative ? -e : e;
+			}
+			buf[len++] = 'e';
+			format_integer(exponent, buf + len);
+			return std::strtod(buf, nullptr);
+		}
+
+	}
+
+	// Ryu, by Ulf Adams: of the decimals that read back as a double, finds one
+	// with the fewest digits, the nearest to it if there are several, using
+	// products with 128 bit approximations of powers of five in number_tables.h
+	namespace ryu{
+		namespace{
+
+			// a double as digits * 10^exponent
+			struct Decimal{
+				unsigned long long digits;
+				int exponent;
+			};
+
+			const int MantissaBits = 52;
+			const int ExponentBias = 1023;
+
+			// ceil(log2(5^e)), or 1 when e is 0
+			int pow5bits(int e){
+				return (int)(((unsigned)e * 1217359) >> 19) + 1;
+			}
+
+			// floor(log10(2^e))
+			int log10_pow2(int e){
+				return (int)(((unsigned)e * 78913) >> 18);
+			}
+
+			// floor(log10(5^e))
+			int log10_pow5(int e){
+				return (int)(((unsigned)e * 732923) >> 20);
+			}
+
+			bool multiple_of_pow5(unsigned long long value, int p){
+				int count = 0;
+				while (value % 5 == 0){
+					value /= 5;
+					++count;
+				}
+				return count >= p;
+			}
+
+			bool multiple_of_pow2(unsigned long long value, int p){
+				return (value & ((1ULL << p) - 1)) == 0;
+			}
+
+			// the high word of a * b, with the low word in low
+			unsigned long long multiply(unsigned long long a, unsigned long long b, unsigned long long& low){
+				unsigned long long a_lo = a & 0xffffffff, a_hi = a >> 32;
+				unsigned long long b_lo = b & 0xffffffff, b_hi = b >> 32;
+				unsigned long long lo_lo = a_lo * b_lo;
+				unsigned long long hi_lo = a_hi * b_lo;
+				unsigned long long lo_hi = a_lo * b_hi;
+				unsigned long long hi_hi = a_hi * b_hi;
+				unsigned long long middle = hi_lo + (lo_lo >> 32) + (lo_hi & 0xffffffff);
+				low = (middle << 32) | (lo_lo & 0xffffffff);
+				return hi_hi + (middle >> 32) + (lo_hi >> 32);
+			}
+
+			// (m * mul) >> shift, for m of at most 55 bits and shift between 64 and 128
+			unsigned long long multiply_shift(unsigned long long m, const unsigned long long* mul, int shift){
+				unsigned long long low0, low1;
+				unsigned long long high0 = multiply(m, mul[0], low0);
+				unsigned long long high1 = multiply(m, mul[1], low1);
+				unsigned long long sum = high0 + low1;
+				if (sum < high0) ++high1;
+				shift -= 64;
+				return (high1 << (64 - shift)) | (sum >> shift);
+			}
+
+			Decimal shortest(unsigned long long mantissa, int biased_exponent){
+				// num is m2 * 2^e2, with two more bits for the bounds of its interval
+				int e2;
+				unsigned long long m2;
+				if (biased_exponent == 0){
+					e2 = 1 - ExponentBias - MantissaBits - 2;
+					m2 = mantissa;
+				}
+				else{
+					e2 = biased_exponent - ExponentBias - MantissaBits - 2;
+					m2 = (1ULL << MantissaBits) | mantissa;
+				}
+				// round to even, so the bounds themselves read back as num when m2 is even
+				bool accept_bounds = (m2 & 1) == 0;
+				unsigned long long mv = 4 * m2;
+				// the lower bound is closer when num is a power of two above the subnormals
+				int mm_shift = mantissa != 0 || biased_exponent <= 1 ? 1 : 0;
+
+				// num, its upper bound and its lower bound in a power of ten, as vr, vp and vm
+				unsigned long long vr, vp, vm;
+				int e10;
+				bool vm_trailing_zeros = false;
+				bool vr_trailing_zeros = false;
+				if (e2 >= 0){
+					int q = log10_pow2(e2) - (e2 > 3 ? 1 : 0);
+					e10 = q;
+					int k = Pow5InvBitCount + pow5bits(q) - 1;
+					int i = -e2 + q + k;
+					vr = multiply_shift(4 * m2, pow5_inv_split[q], i);
+					vp = multiply_shift(4 * m2 + 2, pow5_inv_split[q], i);
+					vm = multiply_shift(4 * m2 - 1 - mm_shift, pow5_inv_split[q], i);
+					// only one of the three can be a multiple of 5, if any
+					if (q <= 21){
+						if (mv % 5 == 0) vr_trailing_zeros = multiple_of_pow5(mv, q);
+						else if (accept_bounds) vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+						else if (multiple_of_pow5(mv + 2, q)) --vp;
+					}
+				}
+				else{
+					int q = log10_pow5(-e2) - (-e2 > 1 ? 1 : 0);
+					e10 = q + e2;
+					int i = -e2 - q;
+					int k = pow5bits(i) - Pow5BitCount;
+					int j = q - k;
+					vr = multiply_shift(4 * m2, pow5_split[i], j);
+					vp = multiply_shift(4 * m2 + 2, pow5_split[i], j);
+					vm = multiply_shift(4 * m2 - 1 - mm_shift, pow5_split[i], j);
+					if (q <= 1){
+						// mv has at least two trailing zero bits, so vr is exact
+						vr_trailing_zeros = true;
+						if (accept_bounds) vm_trailing_zeros = mm_shift == 1;
+						else --vp;
+					}
+					else if (q < 63){
+						vr_trailing_zeros = multiple_of_pow2(mv, q);
+					}
+				}
+
+				// drop digits while the bounds still differ, rounding vr by the last one dropped
+				int removed = 0;
+				int last_removed = 0;
+				unsigned long long output;
+				if (vm_trailing_zeros || vr_trailing_zeros){
+					// exact bounds and exact halves need the digits dropped to be tracked
+					while (vp / 10 > vm / 10){
+						vm_trailing_zeros &= vm % 10 == 0;
+						vr_trailing_zeros &= last_removed == 0;
+						last_removed = (int)(vr % 10);
+						vr /= 10;
+						vp /= 10;
+						vm /= 10;
+						++removed;
+					}
+					if (vm_trailing_zeros){
+						while (vm % 10 == 0){
+							vr_trailing_zeros &= last_removed == 0;
+							last_removed = (int)(vr % 10);
+							vr /= 10;
+							vp /= 10;
+							vm /= 10;
+							++removed;
+						}
+					}
+					// exactly half way rounds to even
+					if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) last_removed = 4;
+					bool up = (vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5;
+					output = vr + (up ? 1 : 0);
+				}
+				else{
+					while (vp / 10 > vm / 10){
+						last_removed = (int)(vr % 10);
+						vr /= 10;
+						vp /= 10;
+						vm /= 10;
+						++removed;
+					}
+					output = vr + (vr == vm || last_removed >= 5 ? 1 : 0);
+				}
+				Decimal result = { output, e10 + removed };
+				return result;
+			}
+
+		}
+	}
+
+	bool parse_int64(const char* begin, const char* end, int base, long long& out){
+		if (begin == end) return false;
+		unsigned long long acc = 0;
+		for (const char* p = begin; p != end; ++p){
+			int d = digit_value(*p);
+			if (d >= base) return false;
+			if (acc > (9223372036854775807ULL - d) / base) return false;
+			acc = acc * base + d;
+		}
+		out = (long long)acc;
+		return true;
+	}
+
+	int format_integer(long long num, char* buf){
+		char digits[24];
+		int len = 0;
+		unsigned long long u = num < 0 ? 0ULL - (unsigned long long)num : (unsigned long long)num;
+		do{
+			digits[len++] = '0' + u % 10;
+			u /= 10;
+		} while (u != 0);
+		int out = 0;
+		if (num < 0) buf[out++] = '-';
+		while (len > 0) buf[out++] = digits[--len];
+		buf[out] = '\0';
+		return out;
+	}
+
+	double parse_integer(const char* begin, const char* end, int base){
+		unsigned long long acc = 0;
+		const char* p = begin;
+		for (; p != end; ++p){
+			int d = digit_value(*p);
+			if (d >= base) return (double)acc;
+			if (acc > (~0ULL - d) / base) break;
+			acc = acc * base + d;
+		}
+		// past 64 bits, carry on in floating point
+		double num = (double)acc;
+		for (; p != end; ++p){
+			int d = digit_value(*p);
+			if (d >= base) break;
+			num = num * base + d;
+		}
+		return num;
+	}
+
+	// Clinger's fast path: a mantissa of at most 53 bits scaled by an exact power
+	// of ten is one correctly rounded multiplication or division
+	double parse_decimal(const char* begin, const char* end){
+		unsigned long long mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+		bool truncated = false;
+		const char* p = begin;
+		for (; p != end && *p >= '0' && *p <= '9'; ++p){
+			if (digits < MaxDigits){
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0) ++digits;
+			}
+			else{
+				++exponent;
+				truncated |= *p != '0';
+			}
+		}
+		if (p != end && *p == '.'){
+			for (++p; p != end && *p >= '0' && *p <= '9'; ++p){
+				if (digits < MaxDigits){
+					mantissa = mantissa * 10 + (*p - '0');
+					if (mantissa != 0) ++digits;
+					--exponent;
+				}
+				else truncated |= *p != '0';
+			}
+		}
+		if (p != end && (*p == 'e' || *p == 'E')){
+			++p;
+			bool negative = p != end && *p == '-';
+			if (p != end && (*p == '-' || *p == '+')) ++p;
+			int e = 0;
+			for (; p != end && *p >= '0' && *p <= '9'; ++p){
+				if (e < 100000) e = e * 10 + (*p - '0');
+			}
+			exponent += negative ? -e : e;
+		}
+		if (mantissa == 0 && !truncated) return 0;
+		if (!truncated && mantissa <= MaxExactInteger){
+			if (exponent >= 0 && exponent <= MaxExactPower) return mantissa * exact_powers[exponent];
+			if (exponent < 0 && exponent >= -MaxExactPower) return mantissa / exact_powers[-exponent];
+		}
+		return parse_slow(begin, p);
+	}
+
+	// the digits come from ryu::shortest and are laid out as %g would with the
+	// fewest of 15, 16 or 17 digits of precision that reads back as num
+	int format_number(double num, char* buf){
+		if (num != num){
+			std::strcpy(buf, "nan");
+			return 3;
+		}
+		if (std::isinf(num)){
+			std::strcpy(buf, num < 0 ? "-inf" : "inf");
+			return num < 0 ? 4 : 3;
+		}
+		if (num == std::floor(num) && std::fabs(num) < 1e16){
+			if (num == 0 && std::signbit(num)){
+				std::strcpy(buf, "-0");
+				return 2;
+			}
+			return format_integer((long long)num, buf);
+		}
+
+		unsigned long long bits;
+		std::memcpy(&bits, &num, sizeof bits);
+		ryu::Decimal dec = ryu::shortest(bits & ((1ULL << ryu::MantissaBits) - 1),
+			(int)((bits >> ryu::MantissaBits) & 0x7ff));
+		// rounding up can leave zeros at the end, which %g would not write
+		while (dec.digits % 10 == 0){
+			dec.digits /= 10;
+			++dec.exponent;
+		}
+		char digits[24];
+		int count = 0;
+		for (unsigned long long d = dec.digits; d != 0; d /= 10) digits[count++] = '0' + d % 10;
+		// the exponent of the first digit in scientific notation
+		int point = dec.exponent + count - 1;
+		int precision = count > 15 ? count : 15;
+
+		int len = 0;
+		if (num < 0) buf[len++] = '-';
+		if (point < -4 || point >= precision){
+			buf[len++] = digits[--count];
+			if (count > 0){
+				buf[len++] = '.';
+				while (count > 0) buf[len++] = digits[--count];
+			}
+			buf[len++] = 'e';
+			buf[len++] = point < 0 ? '-' : '+';
+			int magnitude = point < 0 ? -point : point;
+			if (magnitude >= 100) buf[len++] = '0' + magnitude / 100;
+			buf[len++] = '0' + magnitude / 10 % 10;
+			buf[len++] = '0' + magnitude % 10;
+		}
+		else if (point < 0){
+			buf[len++] = '0';
+			buf[len++] = '.';
+			for (int i = point + 1; i < 0; ++i) buf[len++] = '0';
+			while (count > 0) buf[len++] = digits[--count];
+		}
+		else{
+			for (int i = 0; i <= point; ++i) buf[len++] = count > 0 ? digits[--count] : '0';
+			if (count > 0){
+				buf[len++] = '.';
+				while (count > 0) buf[len++] = digits[--count];
+			}
+		}
+		buf[len] = '\0';
+		return len;
+	}
+
+	std::string format_number(double num){
+		char buf[NumberBufferSize];
+		return std::string(buf, format_number(num, buf));
+	}
+
+	std::string format_integer(long long num){
+		char buf[NumberBufferSize];
+		return std::string(buf, format_integer(num, buf));
+	}
+
+}
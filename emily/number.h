@@ -0,0 +1,40 @@
+// number.h
+
+#ifndef __NUMBER_H__
+#define __NUMBER_H__
+
+#include <string>
+
+namespace emily{
+
+	// numeric literals and number formatting, independent of the C locale
+
+	// parses digits in base 2, 8 or 16, without a prefix
+	// exact up to 2^53; beyond that, exact up to 2^64 and then approximate
+	double parse_integer(const char* begin, const char* end, int base);
+
+	// parses digits in base 2, 8, 10 or 16, without a prefix, into out
+	// returns false, leaving out alone, if they are empty, hold another character
+	// or do not fit in a long long
+	bool parse_int64(const char* begin, const char* end, int base, long long& out);
+
+	// parses digits with an optional fraction and exponent, as in 12, .5, 3. or 1.5e-3
+	// most literals take a fast exact path; long or extreme ones fall back to a
+	// correctly rounded conversion that is slower
+	double parse_decimal(const char* begin, const char* end);
+
+	// enough for any number format_number writes, with its terminating null
+	const int NumberBufferSize = 32;
+
+	// writes the shortest decimal that reads back as num, returning its length
+	// integers below 1e16 have no fraction or exponent, so 3 is written as 3
+	int format_number(double num, char* buf);
+	std::string format_number(double num);
+
+	// writes the digits of num, with a minus sign if it is negative, returning their length
+	int format_integer(long long num, char* buf);
+	std::string format_integer(long long num);
+
+}
+
+#endif
@@ -0,0 +1,204 @@
+// output.cpp
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "number.h"
+#include "output.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace emily{
+
+	Output::Output(int fd, size_t capacity, FlushPolicy policy)
+		: fd{ fd }, buffer(capacity), capacity{ capacity }, used{ 0 }, calls{ 0 }, err{ 0 }{
+#ifdef _WIN32
+		terminal = _isatty(fd) != 0;
+#else
+		terminal = isatty(fd) != 0;
+#endif
+		set_policy(policy);
+	}
+
+	Output::~Output(){
+		flush();
+	}
+
+	void Output::write(const char* data, size_t len){
+		if (len <= buffer.size() - used){
+			std::memcpy(buffer.data() + used, data, len);
+			used += len;
+		}
+		else if (err != 0){
+			keep(data, len);
+		}
+		else{
+			write_out(data, len);
+		}
+		if (line && used != 0 && std::memchr(data, '\n', len) != nullptr)
+			flush();
+	}
+
+	void Output::write(const std::string& str){
+		write(str.data(), str.size());
+	}
+
+	void Output::put(char c){
+		// a full buffer is sent together with c, as write does
+		if (used == buffer.size()){
+			if (err == 0) write_out(&c, 1);
+			return;
+		}
+		buffer[used++] = c;
+		if (line && c == '\n')
+			flush();
+	}
+
+	bool Output::flush(){
+		if (used != 0 && err == 0) write_out(nullptr, 0);
+		return used == 0;
+	}
+
+	size_t Output::pending() const{
+		return used;
+	}
+
+	void Output::set_capacity(size_t capacity){
+		flush();
+		this->capacity = capacity;
+		// bytes a failed write left behind are kept
+		buffer.resize(capacity > used ? capacity : used);
+	}
+
+	void Output::set_policy(FlushPolicy policy){
+		line = policy == FlushPolicy::Line || (policy == FlushPolicy::Auto && terminal);
+	}
+
+	bool Output::is_terminal() const{
+		return terminal;
+	}
+
+	size_t Output::syscalls() const{
+		return calls;
+	}
+
+	int Output::error() const{
+		return err;
+	}
+
+	void Output::clear_error(){
+		err = 0;
+	}
+
+	// writes the buffered bytes followed by data, emptying the buffer
+	// if a write fails, whatever was not written stays buffered
+	void Output::write_out(const char* data, size_t len){
+		const char* parts[2] = { buffer.data(), data };
+		size_t sizes[2] = { used, len };
+		int first = 0;
+		for (;;){
+			while (first < 2 && sizes[first] == 0) ++first;
+			if (first == 2) break;
+			++calls;
+#ifdef _WIN32
+			long long n = _write(fd, parts[first], (unsigned)sizes[first]);
+#else
+			iovec iov[2];
+			int count = 0;
+			for (int i = first; i < 2; ++i){
+				iov[count].iov_base = (void*)parts[i];
+				iov[count].iov_len = sizes[i];
+				++count;
+			}
+			long long n = writev(fd, iov, count);
+#endif
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0){
+				// a write of nothing would only repeat, so it counts as an error
+				err = n < 0 ? errno : EIO;
+				// the unwritten buffered bytes move to the front, then the rest of data follows
+				size_t kept = first == 0 ? sizes[0] : 0;
+				if (kept != 0) std::memmove(buffer.data(), parts[0], kept);
+				used = kept;
+				keep(parts[1], sizes[1]);
+				return;
+			}
+			// a partial write continues where it stopped
+			for (; first < 2 && (size_t)n >= sizes[first]; ++first)
+				n -= sizes[first];
+			if (first < 2){
+				parts[first] += n;
+				sizes[first] -= n;
+			}
+		}
+		used = 0;
+		// a buffer set_capacity left larger, to keep bytes, returns to its capacity
+		if (buffer.size() > capacity){
+			buffer.resize(capacity);
+			buffer.shrink_to_fit();
+		}
+	}
+
+	// appends bytes that could not be written to the buffer, dropping what does not fit
+	void Output::keep(const char* data, size_t len){
+		if (len > buffer.size() - used) len = buffer.size() - used;
+		if (len == 0) return;
+		std::memcpy(buffer.data() + used, data, len);
+		used += len;
+	}
+
+	Output& standard_output(){
+		// destroyed, and so flushed, when the program exits normally
+		static Output out{ 1 };
+		return out;
+	}
+
+	void print(Output& out, MemoryManager& mm, const Program& prog, Value val){
+		char buf[NumberBufferSize];
+		switch (val.type){
+		case ValType::Null: out.write("null", 4); break;
+		case ValType::True: out.write("true", 4); break;
+		case ValType::Number:
+			out.write(buf, format_number(val.number, buf));
+			break;
+		case ValType::Integer:
+			out.write(buf, format_integer(val.integer, buf));
+			break;
+		case ValType::Atom: out.write(prog.word(val.index)); break;
+		case ValType::BuiltinFunction:
+			out.write("<builtin ", 9);
+			out.write(keyword_name(val.index), std::strlen(keyword_name(val.index)));
+			out.put('>');
+			break;
+		case ValType::String:{
+			const String& str = mm.string(val);
+			out.write(str.data(), str.length);
+			break;
+		}
+		default:
+			out.put('<');
+			out.write(type_name(val.type), std::strlen(type_name(val.type)));
+			out.put('>');
+			break;
+		}
+	}
+
+	void println(Output& out, MemoryManager& mm, const Program& prog, Value val){
+		print(out, mm, prog, val);
+		out.put('\n');
+	}
+
+	void ln(Output& out){
+		out.put('\n');
+	}
+
+	void sp(Output& out){
+		out.put(' ');
+	}
+
+}
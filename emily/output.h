@@ -0,0 +1,82 @@
+// output.h
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <string>
+#include <vector>
+#include "memory.h"
+
+namespace emily{
+
+	enum class FlushPolicy{
+		Full,		// only when the buffer is full, on flush and on destruction
+		Line,		// also after every write containing a newline
+		Auto		// Line if the descriptor is a terminal, otherwise Full
+	};
+
+	/**	Output class
+	 *	buffered writer to a file descriptor, so printing a character at a time
+	 *	costs a copy instead of a system call
+	 *	a write that does not fit is sent together with the buffered bytes in one
+	 *	writev call where available, instead of flushing and then writing
+	 *	interrupted writes are retried; a write that fails otherwise is recorded,
+	 *	and the bytes it did not write stay buffered, up to the capacity, with any
+	 *	more dropped; nothing more is written until clear_error, so output to a
+	 *	closed pipe costs neither memory nor a system call per character
+	 */
+	class Output{
+	public:
+		explicit Output(int fd = 1, size_t capacity = 1 << 16, FlushPolicy policy = FlushPolicy::Auto);
+		// flushes anything still buffered
+		~Output();
+
+		void write(const char* data, size_t len);
+		void write(const std::string& str);
+		void put(char c);
+		// returns false if bytes are still buffered because a write failed
+		bool flush();
+		// bytes buffered and not yet written
+		size_t pending() const;
+
+		// flushes, then uses a buffer of capacity bytes; 0 writes through
+		void set_capacity(size_t capacity);
+		void set_policy(FlushPolicy policy);
+		bool is_terminal() const;
+		// system calls made so far, for measuring
+		size_t syscalls() const;
+		// errno of the last write that failed, 0 if none has since clear_error
+		int error() const;
+		// lets the buffered bytes be written again, after the error was dealt with
+		void clear_error();
+
+	private:
+		int fd;
+		std::vector<char> buffer;
+		size_t capacity;	// size of the buffer, unless set_capacity shrank it below used
+		size_t used;
+		bool line;
+		bool terminal;
+		size_t calls;
+		int err;
+
+		void write_out(const char* data, size_t len);
+		void keep(const char* data, size_t len);
+
+		Output(const Output&);
+		Output& operator=(const Output&);
+	};
+
+	// buffered standard output, flushed when the program exits
+	Output& standard_output();
+
+	// print builtins: print writes a value, println a value and a newline,
+	// ln a newline and sp a space
+	void print(Output& out, MemoryManager& mm, const Program& prog, Value val);
+	void println(Output& out, MemoryManager& mm, const Program& prog, Value val);
+	void ln(Output& out);
+	void sp(Output& out);
+
+}
+
+#endif
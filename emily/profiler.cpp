@@ -0,0 +1,216 @@
+// profiler.cpp
+
+#include <algorithm>
+#include <cstdio>
+#include "profiler.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+namespace emily{
+
+	volatile std::sig_atomic_t profile_signal = 0;
+
+	namespace{
+#ifndef _WIN32
+		void on_profile_timer(int){
+			profile_signal = 1;
+		}
+
+		// restarts interrupted system calls, so output is not cut short by the timer
+		void set_handler(void(*handler)(int)){
+			struct sigaction action;
+			action.sa_handler = handler;
+			sigemptyset(&action.sa_mask);
+			action.sa_flags = SA_RESTART;
+			sigaction(SIGPROF, &action, nullptr);
+		}
+
+		void set_timer(long long interval_us){
+			itimerval timer;
+			timer.it_interval.tv_sec = (time_t)(interval_us / 1000000);
+			timer.it_interval.tv_usec = (suseconds_t)(interval_us % 1000000);
+			timer.it_value = timer.it_interval;
+			setitimer(ITIMER_PROF, &timer, nullptr);
+		}
+#endif
+
+		bool is_assignment(const Token& tok){
+			return tok.type == Tok::Atom && (tok.index == Kw::Let || tok.index == Kw::Set);
+		}
+	}
+
+	Profiler::Profiler(const Program& prog)
+		: prog(prog), sample_count{ 0 }, ticks{ 0 }, countdown{ 0 }, interval_us{ 0 }, timer_running{ false }{
+		find_functions();
+	}
+
+	Profiler::~Profiler(){
+		stop();
+	}
+
+	// names each closure after the word it is assigned to, as in
+	// .let name ^@(...) or target .let .name ^@(...), then gives every group
+	// the closure it belongs to by walking down from the top level
+	// operands of branch tokens run in place, so they belong to the enclosing closure
+	void Profiler::find_functions(){
+		group_function.assign(prog.groups.size(), 0);
+		names[0] = "main";
+		std::vector<int> todo{ 0 };
+		auto enter = [&](const Token& tok, int g, std::string name){
+			int child;
+			if (tok.type == Tok::Group) child = tok.index;
+			else if (tok.type == Tok::Closure) child = prog.closures[tok.index].group_idx;
+			else return;
+			if (child <= 0 || child >= (int)prog.groups.size()) return;
+
+			if (tok.type == Tok::Group){
+				group_function[child] = group_function[g];
+			}
+			else{
+				group_function[child] = child;
+				if (name.empty()) name = "closure@" + std::to_string(tok.line);
+				names[child] = name;
+			}
+			todo.push_back(child);
+		};
+		while (!todo.empty()){
+			int g = todo.back();
+			todo.pop_back();
+			for (const auto& line : prog.groups[g]){
+				for (auto tk = line.begin(); tk != line.end(); ++tk){
+					if (tk->type == Tok::Branch){
+						const BranchInfo& br = prog.branches[tk->index];
+						for (const auto& operand : br.operands) enter(operand, g, "");
+						continue;
+					}
+					std::string name;
+					if (tk->type == Tok::Closure && tk != line.begin()){
+						auto key = std::prev(tk);
+						if ((key->type == Tok::Word || key->type == Tok::Atom) && key != line.begin()
+							&& is_assignment(*std::prev(key)))
+							name = prog.word(key->index);
+					}
+					enter(*tk, g, name);
+				}
+			}
+		}
+	}
+
+	bool Profiler::start_timer(std::chrono::microseconds interval){
+#ifdef _WIN32
+		(void)interval;
+		return false;
+#else
+		stop();
+		interval_us = std::max<long long>(interval.count(), 1);
+		set_handler(on_profile_timer);
+		set_timer(interval_us);
+		timer_running = true;
+		return true;
+#endif
+	}
+
+	void Profiler::start_ticks(unsigned n){
+		ticks = countdown = n;
+	}
+
+	void Profiler::stop(){
+#ifndef _WIN32
+		if (timer_running){
+			set_timer(0);
+			set_handler(SIG_DFL);
+			timer_running = false;
+		}
+#endif
+		ticks = countdown = 0;
+		profile_signal = 0;
+	}
+
+	const std::string& Profiler::function_name(int group) const{
+		int fn = group >= 0 && group < (int)group_function.size() ? group_function[group] : 0;
+		return names.at(fn);
+	}
+
+	// line of the token frame is at, or of the last token of its line if it reached the end
+	int Profiler::source_line(const StackFrame& frame) const{
+		if (frame.group < 0 || frame.group >= (int)prog.groups.size()) return 0;
+		const Group& group = prog.groups[frame.group];
+		if (frame.line < 0 || frame.line >= (int)group.size()) return 0;
+		const Line& line = group[frame.line];
+		if (line.empty()) return 0;
+		return frame.pos == line.end() ? line.back().line : frame.pos->line;
+	}
+
+	void Profiler::sample(const ExecStack& stack){
+		profile_signal = 0;
+		countdown = ticks;
+		++sample_count;
+
+		// frames in nested groups of one closure are one frame of the folded stack
+		std::string folded = "main";
+		int function = 0;
+		std::vector<int> seen;
+		for (const auto& frame : stack){
+			int fn = frame.group >= 0 && frame.group < (int)group_function.size() ? group_function[frame.group] : 0;
+			if (fn != function){
+				folded += ';';
+				folded += names.at(fn);
+				function = fn;
+			}
+			int ln = source_line(frame);
+			if (ln > 0 && std::find(seen.begin(), seen.end(), ln) == seen.end()){
+				seen.push_back(ln);
+				++lines[ln].total;
+			}
+		}
+		++stacks[folded];
+		if (!stack.empty()){
+			int ln = source_line(stack.back());
+			if (ln > 0) ++lines[ln].self;
+		}
+	}
+
+	void Profiler::write_folded(std::ostream& os) const{
+		std::vector<std::pair<std::string, size_t>> sorted{ stacks.begin(), stacks.end() };
+		std::sort(sorted.begin(), sorted.end());
+		for (const auto& s : sorted)
+			os << s.first << ' ' << s.second << '\n';
+	}
+
+	void Profiler::write_lines(std::ostream& os, const std::string* source) const{
+		std::vector<std::pair<int, LineSamples>> sorted{ lines.begin(), lines.end() };
+		std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<int, LineSamples>& a, const std::pair<int, LineSamples>& b){
+			return a.second.total > b.second.total;
+		});
+		std::vector<std::string> text;
+		if (source){
+			size_t start = 0;
+			for (;;){
+				size_t end = source->find('\n', start);
+				text.push_back(source->substr(start, end == std::string::npos ? std::string::npos : end - start));
+				if (end == std::string::npos) break;
+				start = end + 1;
+			}
+		}
+		double scale = sample_count ? 100.0 / sample_count : 0;
+		char buf[128];
+		std::sprintf(buf, "%6s %8s %7s %8s %7s%s\n", "line", "self", "self%", "total", "total%",
+			interval_us ? "   self ms  total ms" : "");
+		os << buf;
+		for (const auto& l : sorted){
+			std::sprintf(buf, "%6d %8llu %6.2f%% %8llu %6.2f%%", l.first, (unsigned long long)l.second.self,
+				l.second.self * scale, (unsigned long long)l.second.total, l.second.total * scale);
+			os << buf;
+			if (interval_us){
+				std::sprintf(buf, " %9.1f %9.1f", l.second.self * interval_us / 1000.0, l.second.total * interval_us / 1000.0);
+				os << buf;
+			}
+			if (l.first - 1 < (int)text.size()) os << "  " << text[l.first - 1];
+			os << '\n';
+		}
+	}
+
+}
@@ -0,0 +1,89 @@
+// profiler.h
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <chrono>
+#include <csignal>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "tokenize.h"
+#include "values.h"
+
+namespace emily{
+
+	// set by the profiling timer's signal handler, cleared when a sample is taken
+	extern volatile std::sig_atomic_t profile_signal;
+
+	// samples in which a source line was running, and in which it was anywhere on the stack
+	struct LineSamples{
+		size_t self;
+		size_t total;
+	};
+
+	/**	Sampling profiler
+	 *	the interpreter calls poll with its stack at each dispatch step, and a
+	 *	sample is taken when the timer has fired or every ticks calls to poll,
+	 *	so the stack is only read by the thread running it
+	 *	the timer is SIGPROF, which counts cpu time of the whole process; where it
+	 *	is unavailable, as on Windows, use ticks instead
+	 *	each frame is mapped back to the source line it is running and to the
+	 *	closure it belongs to, named after the word it is assigned to, or
+	 *	closure@line for anonymous closures; the top level is main
+	 *	prog is the program after macros, the one the stack refers into
+	 */
+	class Profiler{
+	public:
+		explicit Profiler(const Program& prog);
+		// stops the timer if it is running
+		~Profiler();
+
+		Profiler(const Profiler&) = delete;
+		Profiler& operator=(const Profiler&) = delete;
+
+		// samples every interval of cpu time, returns false if timers are unavailable
+		// only one profiler in a process may use the timer at a time
+		bool start_timer(std::chrono::microseconds interval);
+		// samples every ticks calls to poll
+		void start_ticks(unsigned ticks);
+		void stop();
+
+		void poll(const ExecStack& stack){
+			if (profile_signal || (ticks && --countdown == 0)) sample(stack);
+		}
+		// records stack now
+		void sample(const ExecStack& stack);
+
+		size_t samples() const{ return sample_count; }
+		// closure running in group, by the naming above
+		const std::string& function_name(int group) const;
+
+		// writes one line per distinct stack, outermost closure first, as
+		// "main;outer;inner count", the folded format read by flame graph tools
+		void write_folded(std::ostream& os) const;
+		// writes a table of self and total samples per source line, most total first
+		// with the source, also writes the text of each line
+		void write_lines(std::ostream& os, const std::string* source = nullptr) const;
+
+	private:
+		const Program& prog;
+		std::vector<int> group_function;	// for each group, its closure's group, or 0 for the top level
+		std::unordered_map<int, std::string> names;	// closure group to name
+		std::unordered_map<std::string, size_t> stacks;
+		std::map<int, LineSamples> lines;
+		size_t sample_count;
+		unsigned ticks;
+		unsigned countdown;
+		long long interval_us;	// sampling interval of the timer, 0 if sampling by ticks
+		bool timer_running;
+
+		void find_functions();
+		int source_line(const StackFrame& frame) const;
+	};
+
+}
+
+#endif
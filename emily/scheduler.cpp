@@ -0,0 +1,211 @@
+// scheduler.cpp
+
+#include "scheduler.h"
+
+namespace emily{
+
+	Scheduler::Scheduler(MemoryManager& mm, Resume resume)
+		: mm(mm), resume_fn{ resume }, running{ -1 }, live{ 0 }{}
+
+	Scheduler::~Scheduler(){
+		for (auto& task : tasks){
+			discard(task.cont);
+			discard(task.resume);
+			discard(task.result);
+		}
+		for (auto& ch : channels){
+			for (auto val : ch.items) discard(val);
+		}
+	}
+
+	int Scheduler::spawn(Value cont){
+		int id;
+		if (free_tasks.empty()){
+			id = tasks.size();
+			tasks.push_back(Task{});
+		}
+		else{
+			id = free_tasks.back();
+			free_tasks.pop_back();
+		}
+		Task& task = tasks[id];
+		task.result = Value{ ValType::Null };
+		task.joiner = -1;
+		task.detached = false;
+		++live;
+		make_ready(id, cont, Value{ ValType::Null });
+		return id;
+	}
+
+	int Scheduler::current() const{
+		return running;
+	}
+
+	void Scheduler::yield(Value cont){
+		if (running < 0)
+			throw InternalError{ "Internal Error: yield outside of a task" };
+		int id = running;
+		running = -1;
+		make_ready(id, cont, Value{ ValType::Null });
+	}
+
+	bool Scheduler::join(int task, Value cont, Value& result){
+		if (running < 0)
+			throw InternalError{ "Internal Error: join outside of a task" };
+		if (task < 0 || task >= (int)tasks.size() || tasks[task].state == TaskState::Dead
+			|| tasks[task].detached || tasks[task].joiner >= 0 || task == running)
+			throw InternalError{ "Internal Error: attempted to join a task that cannot be joined" };
+		Task& target = tasks[task];
+		if (target.state == TaskState::Finished){
+			result = target.result;
+			target.result = Value{ ValType::Null };
+			reuse(task);
+			return true;
+		}
+		target.joiner = running;
+		block(cont);
+		return false;
+	}
+
+	void Scheduler::detach(int task){
+		if (task < 0 || task >= (int)tasks.size() || tasks[task].state == TaskState::Dead
+			|| tasks[task].joiner >= 0)
+			throw InternalError{ "Internal Error: attempted to detach a task that cannot be detached" };
+		if (tasks[task].state == TaskState::Finished){
+			discard(tasks[task].result);
+			reuse(task);
+		}
+		else tasks[task].detached = true;
+	}
+
+	void Scheduler::finish(Value result){
+		if (running < 0)
+			throw InternalError{ "Internal Error: finish outside of a task" };
+		int id = running;
+		running = -1;
+		Task& task = tasks[id];
+		task.state = TaskState::Finished;
+		--live;
+		if (task.joiner >= 0){
+			// the result goes straight to the joiner, which is the only task that may see it
+			int joiner = task.joiner;
+			reuse(id);
+			Task& waiting = tasks[joiner];
+			Value cont = waiting.cont;
+			waiting.cont = Value{ ValType::Null };
+			make_ready(joiner, cont, result);
+		}
+		else if (task.detached){
+			discard(result);
+			reuse(id);
+		}
+		else task.result = result;
+	}
+
+	int Scheduler::channel(){
+		channels.push_back(TaskChannel{});
+		return channels.size() - 1;
+	}
+
+	void Scheduler::send(int ch, Value val){
+		TaskChannel& channel = channels.at(ch);
+		if (channel.receivers.empty()){
+			channel.items.push_back(val);
+			return;
+		}
+		int id = channel.receivers.front();
+		channel.receivers.pop_front();
+		Value cont = tasks[id].cont;
+		tasks[id].cont = Value{ ValType::Null };
+		make_ready(id, cont, val);
+	}
+
+	bool Scheduler::receive(int ch, Value cont, Value& val){
+		if (running < 0)
+			throw InternalError{ "Internal Error: receive outside of a task" };
+		TaskChannel& channel = channels.at(ch);
+		if (!channel.items.empty()){
+			val = channel.items.front();
+			channel.items.pop_front();
+			return true;
+		}
+		channel.receivers.push_back(running);
+		block(cont);
+		return false;
+	}
+
+	size_t Scheduler::run(){
+		while (!ready.empty()){
+			int id = ready.front();
+			ready.pop_front();
+			Task& task = tasks[id];
+			Value cont = task.cont;
+			Value resume = task.resume;
+			task.cont = Value{ ValType::Null };
+			task.resume = Value{ ValType::Null };
+			task.state = TaskState::Running;
+			running = id;
+			// tasks may grow while the task runs, so task is not used after this
+			resume_fn(*this, id, cont, resume);
+			if (running >= 0){
+				running = -1;
+				throw InternalError{ "Internal Error: task returned without yielding, blocking or finishing" };
+			}
+		}
+		return live;
+	}
+
+	size_t Scheduler::live_tasks() const{
+		return live;
+	}
+
+	size_t Scheduler::ready_tasks() const{
+		return ready.size();
+	}
+
+	std::vector<Value> Scheduler::roots() const{
+		std::vector<Value> out;
+		for (const auto& task : tasks){
+			if (task.cont.type >= ValType::String) out.push_back(task.cont);
+			if (task.resume.type >= ValType::String) out.push_back(task.resume);
+			if (task.result.type >= ValType::String) out.push_back(task.result);
+		}
+		for (const auto& ch : channels){
+			for (auto val : ch.items)
+				if (val.type >= ValType::String) out.push_back(val);
+		}
+		return out;
+	}
+
+	void Scheduler::make_ready(int task, Value cont, Value resume){
+		Task& t = tasks[task];
+		t.cont = cont;
+		t.resume = resume;
+		t.state = TaskState::Ready;
+		ready.push_back(task);
+	}
+
+	// saves the current task's continuation until something wakes it
+	void Scheduler::block(Value cont){
+		Task& task = tasks[running];
+		task.cont = cont;
+		task.state = TaskState::Blocked;
+		running = -1;
+	}
+
+	// drops a reference the scheduler held
+	// with deferred counting, held values are roots rather than counted references
+	void Scheduler::discard(Value val){
+		if (!mm.deferred()) mm.deref(val);
+	}
+
+	void Scheduler::reuse(int task){
+		Task& t = tasks[task];
+		t.state = TaskState::Dead;
+		t.result = Value{ ValType::Null };
+		t.joiner = -1;
+		t.detached = false;
+		free_tasks.push_back(task);
+	}
+
+}
@@ -0,0 +1,118 @@
+// scheduler.h
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include "memory.h"
+
+namespace emily{
+
+	enum class TaskState{
+		Ready,
+		Running,
+		Blocked,
+		Finished,
+		Dead
+	};
+
+	/**	Task
+	 *	a green thread: a continuation waiting to be resumed with a value
+	 *	a task holds no native stack, so thousands of them fit in one thread
+	 */
+	struct Task{
+		Value cont;		// where the task resumes, null unless ready or blocked
+		Value resume;	// value the continuation is resumed with
+		Value result;	// return value once finished
+		TaskState state;
+		int joiner;		// task waiting in join, or -1
+		bool detached;
+	};
+
+	// unbounded queue of values between tasks of one scheduler
+	struct TaskChannel{
+		std::deque<Value> items;
+		std::deque<int> receivers;	// blocked tasks, in the order they arrived
+	};
+
+	/**	Scheduler class
+	 *	runs tasks cooperatively on the thread that calls run, one at a time
+	 *	the resume callback is the interpreter: it continues a task's continuation
+	 *	with a value until the task calls back into yield, join, receive or finish,
+	 *	each of which saves or ends the task and returns, so a task switch costs
+	 *	one return and one call rather than a native context switch
+	 *	this is the C++ side only: an interpreter would expose the methods to
+	 *	programs as builtins of the same names, called for the current task, but
+	 *	this tree has none, so no such keywords or builtins exist yet
+	 *	all values passed in are references the scheduler takes over, and all
+	 *	values passed out are references given to the receiver
+	 *	a scheduler belongs to one memory manager, so it runs on one thread;
+	 *	use one scheduler per isolate to spread tasks across cores
+	 */
+	class Scheduler{
+	public:
+		typedef std::function<void(Scheduler& sched, int task, Value cont, Value resume)> Resume;
+
+		Scheduler(MemoryManager& mm, Resume resume);
+		// releases the references held by tasks and channels
+		~Scheduler();
+
+		// creates a ready task that will resume cont with null, returns its id
+		int spawn(Value cont);
+		// task currently running, -1 outside of run
+		int current() const;
+
+		// the current task goes to the back of the ready queue, to resume cont with null
+		void yield(Value cont);
+		// if task has finished, stores its result in result and returns true;
+		// otherwise the current task blocks until it finishes, then resumes cont with the result
+		// a task may be joined only once, after which its id may be reused
+		// like receive, cont is only taken over if the task blocks
+		bool join(int task, Value cont, Value& result);
+		// lets a task's id be reused once it finishes, discarding its result
+		void detach(int task);
+		// ends the current task with result
+		void finish(Value result);
+
+		// creates a channel, returns its id
+		int channel();
+		// queues val, or hands it to the first task blocked on ch
+		void send(int ch, Value val);
+		// if ch has a value, stores it in val and returns true;
+		// otherwise the current task blocks until a value is sent, then resumes cont with it
+		// cont is only taken over if the task blocks, so a task that did not block keeps running
+		bool receive(int ch, Value cont, Value& val);
+
+		// resumes ready tasks until there are none
+		// returns the number of tasks still blocked, which are deadlocked
+		size_t run();
+
+		size_t live_tasks() const;
+		size_t ready_tasks() const;
+		// values held by tasks and channels, for MemoryManager::reconcile
+		std::vector<Value> roots() const;
+
+	private:
+		MemoryManager& mm;
+		Resume resume_fn;
+		std::vector<Task> tasks;
+		std::vector<int> free_tasks;
+		std::deque<int> ready;
+		std::vector<TaskChannel> channels;
+		int running;
+		size_t live;
+
+		void make_ready(int task, Value cont, Value resume);
+		void block(Value cont);
+		void discard(Value val);
+		void reuse(int task);
+
+		Scheduler(const Scheduler&);
+		Scheduler& operator=(const Scheduler&);
+	};
+
+}
+
+#endif
@@ -0,0 +1,100 @@
+// stats.cpp
+
+#include "memory.h"
+
+namespace emily{
+
+	namespace{
+		long long now_ns(){
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// events per second between two counter readings
+		double rate(size_t now, size_t before, double seconds){
+			return seconds > 0 ? (now - before) / seconds : 0;
+		}
+	}
+
+	MemorySnapshot MemoryManager::snapshot(bool deep){
+		MemorySnapshot snap{};
+		snap.time = now_ns();
+		snap.pools[(int)ValType::String] = strings.stats();
+		snap.pools[(int)ValType::UserClosure] = userClosures.stats();
+		snap.pools[(int)ValType::BuiltinClosure] = builtinClosures.stats();
+		snap.pools[(int)ValType::Table] = tables.stats();
+		snap.pools[(int)ValType::Continuation] = continuations.stats();
+		if (deep){
+			auto measure = [&](Value val){
+				snap.pools[(int)val.type].heap_bytes += footprint(val);
+			};
+			strings.each(measure);
+			userClosures.each(measure);
+			builtinClosures.each(measure);
+			tables.each(measure);
+			continuations.each(measure);
+			// footprint includes the object itself, which is counted in its page
+			snap.pools[(int)ValType::String].heap_bytes -= snap.pools[(int)ValType::String].live * sizeof(String);
+			snap.pools[(int)ValType::UserClosure].heap_bytes -= snap.pools[(int)ValType::UserClosure].live * sizeof(UserClosure);
+			snap.pools[(int)ValType::BuiltinClosure].heap_bytes -= snap.pools[(int)ValType::BuiltinClosure].live * sizeof(BuiltinClosure);
+			snap.pools[(int)ValType::Table].heap_bytes -= snap.pools[(int)ValType::Table].live * sizeof(Table);
+			snap.pools[(int)ValType::Continuation].heap_bytes -= snap.pools[(int)ValType::Continuation].live * sizeof(Continuation);
+		}
+		snap.pending = pending_frees();
+		snap.zero_count = zct.size();
+		snap.suspects = suspects.size();
+		snap.cycles = cycles;
+		return snap;
+	}
+
+	void MemoryManager::set_stats_dump(std::ostream* os, std::chrono::milliseconds interval){
+		stats_out = os;
+		stats_interval = interval;
+		stats_ticks = 0;
+		if (os != nullptr) stats_last = snapshot();
+	}
+
+	// writes a snapshot if the dump interval has passed
+	void MemoryManager::dump_stats(){
+		MemorySnapshot snap = snapshot();
+		if (snap.time - stats_last.time < std::chrono::duration_cast<std::chrono::nanoseconds>(stats_interval).count())
+			return;
+		write_json(*stats_out, snap, &stats_last);
+		stats_last = snap;
+	}
+
+	void write_json(std::ostream& os, const MemorySnapshot& snap, const MemorySnapshot* previous){
+		double seconds = previous ? (snap.time - previous->time) / 1e9 : 0;
+		os << "{\"time\":" << snap.time << ",\"pools\":{";
+		bool first = true;
+		for (int t = (int)ValType::String; t < ValTypeCount; ++t){
+			const PoolStats& st = snap.pools[t];
+			os << (first ? "" : ",") << '"' << type_name((ValType)t) << "\":{"
+				<< "\"live\":" << st.live
+				<< ",\"peak\":" << st.peak
+				<< ",\"allocs\":" << st.allocs
+				<< ",\"frees\":" << st.frees
+				<< ",\"reused\":" << st.reused
+				<< ",\"reuse_ratio\":" << (st.allocs ? (double)st.reused / st.allocs : 0)
+				<< ",\"free_slots\":" << st.free_slots
+				<< ",\"pages\":" << st.pages
+				<< ",\"bytes\":" << st.bytes
+				<< ",\"heap_bytes\":" << st.heap_bytes;
+			if (previous){
+				os << ",\"alloc_rate\":" << rate(st.allocs, previous->pools[t].allocs, seconds)
+					<< ",\"free_rate\":" << rate(st.frees, previous->pools[t].frees, seconds);
+			}
+			os << '}';
+			first = false;
+		}
+		os << "},\"pending\":" << snap.pending
+			<< ",\"zero_count\":" << snap.zero_count
+			<< ",\"suspects\":" << snap.suspects
+			<< ",\"cycles\":{\"collections\":" << snap.cycles.collections
+			<< ",\"found\":" << snap.cycles.cycles
+			<< ",\"objects\":" << snap.cycles.objects
+			<< ",\"bytes\":" << snap.cycles.bytes << "}}\n";
+		os.flush();
+	}
+
+}
@@ -0,0 +1,172 @@
+// strings.cpp
+
+#include <algorithm>
+#include "memory.h"
+
+namespace emily{
+
+	// never returns 0, which marks a hash that has not been computed
+	size_t hash_chars(const char* str, size_t len){
+		unsigned long long h = 14695981039346656037ULL;
+		for (size_t i = 0; i < len; ++i){
+			h ^= (unsigned char)str[i];
+			h *= 1099511628211ULL;
+		}
+		size_t result = (size_t)(h ^ (h >> 32));
+		return result == 0 ? 1 : result;
+	}
+
+	Value MemoryManager::create_string(std::string str){
+		Handle<String> h = create<String>();
+		String& s = get(h);
+		s.length = str.size();
+		s.offset = 0;
+		s.hash = 0;
+		s.interned = false;
+		s.buffer = std::make_shared<std::string>(std::move(str));
+		return h.value();
+	}
+
+	const String& MemoryManager::string(Value val){
+		if (is_constant(val)) return constant_pool->string(val);
+		return strings[val];
+	}
+
+	Value MemoryManager::find_interned(const char* str, size_t len, size_t h){
+		if (constant_pool){
+			Value found = constant_pool->find(str, len, h);
+			if (found.type == ValType::String) return found;
+		}
+		auto range = interned.equal_range(h);
+		for (auto it = range.first; it != range.second; ++it){
+			// the intern table only holds live strings
+			const String& s = strings[it->second];
+			if (s.length == len && std::equal(str, str + len, s.data()))
+				return make_value(ValType::String, it->second);
+		}
+		return Value{ ValType::Null };
+	}
+
+	Value MemoryManager::intern(const std::string& str){
+		size_t h = hash_chars(str.data(), str.size());
+		Value found = find_interned(str.data(), str.size(), h);
+		if (found.type == ValType::String) return acquire(found);
+		Value val = create_string(str);
+		String& s = strings[val.index];
+		s.hash = h;
+		s.interned = true;
+		interned.insert(std::make_pair(h, val.index));
+		return val;
+	}
+
+	Value MemoryManager::intern(Value str){
+		if (is_constant(str) || strings[str].interned) return acquire(str);
+		size_t h = hash(str);
+		String& s = strings[str];
+		Value found = find_interned(s.data(), s.length, h);
+		if (found.type == ValType::String) return acquire(found);
+		// no equal string is interned, so this one becomes the interned one
+		s.interned = true;
+		interned.insert(std::make_pair(h, str.index));
+		return acquire(str);
+	}
+
+	Value MemoryManager::literal(const Program& prog, int index){
+		if (constant_pool && constant_pool->serves(prog))
+			return constant_pool->literal(index);
+		// another program, even one at the same address, invalidates the cache
+		if (literal_prog != prog.id.value){
+			for (auto val : literals)
+				if (val.type == ValType::String) deref(val);
+			literals.assign(prog.strings.size(), Value{ ValType::Null });
+			literal_prog = prog.id.value;
+		}
+		// strings may have been added to the program since the cache was built
+		if (literals.size() < prog.strings.size())
+			literals.resize(prog.strings.size(), Value{ ValType::Null });
+		if (literals[index].type != ValType::String){
+			literals[index] = intern(prog.strings[index]);
+			// the cache holds a counted reference
+			if (defer) ref(literals[index]);
+		}
+		return acquire(literals[index]);
+	}
+
+	Value MemoryManager::concat(Value l, Value r){
+		// references, not copies: copying a constant would count references to its
+		// buffer, which every isolate shares, and pool pages never move, so both
+		// stay valid while the result is created
+		const String& left = string(l);
+		const String& right = string(r);
+		if (right.length == 0) return acquire(l);
+		// left ends at the end of its buffer: no other string has extended it,
+		// so the new string can share the buffer by appending to it
+		// constants are never extended, since other threads may be reading them
+		if (!is_constant(l) && left.buffer && left.offset + left.length == left.buffer->size()){
+			if (right.buffer == left.buffer)
+				left.buffer->append(right.str());
+			else
+				left.buffer->append(right.data(), right.length);
+			Handle<String> h = create<String>();
+			String& s = get(h);
+			s.buffer = left.buffer;
+			s.offset = left.offset;
+			s.length = left.length + right.length;
+			s.hash = 0;
+			s.interned = false;
+			return h.value();
+		}
+		std::string str;
+		str.reserve(left.length + right.length);
+		str.append(left.data(), left.length);
+		str.append(right.data(), right.length);
+		return create_string(std::move(str));
+	}
+
+	Value MemoryManager::substr(Value str, size_t pos, size_t len){
+		const String& parent = string(str);
+		if (pos > parent.length) pos = parent.length;
+		if (len > parent.length - pos) len = parent.length - pos;
+		if (pos == 0 && len == parent.length) return acquire(str);
+		if (is_constant(str)) return create_string(std::string{ parent.data() + pos, len });
+		Handle<String> h = create<String>();
+		String& s = get(h);
+		s.buffer = parent.buffer;
+		s.offset = parent.offset + pos;
+		s.length = len;
+		s.hash = 0;
+		s.interned = false;
+		return h.value();
+	}
+
+	size_t MemoryManager::hash(Value str){
+		// constants are hashed when their pool is built
+		if (is_constant(str)) return constant_pool->string(str).hash;
+		String& s = strings[str];
+		if (s.hash == 0)
+			s.hash = hash_chars(s.data(), s.length);
+		return s.hash;
+	}
+
+	void MemoryManager::set_constants(std::shared_ptr<const ConstantPool> pool){
+		if (!interned.empty() || !literals.empty())
+			throw InternalError{ "Internal Error: attempted to set constants after interning strings" };
+		constant_pool = std::move(pool);
+	}
+
+	// frees a string, removing it from the intern table if necessary
+	void MemoryManager::release_string(int index){
+		const String& s = strings[index];
+		if (s.interned){
+			auto range = interned.equal_range(s.hash);
+			for (auto it = range.first; it != range.second; ++it){
+				if (it->second == index){
+					interned.erase(it);
+					break;
+				}
+			}
+		}
+		strings.free(index);
+	}
+
+}
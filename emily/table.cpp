@@ -0,0 +1,252 @@
+// table.cpp
+
+#include "table.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EMILY_TABLE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace emily{
+
+	namespace{
+		const size_t GroupSize = 16;
+		const size_t npos = (size_t)-1;
+		const unsigned char Empty = 0x80;
+		const unsigned char Deleted = 0xFE;
+
+		// low 7 bits of the hash, stored in the control byte of a full slot
+		inline unsigned char h2(size_t hash){
+			return hash & 0x7F;
+		}
+
+		// high bits of the hash select the first group to probe
+		inline size_t h1(size_t hash){
+			return hash >> 7;
+		}
+
+		// bit i of the result is set if control byte i of the group equals b
+		inline unsigned match(const unsigned char* group, unsigned char b){
+#ifdef EMILY_TABLE_SSE2
+			__m128i g = _mm_loadu_si128((const __m128i*)group);
+			return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+#else
+			unsigned mask = 0;
+			for (unsigned i = 0; i < GroupSize; ++i)
+				if (group[i] == b) mask |= 1u << i;
+			return mask;
+#endif
+		}
+
+		// bit i of the result is set if slot i of the group is empty or deleted
+		inline unsigned match_free(const unsigned char* group){
+#ifdef EMILY_TABLE_SSE2
+			// full slots have the high bit clear
+			return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+			unsigned mask = 0;
+			for (unsigned i = 0; i < GroupSize; ++i)
+				if (group[i] & 0x80) mask |= 1u << i;
+			return mask;
+#endif
+		}
+
+		inline unsigned lowest_bit(unsigned mask){
+			unsigned i = 0;
+			while (!(mask & 1)){
+				mask >>= 1;
+				++i;
+			}
+			return i;
+		}
+	}
+
+	Table::iterator::iterator(Table* t, size_t p) : table{ t }, pos{ p }{}
+
+	TableEntry& Table::iterator::operator*() const{
+		return table->entries[pos];
+	}
+
+	TableEntry* Table::iterator::operator->() const{
+		return &table->entries[pos];
+	}
+
+	Table::iterator& Table::iterator::operator++(){
+		do ++pos;
+		while (pos < table->entries.size() && !table->alive[pos]);
+		return *this;
+	}
+
+	bool Table::iterator::operator==(const iterator& other) const{
+		return pos == other.pos;
+	}
+
+	bool Table::iterator::operator!=(const iterator& other) const{
+		return pos != other.pos;
+	}
+
+	Table::Table() : live{ 0 }, used{ 0 }{}
+
+	size_t Table::size() const{
+		return live;
+	}
+
+	bool Table::empty() const{
+		return live == 0;
+	}
+
+	Table::iterator Table::begin(){
+		size_t pos = 0;
+		while (pos < entries.size() && !alive[pos]) ++pos;
+		return iterator{ this, pos };
+	}
+
+	Table::iterator Table::end(){
+		return iterator{ this, entries.size() };
+	}
+
+	Table::iterator Table::find(Value key){
+		if (live == 0) return end();
+		size_t slot = find_slot(key, std::hash<Value>()(key));
+		return slot == npos ? end() : iterator{ this, (size_t)slots[slot] };
+	}
+
+	const TableEntry* Table::array_entry(size_t pos) const{
+		if (pos >= entries.size() || !alive[pos]) return nullptr;
+		const TableEntry& entry = entries[pos];
+		bool keyed = entry.first.type == ValType::Integer ? entry.first.integer == (long long)pos
+			: entry.first.type == ValType::Number && entry.first.number == (double)pos;
+		return keyed ? &entry : nullptr;
+	}
+
+	size_t Table::count(Value key) const{
+		if (live == 0) return 0;
+		return find_slot(key, std::hash<Value>()(key)) == npos ? 0 : 1;
+	}
+
+	Value& Table::operator[](Value key){
+		size_t hash = std::hash<Value>()(key);
+		size_t slot = live == 0 ? npos : find_slot(key, hash);
+		if (slot != npos) return entries[slots[slot]].second;
+		if ((used + 1) * 8 > ctrl.size() * 7)
+			rehash(live + 1);
+		entries.push_back(TableEntry{ key, Value{ ValType::Null } });
+		alive.push_back(1);
+		++live;
+		place(entries.size() - 1, hash);
+		return entries.back().second;
+	}
+
+	bool Table::insert(Value key, Value val){
+		size_t hash = std::hash<Value>()(key);
+		if (live != 0 && find_slot(key, hash) != npos) return false;
+		if ((used + 1) * 8 > ctrl.size() * 7)
+			rehash(live + 1);
+		entries.push_back(TableEntry{ key, val });
+		alive.push_back(1);
+		++live;
+		place(entries.size() - 1, hash);
+		return true;
+	}
+
+	size_t Table::erase(Value key){
+		if (live == 0) return 0;
+		size_t slot = find_slot(key, std::hash<Value>()(key));
+		if (slot == npos) return 0;
+		alive[slots[slot]] = 0;
+		entries[slots[slot]] = TableEntry{};
+		ctrl[slot] = Deleted;
+		--live;
+		// drop trailing erased entries so repeated removal from the end stays compact
+		while (!entries.empty() && !alive.back()){
+			entries.pop_back();
+			alive.pop_back();
+		}
+		return 1;
+	}
+
+	void Table::clear(){
+		entries.clear();
+		alive.clear();
+		ctrl.clear();
+		slots.clear();
+		live = 0;
+		used = 0;
+	}
+
+	void Table::reserve(size_t n){
+		if (n * 8 > ctrl.size() * 7)
+			rehash(n);
+		entries.reserve(n);
+		alive.reserve(n);
+	}
+
+	std::vector<TableEntry> Table::take_entries(){
+		std::vector<TableEntry> out{ std::move(entries) };
+		clear();
+		return out;
+	}
+
+	size_t Table::memory() const{
+		return entries.capacity() * sizeof(TableEntry) + alive.capacity()
+			+ ctrl.capacity() + slots.capacity() * sizeof(int);
+	}
+
+	// returns the slot holding key, or npos if key is not present
+	size_t Table::find_slot(Value key, size_t hash) const{
+		size_t groups = ctrl.size() / GroupSize;
+		size_t g = h1(hash) & (groups - 1);
+		unsigned char tag = h2(hash);
+		// triangular probing visits every group when the group count is a power of 2
+		for (size_t step = 1; step <= groups; ++step){
+			const unsigned char* group = &ctrl[g * GroupSize];
+			for (unsigned m = match(group, tag); m != 0; m &= m - 1){
+				size_t slot = g * GroupSize + lowest_bit(m);
+				if (entries[slots[slot]].first == key) return slot;
+			}
+			if (match(group, Empty) != 0) return npos;
+			g = (g + step) & (groups - 1);
+		}
+		return npos;
+	}
+
+	// puts entry into the first free slot on its probe sequence
+	void Table::place(int entry, size_t hash){
+		size_t groups = ctrl.size() / GroupSize;
+		size_t g = h1(hash) & (groups - 1);
+		for (size_t step = 1;; ++step){
+			unsigned m = match_free(&ctrl[g * GroupSize]);
+			if (m != 0){
+				size_t slot = g * GroupSize + lowest_bit(m);
+				if (ctrl[slot] == Empty) ++used;
+				ctrl[slot] = h2(hash);
+				slots[slot] = entry;
+				return;
+			}
+			g = (g + step) & (groups - 1);
+		}
+	}
+
+	// rebuilds the index with room for at least n entries
+	// also compacts erased entries and clears deleted slots
+	void Table::rehash(size_t n){
+		if (live != entries.size()){
+			size_t out = 0;
+			for (size_t i = 0; i < entries.size(); ++i){
+				if (alive[i]) entries[out++] = entries[i];
+			}
+			entries.resize(out);
+			alive.assign(out, 1);
+		}
+		size_t capacity = GroupSize;
+		while (n * 8 > capacity * 7) capacity *= 2;
+		// leave headroom so a table that is only filled does not rehash on every group
+		if (live * 8 > capacity * 7 / 2) capacity *= 2;
+		ctrl.assign(capacity, Empty);
+		slots.assign(capacity, -1);
+		used = 0;
+		for (size_t i = 0; i < entries.size(); ++i)
+			place(i, std::hash<Value>()(entries[i].first));
+	}
+
+}
@@ -0,0 +1,84 @@
+// table.h
+
+#ifndef __TABLE_H__
+#define __TABLE_H__
+
+#include <cstddef>
+#include <vector>
+#include "values.h"
+
+namespace emily{
+
+	struct TableEntry{
+		Value first;
+		Value second;
+	};
+
+	/**	Table class
+	 *	compact ordered hash map from values to values
+	 *	entries are stored densely in insertion order, so iteration is a linear scan
+	 *	and visits entries in the order they were first inserted
+	 *	the hash index is an open addressing table of one byte control codes
+	 *	and entry indices, probed a group of 16 slots at a time
+	 *	references to entries are invalidated by insertion, like std::vector
+	 */
+	class Table{
+	public:
+		class iterator{
+			friend class Table;
+			Table* table;
+			size_t pos;
+			iterator(Table* t, size_t p);
+
+		public:
+			TableEntry& operator*() const;
+			TableEntry* operator->() const;
+			iterator& operator++();
+			bool operator==(const iterator& other) const;
+			bool operator!=(const iterator& other) const;
+		};
+
+		Table();
+
+		size_t size() const;
+		bool empty() const;
+		iterator begin();
+		iterator end();
+
+		iterator find(Value key);
+		// the entry at position pos in insertion order if it is alive and keyed
+		// by the number pos, as each element of an array is, or null
+		// finds array elements without hashing
+		const TableEntry* array_entry(size_t pos) const;
+		size_t count(Value key) const;
+		// returns the value for key, inserting null if it is not present
+		Value& operator[](Value key);
+		// inserts key if it is not present, returns true if it was inserted
+		bool insert(Value key, Value val);
+		// removes key, returns the number of entries removed
+		size_t erase(Value key);
+		void clear();
+		// makes room for n entries without rehashing
+		void reserve(size_t n);
+		// empties the table, returning its entries in insertion order
+		// erased entries may be included as pairs of nulls
+		std::vector<TableEntry> take_entries();
+		// bytes of heap storage owned by the table
+		size_t memory() const;
+
+	private:
+		std::vector<TableEntry> entries;
+		std::vector<char> alive;
+		std::vector<unsigned char> ctrl;
+		std::vector<int> slots;
+		size_t live;		// entries not erased
+		size_t used;		// slots not empty, including deleted slots
+
+		size_t find_slot(Value key, size_t hash) const;
+		void rehash(size_t capacity);
+		void place(int entry, size_t hash);
+	};
+
+}
+
+#endif
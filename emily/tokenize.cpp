@@ -1,150 +1,251 @@
 // tokenize.cpp
 // Chris Bowers
 
+#include <atomic>
+#include "instrument.h"
+#include "number.h"
 #include "tokenize.h"
 
 namespace emily{
 
+	namespace{
+		// keywords as strings, built once for every program to share
+		std::vector<std::string> keyword_strings(){
+			std::vector<std::string> out;
+			for (int kw = 0; kw < Kw::Count; ++kw)
+				out.push_back(keyword_name(kw));
+			return out;
+		}
+
+		const std::vector<std::string> keyword_words = keyword_strings();
+
+		std::atomic<unsigned long long> program_ids{ 0 };
+	}
+
+	// ids start at 1, so 0 never names a program
+	ProgramId::ProgramId() : value{ ++program_ids }{}
+
 	// interns a string, returning its index
+	// keywords have fixed indices, so only user words are stored
 	int Program::intern(std::string str){
+		EMILY_COUNT(intern_calls);
+		int kw = find_keyword(str);
+		if (kw >= 0) return kw;
 		int i = std::find(words.begin(), words.end(), str) - words.begin();
-		if (i == words.size())
+		if (i == words.size()){
+			EMILY_COUNT(intern_misses);
 			words.push_back(str);
-		return i;
+		}
+		return Kw::Count + i;
+	}
+
+	const std::string& Program::word(int i) const{
+		return i < Kw::Count ? keyword_words[i] : words[i - Kw::Count];
 	}
 
 	// interns a symbol string, returning its index
 	// TODO: check for non-symbol strings?
 	int Program::sym(std::string str){
+		EMILY_COUNT(sym_calls);
 		int i = std::find(symbols.begin(), symbols.end(), str) - symbols.begin();
-		if (i == symbols.size())
+		if (i == symbols.size()){
+			EMILY_COUNT(sym_misses);
 			symbols.push_back(str);
+		}
 		return i;
 	}
 
-	/**
-	 *	Program tokenize(std::string)
-	 *	takes a string containing the program to be tokenized
-	 *	outputs a structure representing the program
-	 */
-	Program tokenize(std::string program){
-		using namespace std;
-		// set up program data structure
-		Program prog{};
-		prog.groups.push_back(Group{});
-		prog.groups.back().push_back(Line{});
-		prog.group_kinds.push_back('(');
-		// initialize with keywords
-		prog.words = keywords;
-		// set up stack to track current group
-		stack<Token> curr_group{};
-		curr_group.push(Token{ Tok::Group, 0, 0, 0 });
-		// track line and column number for debugging info
-		int line_number = 1;
-		int line_offset = 0;
-		regex em_rgx{ emily_regex };
-		// for each regex match, test the length of each submatch
-		// nonzero submatch length indicates the type of token matched
-		for (rgx_it rit{ program.begin(), program.end(), em_rgx }, rend{}; rit != rend; ++rit){
-			Token tok{ -1, -1, line_number, rit->position() - line_offset };
-			if ((*rit)[Tok::HexNumber].length() > 0){
-				tok.type = Tok::Number;
-				tok.index = prog.numbers.size();
-				prog.numbers.push_back(strtol(program.c_str() + rit->position(), nullptr, 16));
-				prog.groups[curr_group.top().index].back().push_back(tok);
-			}
-			else if ((*rit)[Tok::OctNumber].length() > 0){
-				tok.type = Tok::Number;
-				// skip over the 0o
-				tok.index = prog.numbers.size();
-				prog.numbers.push_back(strtol(program.c_str() + rit->position() + 2, nullptr, 8));
-				prog.groups[curr_group.top().index].back().push_back(tok);
-			}
-			else if ((*rit)[Tok::BinNumber].length() > 0){
-				tok.type = Tok::Number;
-				// skip over the 0b
-				tok.index = prog.numbers.size();
-				prog.numbers.push_back(strtol(program.c_str() + rit->position() + 2, nullptr, 2));
-				prog.groups[curr_group.top().index].back().push_back(tok);
+	namespace{
+		// a literal that is a whole number fitting in a long long becomes an Integer,
+		// any other, with a fraction, an exponent or too many digits, a Number
+		void push_literal(Program& prog, Token& tok, const char* begin, const char* end, int base){
+			long long integer;
+			if (parse_int64(begin, end, base, integer)){
+				tok.type = Tok::Integer;
+				tok.index = prog.integers.size();
+				prog.integers.push_back(integer);
 			}
-			else if ((*rit)[Tok::FloatNumber].length() > 0){
+			else{
 				tok.type = Tok::Number;
 				tok.index = prog.numbers.size();
-				prog.numbers.push_back(strtod(program.c_str() + rit->position(), nullptr));
-				prog.groups[curr_group.top().index].back().push_back(tok);
+				prog.numbers.push_back(base == 10 ? parse_decimal(begin, end) : parse_integer(begin, end, base));
 			}
-			else if ((*rit)[Tok::Word].length() > 0){
-				tok.type = Tok::Word;
-				tok.index = prog.intern(rit->str());
-				prog.groups[curr_group.top().index].back().push_back(tok);
-			}
-			else if ((*rit)[Tok::String].length() > 0){
-				tok.type = Tok::String;
-				tok.index = prog.strings.size();
-				// TODO: check for escape sequences
-				prog.strings.push_back((*rit)[Tok::StringContent].str());
-				// check for newlines
-				int nls = count(rit->begin(), rit->end(), '\n');
-				if (nls > 0){
-					line_number += nls;
-					line_offset = rit->position() + rit->str().rfind('\n');
+		}
+
+		// fills in prog from the source, returning false on a syntax error
+		bool tokenize_into(std::string& program, Program& prog){
+			using namespace std;
+			// set up program data structure
+			prog.groups.push_back(Group{});
+			prog.groups.back().push_back(Line{});
+			prog.group_kinds.push_back('(');
+			// set up stack to track current group
+			stack<Token> curr_group{};
+			curr_group.push(Token{ Tok::Group, 0, 0, 0 });
+			// track line and column number for debugging info
+			int line_number = 1;
+			int line_offset = 0;
+			regex em_rgx{ emily_regex };
+			// for each regex match, test the length of each submatch
+			// nonzero submatch length indicates the type of token matched
+			for (rgx_it rit{ program.begin(), program.end(), em_rgx }, rend{}; rit != rend; ++rit){
+				Token tok{ -1, -1, line_number, rit->position() - line_offset };
+				if ((*rit)[Tok::HexNumber].length() > 0){
+					// skip over the 0x
+					const char* digits = program.c_str() + rit->position() + 2;
+					push_literal(prog, tok, digits, digits + rit->length() - 2, 16);
+					prog.groups[curr_group.top().index].back().push_back(tok);
 				}
-				prog.groups[curr_group.top().index].back().push_back(tok);
-			}
-			else if ((*rit)[Tok::Symbol].length() > 0){
-				tok.type = Tok::Symbol;
-				tok.index = prog.sym(rit->str());
-				prog.groups[curr_group.top().index].back().push_back(tok);
-			}
-			else if ((*rit)[Tok::Group].length() > 0){
-				// TODO: elide redundant groups here?
-				tok.type = Tok::Group;
-				tok.index = prog.groups.size();
-				prog.group_kinds.push_back(program[rit->position()]);
-				prog.groups[curr_group.top().index].back().push_back(tok);
-				// add the new group to the list and push its token to the stack
-				curr_group.push(tok);
-				prog.groups.push_back(Group{});
-				prog.groups.back().push_back(Line{});
-			}
-			else if ((*rit)[Tok::GroupClose].length() > 0){
-				if (program[rit->position()] != closer(prog.group_kinds[curr_group.top().index])){
-					syntax_error(tok, "incorrect group closer");
-					return{};
+				else if ((*rit)[Tok::OctNumber].length() > 0){
+					// skip over the 0o
+					const char* digits = program.c_str() + rit->position() + 2;
+					push_literal(prog, tok, digits, digits + rit->length() - 2, 8);
+					prog.groups[curr_group.top().index].back().push_back(tok);
 				}
-				if (curr_group.size() <= 1){
-					syntax_error(tok, "unmatched group closer");
-					return{};
+				else if ((*rit)[Tok::BinNumber].length() > 0){
+					// skip over the 0b
+					const char* digits = program.c_str() + rit->position() + 2;
+					push_literal(prog, tok, digits, digits + rit->length() - 2, 2);
+					prog.groups[curr_group.top().index].back().push_back(tok);
 				}
-				curr_group.pop();
-			}
-			else if ((*rit)[Tok::Newline].length() > 0){
-				if (program[rit->position()] == '\n'){
-					++line_number;
+				else if ((*rit)[Tok::FloatNumber].length() > 0){
+					const char* digits = program.c_str() + rit->position();
+					push_literal(prog, tok, digits, digits + rit->length(), 10);
+					prog.groups[curr_group.top().index].back().push_back(tok);
+				}
+				else if ((*rit)[Tok::Word].length() > 0){
+					tok.type = Tok::Word;
+					tok.index = prog.intern(rit->str());
+					prog.groups[curr_group.top().index].back().push_back(tok);
+				}
+				else if ((*rit)[Tok::String].length() > 0){
+					tok.type = Tok::String;
+					tok.index = prog.strings.size();
+					// TODO: check for escape sequences
+					prog.strings.push_back((*rit)[Tok::StringContent].str());
+					// check for newlines
+					int nls = count(rit->begin(), rit->end(), '\n');
+					if (nls > 0){
+						line_number += nls;
+						line_offset = rit->position() + rit->str().rfind('\n');
+					}
+					prog.groups[curr_group.top().index].back().push_back(tok);
+				}
+				else if ((*rit)[Tok::Symbol].length() > 0){
+					tok.type = Tok::Symbol;
+					tok.index = prog.sym(rit->str());
+					prog.groups[curr_group.top().index].back().push_back(tok);
+				}
+				else if ((*rit)[Tok::Group].length() > 0){
+					// TODO: elide redundant groups here?
+					tok.type = Tok::Group;
+					tok.index = prog.groups.size();
+					prog.group_kinds.push_back(program[rit->position()]);
+					prog.groups[curr_group.top().index].back().push_back(tok);
+					// add the new group to the list and push its token to the stack
+					curr_group.push(tok);
+					prog.groups.push_back(Group{});
+					prog.groups.back().push_back(Line{});
+				}
+				else if ((*rit)[Tok::GroupClose].length() > 0){
+					if (program[rit->position()] != closer(prog.group_kinds[curr_group.top().index])){
+						syntax_error(tok, "incorrect group closer");
+						return false;
+					}
+					if (curr_group.size() <= 1){
+						syntax_error(tok, "unmatched group closer");
+						return false;
+					}
+					curr_group.pop();
+				}
+				else if ((*rit)[Tok::Newline].length() > 0){
+					if (program[rit->position()] == '\n'){
+						++line_number;
+						line_offset = rit->position() + rit->length();
+					}
+					// only add new line if current line is not empty
+					if (!prog.groups[curr_group.top().index].back().empty())
+						prog.groups[curr_group.top().index].push_back(Line{});
+				}
+				else if ((*rit)[Tok::LineStitch].length() > 0){
+					line_number += count(rit->begin(), rit->end(), '\n');
 					line_offset = rit->position() + rit->length();
 				}
-				// only add new line if current line is not empty
-				if (!prog.groups[curr_group.top().index].back().empty())
-					prog.groups[curr_group.top().index].push_back(Line{});
-			}
-			else if ((*rit)[Tok::LineStitch].length() > 0){
-				line_number += count(rit->begin(), rit->end(), '\n');
-				line_offset = rit->position() + rit->length();
+				else if ((*rit)[Tok::Unrecognized].length() > 0){
+					syntax_error(tok, "unrecognized character");
+					return false;
+				}
+				// for other cases, do nothing
 			}
-			else if ((*rit)[Tok::Unrecognized].length() > 0){
-				syntax_error(tok, "unrecognized character");
-				return{};
+			// make sure all groups were closed
+			if (curr_group.size() > 1){
+				syntax_error(curr_group.top(), "unmatched group opener");
+				return false;
 			}
-			// for other cases, do nothing
+			return true;
 		}
-		// make sure all groups were closed
-		if (curr_group.size() > 1){
-			syntax_error(curr_group.top(), "unmatched group opener");
-			return{};
+	}
+
+	/**
+	 *	Program tokenize(std::string)
+	 *	takes a string containing the program to be tokenized
+	 *	outputs a structure representing the program
+	 */
+	Program tokenize(std::string program){
+		Program prog{};
+		bool ok;
+		{
+			EMILY_PHASE(Tokenize, prog);
+			ok = tokenize_into(program, prog);
 		}
+		if (!ok) return{};
 		return prog;
 	}
 
+	namespace{
+		void write_token(std::ostream& os, const Program& prog, const Token& tk){
+			switch (tk.type){
+			case Tok::Number:
+				os << format_number(prog.numbers[tk.index]);
+				break;
+			case Tok::Integer:
+				os << format_integer(prog.integers[tk.index]);
+				break;
+			case Tok::String:
+				os << '"' << prog.strings[tk.index] << '"';
+				break;
+			case Tok::Symbol:
+				os << prog.symbols[tk.index];
+				break;
+			case Tok::Atom:
+				os << '.';
+			case Tok::Word:
+				os << prog.word(tk.index);
+				break;
+			case Tok::Group:
+				os << prog.group_kinds[tk.index] << tk.index << closer(prog.group_kinds[tk.index]);
+				break;
+			case Tok::Closure:
+				os << '^' << prog.group_kinds[prog.closures[tk.index].group_idx]
+					<< prog.closures[tk.index].group_idx << closer(prog.group_kinds[prog.closures[tk.index].group_idx]);
+				break;
+			case Tok::Branch:{
+				const BranchInfo& br = prog.branches[tk.index];
+				os << '<' << keyword_name(br.op);
+				for (int i = 0; i < (br.op == Kw::Tern ? 3 : 2); ++i){
+					os << ' ';
+					write_token(os, prog, br.operands[i]);
+				}
+				os << '>';
+				break;
+			}
+			default:
+				os << "!ERROR!";
+				break;
+			}
+		}
+	}
+
 	std::ostream& operator<<(std::ostream& os, Program prog){
 		int g = 0;
 		for (const auto& group : prog.groups){
@@ -152,33 +253,8 @@ namespace emily{
 				os << prog.group_kinds[g] << g << closer(prog.group_kinds[g]) << ":\n";
 			++g;
 			for (const auto& ln : group){
-				for (auto tk : ln){
-					switch (tk.type){
-					case Tok::Number:
-						os << prog.numbers[tk.index];
-						break;
-					case Tok::String:
-						os << '"' << prog.strings[tk.index] << '"';
-						break;
-					case Tok::Symbol:
-						os << prog.symbols[tk.index];
-						break;
-					case Tok::Atom:
-						os << '.';
-					case Tok::Word:
-						os << prog.words[tk.index];
-						break;
-					case Tok::Group:
-						os << prog.group_kinds[tk.index] << tk.index << closer(prog.group_kinds[tk.index]);
-						break;
-					case Tok::Closure:
-						os << '^' << prog.group_kinds[prog.closures[tk.index].group_idx]
-							<< prog.closures[tk.index].group_idx << closer(prog.group_kinds[prog.closures[tk.index].group_idx]);
-						break;
-					default:
-						os << "!ERROR!";
-						break;
-					}
+				for (const auto& tk : ln){
+					write_token(os, prog, tk);
 					os << ' ';
 				}
 				os << '\n';
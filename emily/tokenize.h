@@ -38,6 +38,8 @@ namespace emily{
 			Unrecognized,
 			Atom,
 			Closure,
+			Branch,
+			Integer,
 			Error
 		};
 	}
@@ -55,19 +57,44 @@ namespace emily{
 		bool has_return;
 	};
 
+	// control flow lowered by lower_control_flow from and, or, xor, tern, if or while
+	// applied to literal closures; a closure operand becomes its body, run in place
+	struct BranchInfo{
+		int op;				// keyword of the builtin the branch replaces
+		Token operands[3];	// tern has three operands, the others two
+	};
+
 	typedef std::list<Token> Line;
 	typedef std::vector<Line> Group;
 
+	// identifies one Program object, for caches that must not outlive it
+	// unlike its address, an id is never reused, and a copy gets a new one,
+	// since the copy may grow differently, as does a program assigned new contents
+	struct ProgramId{
+		unsigned long long value;
+
+		ProgramId();
+		ProgramId(const ProgramId&) : ProgramId(){}
+		ProgramId& operator=(const ProgramId&){ value = ProgramId{}.value; return *this; }
+	};
+
 	struct Program{
 		std::vector<Group> groups;
 		std::vector<double> numbers;
+		// whole literals, which Integer tokens index; numbers holds the rest
+		std::vector<long long> integers;
 		std::vector<std::string> strings;
 		std::vector<std::string> symbols;
+		// user words; keywords come first in word indices, so user word i has index Kw::Count + i
 		std::vector<std::string> words;
 		std::vector<char> group_kinds;
 		std::vector<ClosureInfo> closures;
+		std::vector<BranchInfo> branches;
+		ProgramId id;
 
 		int intern(std::string str);
+		// spelling of the word with index i
+		const std::string& word(int i) const;
 		int sym(std::string str);
 	};
 
@@ -0,0 +1,537 @@
+// translate.cpp
+
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <set>
+#include <sstream>
+#include "translate.h"
+
+namespace emily{
+
+	namespace{
+		// a construct the translator cannot handle, reported at tok
+		struct Unsupported{
+			Token tok;
+			const char* msg;
+		};
+
+		// a variable, resolved when translating
+		struct Var{
+			std::string name;	// C++ name
+			int function;		// closure the variable is bound to once and for all, or -1
+			bool member;		// top level variables are members, visible to every function
+		};
+
+		// an Emily scope: the top level, a closure call, or a brace group
+		struct Scope{
+			int parent;
+			int frame;					// closure whose C++ function holds the scope, -1 for the top level
+			std::map<int, int> vars;	// word to variable
+			std::set<int> defined;		// words let so far, in the order the function runs
+		};
+
+		// what a token evaluates to: C++ code for a Value, or something
+		// applied to the tokens after it that is resolved when translating
+		struct Operand{
+			std::string code;
+			int function;	// closure called directly, or -1
+			int keyword;	// builtin, or -1
+		};
+
+		Operand value_operand(const std::string& code){
+			return Operand{ code, -1, -1 };
+		}
+
+		// name of the aot.h function for an operator method, or null
+		const char* operation(const std::string& method){
+			static const char* const ops[][2] = {
+				{ "plus", "add" }, { "minus", "minus" }, { "times", "times" }, { "divide", "divide" },
+				{ "mod", "mod" }, { "negate", "negate" }, { "lt", "lt" }, { "lte", "lte" },
+				{ "gt", "gt" }, { "gte", "gte" }, { "eq", "eq" }
+			};
+			for (const auto& op : ops)
+				if (method == op[0]) return op[1];
+			return nullptr;
+		}
+
+		// a C++ literal for str, escaping anything but printable characters
+		// octal escapes, unlike hex ones, cannot run into the next character
+		std::string quote(const std::string& str){
+			std::string out{ '"' };
+			for (unsigned char c : str){
+				if (c >= ' ' && c <= '~' && c != '"' && c != '\\' && c != '?') out += c;
+				else{
+					char buf[8];
+					std::sprintf(buf, "\\%03o", c);
+					out += buf;
+				}
+			}
+			return out + '"';
+		}
+
+		std::string number_literal(double num){
+			if (num != num) return "make_number(NAN)";
+			if (std::isinf(num)) return "make_number(HUGE_VAL)";
+			char buf[32];
+			std::sprintf(buf, "%.17g", num);
+			std::string str{ buf };
+			if (str.find_first_of(".e") == std::string::npos) str += ".0";
+			return "make_number(" + str + ")";
+		}
+
+		/**	Translator
+		 *	translates one function at a time into its own stream of statements,
+		 *	evaluating each operation into a new constant temporary, so operations
+		 *	run left to right as they do in the interpreter and the host compiler
+		 *	is left to fold the temporaries away
+		 */
+		class Translator{
+			const Program& prog;
+			std::vector<Var> vars;
+			std::vector<Scope> scopes;
+			// times each word is the key of .let, .set or .exportLet, and the
+			// closure of its last let; a word let once to a closure is a function
+			std::vector<int> assigned;
+			std::vector<int> bound_closure;
+			// closures bound to functions, with the scope they are defined in, in the order found
+			std::deque<std::pair<int, int>> pending;
+			std::set<int> translated;
+
+			std::ostringstream* body;
+			int indent;
+			int temps;
+			int frame;
+			int scope;
+			bool can_return;
+
+		public:
+			std::vector<std::string> members;
+			std::ostringstream declarations;
+			std::ostringstream definitions;
+
+			explicit Translator(const Program& prog)
+				: prog(prog), assigned(Kw::Count + prog.words.size(), 0), bound_closure(assigned.size(), -1),
+				body{ nullptr }, indent{ 0 }, temps{ 0 }, frame{ -1 }, scope{ -1 }, can_return{ false }{
+				for (const auto& group : prog.groups){
+					for (const auto& line : group){
+						auto tk = line.begin();
+						for (; tk != line.end(); ++tk){
+							if (!is_assignment(*tk)) continue;
+							auto key = std::next(tk);
+							if (key == line.end() || key->type != Tok::Word) continue;
+							++assigned[key->index];
+							auto val = std::next(key);
+							bound_closure[key->index] = tk == line.begin() && tk->index != Kw::Set &&
+								val != line.end() && val->type == Tok::Closure && std::next(val) == line.end() ? val->index : -1;
+						}
+					}
+				}
+			}
+
+			// translates the top level into run, then each function it reaches
+			void translate(std::ostringstream& run){
+				scope = new_scope(-1, -1);
+				collect(0);
+				body = &run;
+				indent = 2;
+				can_return = false;
+				discard(lines(0));
+				while (!pending.empty()){
+					auto next = pending.front();
+					pending.pop_front();
+					if (translated.insert(next.first).second) function(next.first, next.second);
+				}
+			}
+
+		private:
+			bool is_assignment(const Token& tok){
+				return tok.type == Tok::Atom && (tok.index == Kw::Let || tok.index == Kw::Set || tok.index == Kw::ExportLet);
+			}
+
+			bool is_function(int word){
+				return assigned[word] == 1 && bound_closure[word] >= 0;
+			}
+
+			std::string function_name(int closure){
+				int word = -1;
+				for (size_t w = 0; w < bound_closure.size() && word < 0; ++w)
+					if (bound_closure[w] == closure && is_function(w)) word = w;
+				return "fn" + std::to_string(closure) + '_' + prog.word(word);
+			}
+
+			int new_scope(int parent, int frame){
+				scopes.push_back(Scope{ parent, frame });
+				return scopes.size() - 1;
+			}
+
+			// adds a variable for each word let in the current scope by group g or
+			// the plain groups in it, which run in the same scope
+			void collect(int g){
+				for (const auto& line : prog.groups[g]){
+					for (auto tk = line.begin(); tk != line.end(); ++tk){
+						if (tk->type == Tok::Group && prog.group_kinds[tk->index] == '(') collect(tk->index);
+						if (tk->type == Tok::Branch){
+							for (const auto& operand : prog.branches[tk->index].operands)
+								if (operand.type == Tok::Group && prog.group_kinds[operand.index] == '(') collect(operand.index);
+						}
+						if (!is_assignment(*tk) || tk->index == Kw::Set) continue;
+						auto key = std::next(tk);
+						if (key == line.end() || key->type != Tok::Word || scopes[scope].vars.count(key->index)) continue;
+						Var var;
+						var.member = scope == 0;
+						var.function = is_function(key->index) ? bound_closure[key->index] : -1;
+						var.name = (var.member ? "g_" : 'l' + std::to_string(scope) + '_') + prog.word(key->index);
+						if (var.function < 0 && !var.member) declare(var.name);
+						else if (var.function < 0) members.push_back(var.name);
+						scopes[scope].vars[key->index] = vars.size();
+						vars.push_back(var);
+					}
+				}
+			}
+
+			void write_indent(){
+				for (int i = 0; i < indent; ++i) *body << '\t';
+			}
+
+			void declare(const std::string& name){
+				write_indent();
+				*body << "Value " << name << " = null();\n";
+			}
+
+			void statement(const std::string& code){
+				write_indent();
+				*body << code << '\n';
+			}
+
+			std::string temp(const std::string& code){
+				std::string name = 't' + std::to_string(temps++);
+				statement("const Value " + name + " = " + code + ';');
+				return name;
+			}
+
+			// a temporary assigned in more than one place
+			std::string result(const std::string& init){
+				std::string name = 't' + std::to_string(temps++);
+				statement("Value " + name + " = " + init + ';');
+				return name;
+			}
+
+			void open(const std::string& head){
+				statement(head + '{');
+				++indent;
+			}
+
+			void close(const std::string& tail = ""){
+				--indent;
+				statement('}' + tail);
+			}
+
+			// the variable word names here, or -1
+			// the current function's own scopes only hold what they have let so far;
+			// a closure sees the variables of outer functions whenever they are let
+			int resolve(const Token& tok){
+				for (int s = scope; s >= 0; s = scopes[s].parent){
+					const Scope& sc = scopes[s];
+					auto it = sc.vars.find(tok.index);
+					if (it == sc.vars.end()) continue;
+					if (sc.frame == frame){
+						if (sc.defined.count(tok.index)) return it->second;
+						continue;
+					}
+					const Var& var = vars[it->second];
+					if (var.function < 0 && !var.member)
+						throw Unsupported{ tok, "closures may only read their own and top level variables" };
+					return it->second;
+				}
+				return -1;
+			}
+
+			// a C++ function for closure, defined in scope parent
+			void function(int closure, int parent){
+				const ClosureInfo& clos = prog.closures[closure];
+				std::ostringstream code;
+				body = &code;
+				indent = 2;
+				temps = 0;
+				frame = closure;
+				can_return = clos.has_return;
+				scope = new_scope(parent, closure);
+				std::string params;
+				for (size_t i = 0; i < clos.bindings.size(); ++i){
+					int word = clos.bindings[i].index;
+					std::string name = "p_" + prog.word(word);
+					// a later binding of the same word shadows an earlier one
+					if (scopes[scope].vars.count(word)) name += std::to_string(i);
+					scopes[scope].vars[word] = vars.size();
+					scopes[scope].defined.insert(word);
+					vars.push_back(Var{ name, -1, false });
+					params += (i ? ", Value " : "Value ") + name;
+				}
+				collect(clos.group_idx);
+				statement("return " + lines(clos.group_idx) + ';');
+
+				std::string name = function_name(closure);
+				declarations << "\t\tValue " << name << '(' << params << ");\n";
+				definitions << "\tValue Script::" << name << '(' << params << "){\n" << code.str() << "\t}\n\n";
+			}
+
+			std::string line(const Line& ln){
+				auto tk = ln.begin();
+				if (tk->type != Tok::Atom) return chain(tk, ln.end());
+				if (!is_assignment(*tk)) throw Unsupported{ *tk, "methods of the scope cannot be translated" };
+				const Token& op = *tk++;
+				if (tk == ln.end() || tk->type != Tok::Word || std::next(tk) == ln.end())
+					throw Unsupported{ op, "assignment without a name and a value" };
+				const Token& key = *tk++;
+				if (op.index != Kw::Set && is_function(key.index) && tk->type == Tok::Closure){
+					scopes[scope].defined.insert(key.index);
+					pending.push_back(std::make_pair(tk->index, scope));
+					return "null()";
+				}
+				std::string val = chain(tk, ln.end());
+				int var;
+				if (op.index == Kw::Set){
+					var = resolve(key);
+					if (var < 0) throw Unsupported{ key, "set of a variable that is not defined" };
+					if (vars[var].function >= 0) throw Unsupported{ key, "set of a closure bound once" };
+				}
+				else{
+					auto it = scopes[scope].vars.find(key.index);
+					if (it == scopes[scope].vars.end()) throw Unsupported{ key, "let in a branch cannot be translated" };
+					var = it->second;
+					scopes[scope].defined.insert(key.index);
+				}
+				statement(vars[var].name + " = " + val + ';');
+				return "null()";
+			}
+
+			// applies each token to the value of the ones before it
+			std::string chain(Line::const_iterator tk, Line::const_iterator end){
+				const Token& first = *tk;
+				Operand cur = primary(*tk++);
+				while (tk != end) cur = apply(cur, tk, end);
+				if (cur.function >= 0 || cur.keyword >= 0) throw Unsupported{ first, "closures and builtins may only be called" };
+				return cur.code;
+			}
+
+			std::string value(const Token& tok){
+				Operand op = primary(tok);
+				if (op.function >= 0 || op.keyword >= 0) throw Unsupported{ tok, "closures and builtins may only be called" };
+				return op.code;
+			}
+
+			Operand primary(const Token& tok){
+				switch (tok.type){
+				case Tok::Integer: return value_operand("make_integer(" + std::to_string(prog.integers[tok.index]) + "LL)");
+				case Tok::Number: return value_operand(number_literal(prog.numbers[tok.index]));
+				case Tok::String: return value_operand("rt.literal(" + std::to_string(tok.index) + ')');
+				case Tok::Group: return value_operand(group(tok));
+				case Tok::Branch: return value_operand(branch(tok));
+				case Tok::Word: return word(tok);
+				case Tok::Closure: throw Unsupported{ tok, "closures not bound once by name cannot be translated" };
+				default: throw Unsupported{ tok, "this cannot be translated" };
+				}
+			}
+
+			Operand word(const Token& tok){
+				int var = resolve(tok);
+				if (var >= 0){
+					if (vars[var].function >= 0) return Operand{ "", vars[var].function, -1 };
+					return value_operand(temp(vars[var].name));
+				}
+				if (tok.index == Kw::Return && !can_return) throw Unsupported{ tok, "return outside a closure that can return" };
+				switch (tok.index){
+				case Kw::Null: return value_operand("null()");
+				case Kw::True: return value_operand("boolean(true)");
+				case Kw::Ln:
+				case Kw::Sp:
+					statement(std::string{ tok.index == Kw::Ln ? "ln" : "sp" } + "(out);");
+					return value_operand("null()");
+				case Kw::Print: case Kw::Println: case Kw::Not: case Kw::Do: case Kw::Return:
+					return Operand{ "", -1, tok.index };
+				default:
+					if (tok.index < Kw::Count) throw Unsupported{ tok, "this builtin cannot be translated" };
+					throw Unsupported{ tok, "variable is not defined here" };
+				}
+			}
+
+			Operand apply(const Operand& cur, Line::const_iterator& tk, Line::const_iterator end){
+				const Token& at = *tk;
+				if (cur.function >= 0){
+					size_t argc = prog.closures[cur.function].bindings.size();
+					if (argc == 0) throw Unsupported{ at, "closures without arguments are called with do" };
+					std::string args;
+					for (size_t i = 0; i < argc; ++i){
+						if (tk == end) throw Unsupported{ at, "closures must be called with all their arguments" };
+						args += (i ? ", " : "") + value(*tk++);
+					}
+					return value_operand(temp(function_name(cur.function) + '(' + args + ')'));
+				}
+				if (cur.keyword == Kw::Do){
+					Operand fn = primary(*tk++);
+					if (fn.function < 0 || !prog.closures[fn.function].bindings.empty())
+						throw Unsupported{ at, "do is only translated for closures without arguments" };
+					return value_operand(temp(function_name(fn.function) + "()"));
+				}
+				if (cur.keyword >= 0){
+					std::string arg = value(*tk++);
+					switch (cur.keyword){
+					case Kw::Print: statement("print(out, mm, prog, " + arg + ");"); break;
+					case Kw::Println: statement("println(out, mm, prog, " + arg + ");"); break;
+					case Kw::Not: return value_operand(temp("boolean(!truthy(" + arg + "))"));
+					case Kw::Return:
+						// the rest of the line never runs
+						statement("return " + arg + ';');
+						tk = end;
+						break;
+					}
+					return value_operand("null()");
+				}
+				const char* op = at.type == Tok::Atom ? operation(prog.word(at.index)) : nullptr;
+				if (op == nullptr) throw Unsupported{ at, "only arithmetic and comparison can be applied to values" };
+				++tk;
+				if (at.index == Kw::Negate) return value_operand(temp(std::string{ "negate(mm, " } + cur.code + ')'));
+				if (tk == end) throw Unsupported{ at, "methods must be called with their argument" };
+				std::string rhs = value(*tk++);
+				if (at.index == Kw::Eq) return value_operand(temp("eq(" + cur.code + ", " + rhs + ')'));
+				return value_operand(temp(std::string{ op } + "(mm, " + cur.code + ", " + rhs + ')'));
+			}
+
+			// runs the lines of group g, returning the value of the last
+			std::string lines(int g){
+				std::string val = "null()";
+				for (const auto& line : prog.groups[g]){
+					if (line.empty()) continue;
+					discard(val);
+					val = this->line(line);
+				}
+				return val;
+			}
+
+			// marks a temporary whose value is not used as used, for the host compiler
+			void discard(const std::string& val){
+				if (val[0] == 't') statement("(void)" + val + ';');
+			}
+
+			// the value of the last line of a group; braces are a scope of their own
+			std::string group(const Token& tok){
+				char kind = prog.group_kinds[tok.index];
+				if (kind == '[') throw Unsupported{ tok, "objects cannot be translated" };
+				if (kind == '(') return lines(tok.index);
+				std::string res = result("null()");
+				open("");
+				int outer = scope;
+				scope = new_scope(outer, frame);
+				collect(tok.index);
+				statement(res + " = " + lines(tok.index) + ';');
+				scope = outer;
+				close();
+				return res;
+			}
+
+			std::string branch(const Token& tok){
+				const BranchInfo& br = prog.branches[tok.index];
+				switch (br.op){
+				case Kw::Tern:{
+					std::string cond = value(br.operands[0]);
+					std::string res = result("null()");
+					open("if (truthy(" + cond + "))");
+					statement(res + " = " + value(br.operands[1]) + ';');
+					close(" else{");
+					++indent;
+					statement(res + " = " + value(br.operands[2]) + ';');
+					close();
+					return res;
+				}
+				case Kw::If:{
+					std::string cond = value(br.operands[0]);
+					open("if (truthy(" + cond + "))");
+					discard(value(br.operands[1]));
+					close();
+					return "null()";
+				}
+				case Kw::While:
+					open("for (;;)");
+					statement("if (!truthy(" + value(br.operands[0]) + ")) break;");
+					discard(value(br.operands[1]));
+					close();
+					return "null()";
+				case Kw::And:{
+					std::string res = result("null()");
+					open("if (truthy(" + value(br.operands[0]) + "))");
+					statement(res + " = boolean(truthy(" + value(br.operands[1]) + "));");
+					close();
+					return res;
+				}
+				case Kw::Or:{
+					std::string res = result("boolean(true)");
+					open("if (!truthy(" + value(br.operands[0]) + "))");
+					statement(res + " = boolean(truthy(" + value(br.operands[1]) + "));");
+					close();
+					return res;
+				}
+				case Kw::Xor:{
+					std::string a = value(br.operands[0]);
+					std::string b = value(br.operands[1]);
+					return temp("boolean(truthy(" + a + ") != truthy(" + b + "))");
+				}
+				default:
+					throw Unsupported{ tok, "this branch cannot be translated" };
+				}
+			}
+		};
+	}
+
+	bool translate(const Program& prog, std::ostream& out, const std::string& source){
+		Translator tr{ prog };
+		std::ostringstream run;
+		try{
+			tr.translate(run);
+		}
+		catch (Unsupported& e){
+			syntax_error(e.tok, e.msg);
+			return false;
+		}
+
+		out << "// translated from " << source << " by emilyc\n\n"
+			<< "#include <cmath>\n"
+			<< "#include \"aot.h\"\n\n"
+			<< "namespace{\n\n"
+			<< "\tusing namespace emily;\n"
+			<< "\tusing namespace emily::aot;\n\n"
+			<< "\tconst Literal literals[] = {\n";
+		for (const auto& str : prog.strings)
+			out << "\t\t{ " << quote(str) << ", " << str.size() << " },\n";
+		out << "\t\t{ nullptr, 0 }\n"
+			<< "\t};\n\n"
+			<< "\tclass Script{\n"
+			<< "\t\tRuntime& rt;\n"
+			<< "\t\tMemoryManager& mm;\n"
+			<< "\t\tOutput& out;\n"
+			<< "\t\tconst Program& prog;\n";
+		for (const auto& name : tr.members)
+			out << "\t\tValue " << name << ";\n";
+		out << "\n"
+			<< "\tpublic:\n"
+			<< "\t\texplicit Script(Runtime& rt) : rt(rt), mm(rt.mm), out(rt.out), prog(rt.program()){\n";
+		for (const auto& name : tr.members)
+			out << "\t\t\t" << name << " = null();\n";
+		out << "\t\t}\n\n"
+			<< "\t\tvoid run();\n\n"
+			<< "\tprivate:\n"
+			<< tr.declarations.str()
+			<< "\t};\n\n"
+			<< tr.definitions.str()
+			<< "\tvoid Script::run(){\n"
+			<< run.str()
+			<< "\t}\n\n"
+			<< "}\n\n"
+			<< "int main(){\n"
+			<< "\treturn emily::aot::run<Script>(literals);\n"
+			<< "}\n";
+		return true;
+	}
+
+}
@@ -0,0 +1,33 @@
+// translate.h
+
+#ifndef __TRANSLATE_H__
+#define __TRANSLATE_H__
+
+#include <ostream>
+#include "tokenize.h"
+
+namespace emily{
+
+	/**	Ahead of time translator
+	 *	writes a program, after do_macros, elide_groups and lower_control_flow,
+	 *	as one C++ translation unit that runs it against the runtime in aot.h,
+	 *	so nothing is tokenized, expanded or dispatched when it runs
+	 *	each closure bound by name once becomes a member function called directly,
+	 *	each variable a C++ variable, string literals static data, and lowered
+	 *	branches if and for statements
+	 *	programs may use numbers, strings, true and null, variables, arithmetic and
+	 *	comparison methods, calls of named closures with all their arguments, return,
+	 *	do, not, print, println, ln, sp, and control flow lower_control_flow lowered;
+	 *	a closure may read its own variables and those of the top level
+	 *	objects, closures used as values, and anything else are syntax errors
+	 *	variables are declared when their scope starts, so a top level variable
+	 *	read by a closure before it is defined is null instead of an error
+	 *	and, or and xor give true or null
+	 */
+	// writes the translation of prog to out, naming source in its header comment
+	// returns false after reporting the first construct it cannot translate
+	bool translate(const Program& prog, std::ostream& out, const std::string& source);
+
+}
+
+#endif
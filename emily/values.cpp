@@ -2,19 +2,87 @@
 
 #include "values.h"
 
-size_t std::hash<emily::Value>::operator()(const emily::Value& arg){
-	if (arg.type == emily::ValType::Number)
-		return std::hash<int>()((int)arg.type) ^ std::hash<double>()(arg.number);
+const char* emily::type_name(emily::ValType type){
+	static const char* names[] = {
+		"Null", "True", "Number", "Integer", "Atom", "BuiltinFunction", "String",
+		"UserClosure", "BuiltinClosure", "Table", "Continuation"
+	};
+	return names[(int)type];
+}
+
+const char* emily::String::data() const{
+	return buffer ? buffer->data() + offset : "";
+}
+
+std::string emily::String::str() const{
+	return buffer ? buffer->substr(offset, length) : std::string{};
+}
+
+#include <cstring>
+
+namespace{
+	// finds the long long num is exactly equal to, if there is one
+	bool integral(double num, long long& out){
+		// long long holds [-2^63, 2^63), both of which are exact as doubles; NaN fails too
+		if (!(num >= -9223372036854775808.0 && num < 9223372036854775808.0)) return false;
+		long long i = (long long)num;
+		if ((double)i != num) return false;
+		out = i;
+		return true;
+	}
+
+	bool same_number(long long i, double num){
+		long long j;
+		return integral(num, j) && i == j;
+	}
+}
+
+// mixes the type and payload of a value so small numbers and
+// neighbouring indices spread over the whole hash
+// objects, strings included, hash by index, as they compare by index
+size_t std::hash<emily::Value>::operator()(const emily::Value& arg) const{
+	unsigned long long bits;
+	emily::ValType type = arg.type;
+	long long i;
+	if (arg.type == emily::ValType::Integer)
+		bits = (unsigned long long)arg.integer;
+	else if (arg.type == emily::ValType::Number){
+		// a whole number hashes like the Integer it equals, which also
+		// makes 0.0 and -0.0 hash equal
+		if (integral(arg.number, i)){
+			bits = (unsigned long long)i;
+			type = emily::ValType::Integer;
+		}
+		else std::memcpy(&bits, &arg.number, sizeof bits);
+	}
+	else if (arg.type == emily::ValType::True || arg.type == emily::ValType::Null)
+		bits = 0;
 	else
-		return std::hash<int>()((int)arg.type) ^ std::hash<int>()(arg.index);
+		bits = (unsigned)arg.index;
+	bits ^= (unsigned long long)type << 56;
+	// splitmix64 finalizer
+	bits ^= bits >> 30;
+	bits *= 0xbf58476d1ce4e5b9ULL;
+	bits ^= bits >> 27;
+	bits *= 0x94d049bb133111ebULL;
+	bits ^= bits >> 31;
+	return (size_t)bits;
 }
 
-bool operator==(emily::Value l, emily::Value r){
-	if (l.type != r.type) return false;
+bool emily::operator==(emily::Value l, emily::Value r){
+	if (l.type != r.type){
+		if (l.type == emily::ValType::Integer && r.type == emily::ValType::Number)
+			return same_number(l.integer, r.number);
+		if (l.type == emily::ValType::Number && r.type == emily::ValType::Integer)
+			return same_number(r.integer, l.number);
+		return false;
+	}
 	if (l.type == emily::ValType::Number)
 		return l.number == r.number;
+	else if (l.type == emily::ValType::Integer)
+		return l.integer == r.integer;
 	else if (l.type == emily::ValType::True || l.type == emily::ValType::Null)
 		return true;
 	else
 		return l.index == r.index;
-}
\ No newline at end of file
+}
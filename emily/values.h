@@ -4,7 +4,8 @@
 #define __VALUES_H__
 
 #include <functional>
-#include <unordered_map>
+#include <memory>
+#include <string>
 #include <vector>
 #include "tokenize.h"
 
@@ -14,19 +15,27 @@ namespace emily{
 		// singleton types: no need to store a value
 		Null,
 		True,
-		// simple type: value stored in place
+		// simple types: value stored in place
 		Number,
+		// whole number that arithmetic keeps exact until it overflows into a Number
+		Integer,
 		// value interned in program structure
 		Atom,
+		// index in the builtin registry
+		BuiltinFunction,
 		// complex values: memory needs to be managed
 		String,
-		BuiltinFunction,
 		UserClosure,
 		BuiltinClosure,
 		Table,
 		Continuation
 	};
 
+	const int ValTypeCount = (int)ValType::Continuation + 1;
+
+	// name of a type, for diagnostics
+	const char* type_name(ValType type);
+
 	enum class ClosureThis{
 		Blank,
 		Never,
@@ -38,10 +47,60 @@ namespace emily{
 		ValType type;
 		union{
 			double number;
+			long long integer;
 			int index;
 		};
 	};
 
+	// constructs a value referring to an object by index
+	// aggregate init would store the index in the number member
+	inline Value make_value(ValType type, int index){
+		Value val;
+		val.type = type;
+		val.index = index;
+		return val;
+	}
+
+	inline Value make_number(double number){
+		Value val;
+		val.type = ValType::Number;
+		val.number = number;
+		return val;
+	}
+
+	inline Value make_integer(long long integer){
+		Value val;
+		val.type = ValType::Integer;
+		val.integer = integer;
+		return val;
+	}
+
+	inline bool is_number(Value val){
+		return val.type == ValType::Number || val.type == ValType::Integer;
+	}
+
+	// the value of a Number or Integer as a double
+	inline double number_value(Value val){
+		return val.type == ValType::Integer ? (double)val.integer : val.number;
+	}
+
+	/**	Immutable string
+	 *	a view of length characters into a shared buffer, starting at offset
+	 *	substrings share the buffer of the string they were taken from
+	 *	the string ending at the end of its buffer may extend the buffer in place,
+	 *	so repeated appends do not copy the whole string each time
+	 */
+	struct String{
+		std::shared_ptr<std::string> buffer;
+		size_t offset;
+		size_t length;
+		size_t hash;	// cached hash, 0 if not yet computed
+		bool interned;
+
+		const char* data() const;
+		std::string str() const;
+	};
+
 	struct UserClosure{
 		std::vector<Value> bound;
 		ClosureInfo info;
@@ -50,10 +109,8 @@ namespace emily{
 		ClosureThis thisKind;
 	};
 
-	typedef std::function<Value(std::vector<Value>)> BuiltinFun;
-
 	struct BuiltinClosure{
-		BuiltinFun fn;
+		int builtin;	// index in the builtin registry
 		std::vector<Value> bound;
 		Value thisBindings[2];
 		int argc;
@@ -82,20 +139,23 @@ namespace emily{
 		Token position;
 	};
 
-	typedef std::unordered_map<Value, Value> Table;
-
 	// operator== for values
-	// for bools and numbers does value equality
+	// for bools and numbers does value equality, so an Integer equals
+	// a Number of exactly the same value, and they hash alike
 	// for others, index equality
 	bool operator==(Value l, Value r);
 
 }
 
-template<>
-struct std::hash<emily::Value>{
-	typedef size_t result_type;
-	typedef emily::Value argument_type;
-	size_t operator()(const emily::Value& arg);
-};
+namespace std{
+
+	template<>
+	struct hash<emily::Value>{
+		typedef size_t result_type;
+		typedef emily::Value argument_type;
+		size_t operator()(const emily::Value& arg) const;
+	};
+
+}
 
 #endif
@@ -0,0 +1,33 @@
+// check.h
+// a minimal harness for the tests: each test is an executable that reports
+// every check that fails and exits with status 1 if any did
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include <cstdio>
+
+namespace emily_test{
+
+	inline int& failures(){
+		static int count = 0;
+		return count;
+	}
+
+	inline void check(bool ok, const char* expr, const char* file, int line){
+		if (ok) return;
+		std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+		++failures();
+	}
+
+	inline int result(){
+		if (failures() == 0) return 0;
+		std::fprintf(stderr, "%d checks failed\n", failures());
+		return 1;
+	}
+
+}
+
+#define CHECK(cond) emily_test::check((cond), #cond, __FILE__, __LINE__)
+
+#endif
@@ -0,0 +1,94 @@
+// cycles_test.cpp
+// the cycle collector with a traversal budget
+
+#include "check.h"
+#include "memory.h"
+#include "table.h"
+
+using namespace emily;
+
+namespace{
+
+	size_t live_tables(MemoryManager& mm){
+		return mm.snapshot().pools[(int)ValType::Table].live;
+	}
+
+	// n tables, each holding the next, the last holding the first
+	// returns the first, with the only reference from outside
+	Value ring(MemoryManager& mm, int n){
+		Value first = mm.create(ValType::Table);
+		Value prev = first;
+		for (int i = 1; i < n; ++i){
+			Value next = mm.create(ValType::Table);
+			mm.get<Table>(prev)[make_integer(0)] = next;
+			prev = next;
+		}
+		mm.get<Table>(prev)[make_integer(0)] = mm.ref(first);
+		return first;
+	}
+
+	// a cycle larger than the budget is collected over several runs
+	void cycle_larger_than_budget(){
+		MemoryManager mm;
+		mm.set_cycle_threshold(0);
+		Value first = ring(mm, 100);
+		mm.deref(first);
+		CHECK(live_tables(mm) == 100);
+		CHECK(mm.snapshot().suspects == 1);
+
+		mm.collect_cycles(10);
+		CHECK(live_tables(mm) == 100);
+		CHECK(mm.snapshot().suspects == 1);
+		int runs = 1;
+		while (live_tables(mm) != 0 && runs < 20){
+			mm.collect_cycles(10);
+			++runs;
+		}
+		CHECK(live_tables(mm) == 0);
+		CHECK(mm.snapshot().suspects == 0);
+		// the budget doubles from 10 to at least 100
+		CHECK(runs <= 5);
+		CHECK(mm.cycle_stats().objects == 100);
+	}
+
+	// a live structure larger than the budget is dropped as a suspect once traversed
+	void live_structure_larger_than_budget(){
+		MemoryManager mm;
+		mm.set_cycle_threshold(0);
+		Value first = ring(mm, 100);
+		mm.ref(first);
+		mm.deref(first);
+		int runs = 0;
+		while (mm.snapshot().suspects != 0 && runs < 20){
+			mm.collect_cycles(10);
+			++runs;
+		}
+		CHECK(mm.snapshot().suspects == 0);
+		CHECK(live_tables(mm) == 100);
+		CHECK(mm.cycle_stats().objects == 0);
+		mm.deref(first);
+		mm.collect_cycles();
+		CHECK(live_tables(mm) == 0);
+	}
+
+	// a suspect is buffered once however often it is decremented
+	void suspect_buffered_once(){
+		MemoryManager mm;
+		mm.set_cycle_threshold(0);
+		Value t = mm.create(ValType::Table);
+		for (int i = 0; i < 10; ++i) mm.ref(t);
+		for (int i = 0; i < 10; ++i) mm.deref(t);
+		CHECK(mm.snapshot().suspects == 1);
+		mm.deref(t);
+		mm.collect_cycles();
+		CHECK(live_tables(mm) == 0);
+	}
+
+}
+
+int main(){
+	cycle_larger_than_budget();
+	live_structure_larger_than_budget();
+	suspect_buffered_once();
+	return emily_test::result();
+}
@@ -0,0 +1,67 @@
+// literal_test.cpp
+// the literal cache follows a program's contents, not its address
+
+#include <memory>
+#include "check.h"
+#include "memory.h"
+
+using namespace emily;
+
+namespace{
+
+	Program with_string(const char* str){
+		Program prog;
+		prog.strings.push_back(str);
+		return prog;
+	}
+
+	// a program assigned new contents gets the new literals
+	void assigned_program(){
+		MemoryManager mm;
+		Program prog = with_string("first");
+		Value a = mm.literal(prog, 0);
+		CHECK(mm.string(a).str() == "first");
+		prog = with_string("second");
+		Value b = mm.literal(prog, 0);
+		CHECK(mm.string(b).str() == "second");
+		mm.deref(a);
+		mm.deref(b);
+	}
+
+	// a pool built for a program does not serve what is assigned over it
+	void assigned_program_with_constants(){
+		Program prog = with_string("first");
+		MemoryManager mm;
+		mm.set_constants(std::make_shared<const ConstantPool>(prog));
+		Value a = mm.literal(prog, 0);
+		CHECK(is_constant(a));
+		CHECK(mm.string(a).str() == "first");
+		prog = with_string("second");
+		Value b = mm.literal(prog, 0);
+		CHECK(!is_constant(b));
+		CHECK(mm.string(b).str() == "second");
+		mm.deref(a);
+		mm.deref(b);
+	}
+
+	// a copy keeps the literals but not the cache
+	void copied_program(){
+		MemoryManager mm;
+		Program prog = with_string("first");
+		Program copy = prog;
+		CHECK(copy.id.value != prog.id.value);
+		Value a = mm.literal(prog, 0);
+		Value b = mm.literal(copy, 0);
+		CHECK(mm.string(b).str() == "first");
+		mm.deref(a);
+		mm.deref(b);
+	}
+
+}
+
+int main(){
+	assigned_program();
+	assigned_program_with_constants();
+	copied_program();
+	return emily_test::result();
+}
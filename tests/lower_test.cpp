@@ -0,0 +1,58 @@
+// lower_test.cpp
+// which lines lower_control_flow turns into branches
+
+#include <string>
+#include "check.h"
+#include "macro.h"
+
+using namespace emily;
+
+namespace{
+
+	// lines of source lowered, after the front end phases before it
+	size_t lowered(const std::string& source){
+		Program prog = tokenize(source);
+		if (!do_macros(prog)) return (size_t)-1;
+		elide_groups(prog);
+		return lower_control_flow(prog);
+	}
+
+	void plain_bodies(){
+		CHECK(lowered("a = 1\nif (a) ^(println a)\n") == 1);
+		CHECK(lowered("a = 1\nwhile ^(a < 3) ^(println a)\n") == 1);
+		CHECK(lowered("a = 1\nb = a ? 1 : 2\n") == 1);
+	}
+
+	// this and super in place would be those of the enclosing closure
+	void this_and_super(){
+		CHECK(lowered("a = 1\nif (a) ^(println this)\n") == 0);
+		CHECK(lowered("a = 1\nif (a) ^(println super)\n") == 0);
+		CHECK(lowered("a = 1\nwhile ^(this.more) ^(println a)\n") == 0);
+		CHECK(lowered("a = 1\nb = a ? this : 2\n") == 0);
+		CHECK(lowered("a = 1\nif (a) ^(println this)\nif (a) ^(println a)\n") == 1);
+	}
+
+	// lowered closures keep their entries, so other closures keep their indices
+	void closure_indices(){
+		Program prog = tokenize("a = 1\nif (a) ^(println a)\nf = ^x (x)\n");
+		CHECK(do_macros(prog));
+		elide_groups(prog);
+		size_t closures = prog.closures.size();
+		CHECK(lower_control_flow(prog) == 1);
+		CHECK(prog.closures.size() == closures);
+	}
+
+	// a program that rebinds a keyword keeps its generic meaning
+	void rebound_keyword(){
+		CHECK(lowered("if = ^c ^b (b)\na = 1\nif (a) ^(println a)\n") == 0);
+	}
+
+}
+
+int main(){
+	plain_bodies();
+	this_and_super();
+	closure_indices();
+	rebound_keyword();
+	return emily_test::result();
+}
@@ -0,0 +1,86 @@
+// output_test.cpp
+// Output after a write fails
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "check.h"
+#include "output.h"
+
+using namespace emily;
+
+namespace{
+
+	const size_t Capacity = 64;
+
+	// writes to /dev/full fail with ENOSPC; the unwritten bytes kept stay within the capacity
+	void kept_bytes_are_bounded(){
+		int fd = open("/dev/full", O_WRONLY);
+		CHECK(fd >= 0);
+		{
+			Output out{ fd, Capacity, FlushPolicy::Full };
+			for (int i = 0; i < 100000; ++i) out.put('x');
+			out.write(std::string(10000, 'y'));
+			CHECK(out.error() == ENOSPC);
+			CHECK(out.pending() <= Capacity);
+			CHECK(!out.flush());
+		}
+		close(fd);
+	}
+
+	// once a write failed, nothing is written until the error is cleared
+	void no_writes_after_an_error(){
+		int fd = open("/dev/full", O_WRONLY);
+		CHECK(fd >= 0);
+		{
+			Output out{ fd, Capacity, FlushPolicy::Line };
+			out.write(std::string(2 * Capacity, 'x'));
+			CHECK(out.error() == ENOSPC);
+			size_t calls = out.syscalls();
+			for (int i = 0; i < 1000; ++i) out.put('x');
+			for (int i = 0; i < 1000; ++i) out.write("line\n", 5);
+			CHECK(!out.flush());
+			CHECK(out.syscalls() == calls);
+
+			// clearing the error tries the kept bytes again
+			out.clear_error();
+			CHECK(!out.flush());
+			CHECK(out.syscalls() == calls + 1);
+			CHECK(out.error() == ENOSPC);
+		}
+		close(fd);
+	}
+
+	// bytes kept after a failure are written once a write succeeds again
+	void kept_bytes_written_after_clear(){
+		int fds[2];
+		CHECK(pipe(fds) == 0);
+		{
+			Output out{ fds[1], Capacity, FlushPolicy::Full };
+			out.write("kept", 4);
+			// a closed descriptor fails with EBADF without raising a signal
+			int saved = dup(fds[1]);
+			close(fds[1]);
+			CHECK(!out.flush());
+			CHECK(out.error() == EBADF);
+			CHECK(out.pending() == 4);
+			dup2(saved, fds[1]);
+			close(saved);
+			out.clear_error();
+			CHECK(out.flush());
+		}
+		char buf[8];
+		CHECK(read(fds[0], buf, sizeof buf) == 4);
+		CHECK(std::string(buf, 4) == "kept");
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+}
+
+int main(){
+	kept_bytes_are_bounded();
+	no_writes_after_an_error();
+	kept_bytes_written_after_clear();
+	return emily_test::result();
+}
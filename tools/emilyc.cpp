@@ -0,0 +1,50 @@
+// emilyc.cpp
+// translates an Emily program to a C++ translation unit, to be compiled
+// and linked with emily_core into a program that runs it
+// usage: emilyc program.em [-o program.cpp]
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "macro.h"
+#include "translate.h"
+
+int main(int argc, char** argv){
+	using namespace emily;
+
+	const char* output = nullptr;
+	if (argc == 4 && std::strcmp(argv[2], "-o") == 0) output = argv[3];
+	else if (argc != 2){
+		std::fprintf(stderr, "usage: %s program.em [-o program.cpp]\n", argv[0]);
+		return 1;
+	}
+	std::ifstream in{ argv[1], std::ios::binary };
+	if (!in){
+		std::fprintf(stderr, "cannot read %s\n", argv[1]);
+		return 1;
+	}
+	std::ostringstream source;
+	source << in.rdbuf();
+
+	Program prog = tokenize(source.str());
+	if (!do_macros(prog)) return 1;
+	elide_groups(prog);
+	lower_control_flow(prog);
+
+	// written only once translated, so a failure leaves no partial file behind
+	std::ostringstream code;
+	if (!translate(prog, code, argv[1])) return 1;
+	if (output == nullptr){
+		std::cout << code.str();
+		return 0;
+	}
+	std::ofstream out{ output, std::ios::binary };
+	out << code.str();
+	if (!out){
+		std::fprintf(stderr, "cannot write %s\n", output);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+// heapdiff.cpp
+// compares two heap dumps written by write_heap_dump, showing how live objects
+// changed per type and which allocation sites grew the most
+// site counts are scaled by each dump's sampling rate to estimate all objects
+// usage: heapdiff before.heap after.heap [--top n]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <tuple>
+#include <vector>
+#include "memory.h"
+
+namespace{
+
+	using namespace emily;
+
+	struct SiteChange{
+		AllocSite site;
+		ValType type;
+		long long count;
+		long long bytes;
+	};
+
+	bool load(const char* path, HeapDump& dump){
+		std::ifstream in{ path };
+		if (in && read_heap_dump(in, dump)) return true;
+		std::fprintf(stderr, "%s is not a heap dump\n", path);
+		return false;
+	}
+
+	// adds the sites of dump to changes, scaled to all allocations, with sign
+	void add_sites(std::map<std::tuple<int, int, int>, SiteChange>& changes, const HeapDump& dump, int sign){
+		long long scale = dump.sample_every ? dump.sample_every : 1;
+		for (const auto& s : dump.sites){
+			SiteChange& c = changes[std::make_tuple(s.site.line, s.site.column, (int)s.type)];
+			c.site = s.site;
+			c.type = s.type;
+			c.count += sign * (long long)s.count * scale;
+			c.bytes += sign * (long long)s.bytes * scale;
+		}
+	}
+
+}
+
+int main(int argc, char** argv){
+	size_t top = 20;
+	if (argc == 5 && std::strcmp(argv[3], "--top") == 0) top = std::strtoul(argv[4], nullptr, 10);
+	else if (argc != 3){
+		std::fprintf(stderr, "usage: %s before.heap after.heap [--top n]\n", argv[0]);
+		return 1;
+	}
+	HeapDump before, after;
+	if (!load(argv[1], before) || !load(argv[2], after)) return 1;
+
+	std::printf("%-16s %12s %12s %14s %15s\n", "type", "count", "change", "bytes change", "retained change");
+	for (int t = (int)ValType::String; t < ValTypeCount; ++t){
+		const HeapTypeStats& b = before.types[t];
+		const HeapTypeStats& a = after.types[t];
+		std::printf("%-16s %12llu %+12lld %+14lld %+15lld\n", type_name((ValType)t), (unsigned long long)a.count,
+			(long long)a.count - (long long)b.count, (long long)a.bytes - (long long)b.bytes,
+			(long long)a.retained - (long long)b.retained);
+	}
+
+	std::map<std::tuple<int, int, int>, SiteChange> changes;
+	add_sites(changes, before, -1);
+	add_sites(changes, after, 1);
+	std::vector<SiteChange> sorted;
+	for (const auto& c : changes)
+		if (c.second.count != 0 || c.second.bytes != 0) sorted.push_back(c.second);
+	std::stable_sort(sorted.begin(), sorted.end(), [](const SiteChange& l, const SiteChange& r){
+		return l.bytes > r.bytes;
+	});
+	if (sorted.empty()){
+		if (before.sample_every == 0 || after.sample_every == 0)
+			std::printf("\nno allocation sites: sample allocations with set_site_sampling before dumping\n");
+		return 0;
+	}
+	std::printf("\n%-12s %-16s %12s %14s\n", "site", "type", "count change", "bytes change");
+	for (size_t i = 0; i < sorted.size() && i < top; ++i){
+		char pos[32];
+		std::sprintf(pos, "%d:%d", sorted[i].site.line, sorted[i].site.column);
+		std::printf("%-12s %-16s %+12lld %+14lld\n", pos, type_name(sorted[i].type), sorted[i].count, sorted[i].bytes);
+	}
+}